@@ -1,9 +1,49 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <math.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#endif
+//Allocator statistics for --soak
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define SOAK_MALLINFO 1
+#else
+#define SOAK_MALLINFO 0
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
 
 // =========================================================
 // KONSTANTEN UND TYPEN (Müssen am Anfang stehen)
@@ -14,6 +54,7 @@
 #define IDLE 0x7A89C197
 #define FRAME_SIZE 2
 #define BATCH_SIZE 16
+#define BATCH_WORDS (BATCH_SIZE + 1) // Sync + Codewörter auf dem Kanal
 #define PREAMBLE_LENGTH 576
 #define FLAG_ADDRESS 0x000000
 #define FLAG_MESSAGE 0x100000
@@ -29,12 +70,905 @@
 #define FLAG_FUNC_3 0x3 // Alpha (Text)
 typedef uint32_t FunctionCode;
 
+/**
+ * One batch as it goes on air: a sync word followed by 8 frames of 2
+ * codewords. Each pager only listens to the frame given by the low three bits
+ * of its address. The occupancy bitmap has one bit per codeword slot
+ * (bit = frame * FRAME_SIZE + word), so free slots can be found with a single
+ * bit scan instead of walking the words.
+ */
+typedef struct {
+    uint32_t sync;
+    uint32_t frames[BATCH_SIZE / FRAME_SIZE][FRAME_SIZE];
+    uint16_t occupied;
+} __attribute__((aligned(64))) Batch;
+
+#define NO_SLOT ((size_t) -1)
+
+// Viele Nachrichten auf einmal
+#define ENCODE_BLOCK 64 // Nachrichten pro Zugriff auf den gemeinsamen Zähler
+
+/**
+ * Messages to encode in one call, as parallel arrays. functionCodes may be
+ * NULL, which makes every message alphanumeric.
+ */
+typedef struct {
+    size_t count;
+    const uint32_t* addresses;
+    const FunctionCode* functionCodes;
+    const char* const* messages;
+    const uint32_t* lengths;
+} MessageArrays;
+
+/**
+ * Shared state of encodeTransmissions() while its threads run.
+ */
+typedef struct {
+    const MessageArrays* arrays;
+    uint32_t preambleLength;
+    const size_t* offsets;
+    uint32_t* out;
+    size_t next;
+    int failed;
+} EncodeJob;
+
 // PCM/Audio Konstanten
 #define SYMRATE 38400
 #define SAMPLE_RATE 22050
+#define SAMPLE_RATE_MIN 8000        // Hz, für --sample-rate
+#define SAMPLE_RATE_MAX 192000
 #define BAUD_RATE 512
 #define MIN_DELAY 1
 #define MAX_DELAY 10
+#define PCM_LEVEL (32767 / 2)
+
+/**
+ * A stretch of the rendered timeline: either a transmission, kept as its
+ * codewords, or silence (codewords == NULL).
+ */
+typedef struct {
+    uint64_t start;
+    uint64_t numSamples;
+    uint32_t* codewords;
+    size_t numCodewords;
+} PcmSegment;
+
+/**
+ * A timeline of transmissions and silences which renders any window of
+ * samples on demand. Only the codewords are stored, so hours of output cost
+ * a few kilobytes instead of gigabytes of samples.
+ */
+typedef struct {
+    uint32_t sampleRate;
+    uint32_t baudRate;
+    int16_t level;
+    PcmSegment* segments;
+    size_t numSegments;
+    size_t capacity;
+    uint64_t totalSamples;
+} PcmRenderer;
+
+// Duplikatfilter und Ratenbegrenzung
+#define DEDUP_SLOTS 4096 // Zweierpotenz, begrenzt den Speicher
+#define DEDUP_PROBES 8
+#define RATE_LIMIT_SLOTS 4096 // Zweierpotenz, begrenzt den Speicher
+#define RATE_LIMIT_WAYS 4 // Eimer je Satz
+
+/**
+ * One remembered message in the duplicate filter.
+ */
+typedef struct {
+    uint64_t hash;
+    uint64_t seenAt;
+    uint32_t used;
+} DedupEntry;
+
+typedef struct {
+    uint64_t windowMs;
+    DedupEntry entries[DEDUP_SLOTS];
+} DedupFilter;
+
+/**
+ * Token bucket for a single pager. Tokens are stored in thousandths so the
+ * refill can be done in integer arithmetic.
+ */
+typedef struct {
+    uint32_t address;
+    uint32_t used;
+    uint64_t milliTokens;
+    uint64_t lastRefill;
+} RateBucket;
+
+typedef struct {
+    uint64_t burst;
+    uint64_t periodMs;
+    RateBucket buckets[RATE_LIMIT_SLOTS];
+} RateLimiter;
+
+// Eingabe
+#define MAX_ADDRESS 2097151 // 21 Bits
+#define PARSE_OK 0
+#define PARSE_MISSING_COLON 1
+#define PARSE_TOO_MANY_COLONS 2
+#define PARSE_INVALID_FUNCTION 3
+#define PARSE_INVALID_ADDRESS 4
+#define PARSE_IGNORED 5 // Zeile enthält keine Nachricht, z.B. Kopfzeilen im Log
+#define PARSE_MALFORMED_LOG 6
+#define PARSE_RESERVED_ADDRESS 7 // Adresswort wäre SYNC oder IDLE
+#define PARSE_INVALID_ID 8       // @ID vor der Nachricht fehlerhaft
+#define INPUT_NATIVE 0   // address:message oder address:function:message
+#define INPUT_MULTIMON 1 // Ausgabe von multimon-ng
+#define INPUT_CHUNK_SIZE (4 << 20) // Bytes pro Parser-Auftrag
+#define INPUT_CHUNKS_PER_THREAD 4  // So weit dürfen die Parser vorauslaufen
+#define INPUT_LINE_SIZE 65536
+
+/**
+ * One parsed input line. The message points into the line it came from and
+ * is not null-terminated, so records can refer straight into a mapped file.
+ * If error is not PARSE_OK, the line was rejected and only the fields
+ * needed to report why are set. The position is filled in by the reader.
+ */
+typedef struct {
+    uint32_t address;
+    FunctionCode functionCode;
+    const char* message;
+    size_t length;
+    uint64_t position; // Byte-Offset der Zeile in der Eingabe
+    int error;
+} Record;
+
+// Bake / Testmuster
+#define BEACON_PAGE 0      // Eine Nachricht von stdin
+#define BEACON_PREAMBLE 1  // Dauerhafte 1010-Präambel
+#define BEACON_SYNC_IDLE 2 // Abwechselnd SYNC und IDLE
+#define PATTERN_WORDS 64   // Vielfaches von 8 Wörtern = ganze Samples
+
+// Verteilte Erzeugung
+#define MANIFEST_SUFFIX ".manifest"
+
+// Prüfsummen
+#define CRC32C_POLY 0x82F63B78 // Castagnoli, bitweise gespiegelt
+#define VERIFY_BUFFER_SIZE (8 << 20)
+
+// Konformitätstest
+#define SWEEP_MAX_CHARS 160 // mehr als drei volle Batches Text
+#define SWEEP_BLOCK 4096    // Fälle pro Zugriff auf den gemeinsamen Zähler
+#define SWEEP_MAX_REPORTS 20
+#define DECODE_OK 0
+#define DECODE_BAD_PREAMBLE 1
+#define DECODE_BAD_SYNC 2
+#define DECODE_BAD_CODEWORD 3
+#define DECODE_NO_ADDRESS 4
+#define DECODE_UNTERMINATED 5
+#define DECODE_EXTRA_WORDS 6
+
+/**
+ * A page as read back from a transmission. `text` holds every 7-bit group
+ * of the message words, so it may end in up to two NULs of padding.
+ */
+typedef struct {
+    uint32_t address;
+    FunctionCode functionCode;
+    char text[SWEEP_MAX_CHARS + 8];
+    size_t numChars;
+} DecodedPage;
+
+/**
+ * Shared state of a conformance sweep. Cases are numbered: first one per
+ * address, then every frame with every message length up to
+ * SWEEP_MAX_CHARS. Threads claim SWEEP_BLOCK cases at a time.
+ */
+typedef struct {
+    uint64_t numCases;
+    uint64_t next;
+    uint64_t failures;
+} Sweep;
+
+// Goldene Ausgaben
+#define GOLDEN_FRAME_CHARS 100  // länger als drei Batches Text
+#define GOLDEN_MAX_CHARS 128
+#define GOLDEN_LINE_SIZE 1024
+#define GOLDEN_BLOCK 16         // Fälle pro Zugriff auf den gemeinsamen Zähler
+#define GOLDEN_MAX_REPORTS 20
+#define GOLDEN_MAX_SAMPLES_PER_BIT 44 // für den Vergleich bei ganzzahligen Raten
+#define GOLDEN_MAX_WINDOW 61          // für den Vergleich mit dem Renderer
+
+/**
+ * One page of the golden corpus with the digests of its output. `line` is
+ * where it was read from, for reporting.
+ */
+typedef struct {
+    uint32_t address;
+    FunctionCode functionCode;
+    uint32_t baudRate;
+    char text[GOLDEN_MAX_CHARS];
+    size_t numChars;
+    uint32_t codewordDigest;
+    uint32_t pcmDigest;
+    size_t line;
+} GoldenCase;
+
+/**
+ * The cases of a corpus being generated or checked. Threads claim
+ * GOLDEN_BLOCK cases at a time. With `crossChecks`, each case is also
+ * compared at a whole number of samples per bit and as read back in
+ * windows from a PcmRenderer.
+ */
+typedef struct {
+    GoldenCase* cases;
+    size_t numCases;
+    size_t capacity;
+    size_t next;
+    uint64_t failures;
+    int generating;
+    int crossChecks;
+    char kernels[64];
+} GoldenCorpus;
+
+// Frame-Auslastung
+#define ANALYSIS_MAX_MOVES 256
+#define SIMULATION_MIN_BATCHES 1024
+#define SIMULATION_WINDOW 64 // Batches, die ein Sender im Voraus füllen kann
+
+/**
+ * Replays traffic as one continuous stream of batches, as a transmitter
+ * with a full queue would send it. Every message goes where
+ * batchPlaceMessage() would put it: the first free run of slots in its
+ * frame, at or after `from`, the first batch with a free slot. Batches more
+ * than SIMULATION_WINDOW behind the end are sent as they are, their free
+ * slots become idle padding. Only the occupancy of the batches from
+ * `baseBatch` on is kept. The delay of a message is the number of slots
+ * between where it would fit if it could start in any frame and where it
+ * starts in its own, the wait which its frame alone is to blame for.
+ * `failed` is set if the batches couldn't be grown, and ends the run.
+ */
+typedef struct {
+    uint16_t* occupied;
+    size_t capacity;
+    uint64_t baseBatch;
+    uint64_t from;
+    uint64_t end;
+    uint64_t numMessages;
+    uint64_t totalDelay;
+    uint64_t maxDelay;
+    int failed;
+} FrameSimulation;
+
+/**
+ * Traffic statistics for --analyse. `frames` gives the frame each address
+ * is simulated in, or is NULL for the frame it has today. The per-address
+ * counts are only gathered while `messages` is set.
+ */
+typedef struct {
+    uint32_t* messages;
+    uint64_t* codewords;
+    const uint8_t* frames;
+    FrameSimulation simulation;
+} FrameAnalysis;
+
+// Konfiguration
+#define CONFIG_LINE_SIZE 256
+#define CONFIG_MAX_DELAY 3600 // Sekunden
+#define SILENCE_CHUNK 65536   // Bytes Stille pro Schreibaufruf
+#define OUTPUT_FILE_BUFFER (1 << 20) // Ausgabepuffer, nur wenn in eine Datei geschrieben wird
+
+/**
+ * Settings which can be changed while running, see loadConfig(). The
+ * defines above are the defaults.
+ */
+typedef struct {
+    uint32_t minDelay;       // Sekunden
+    uint32_t maxDelay;       // Sekunden
+    uint32_t preambleLength; // Bits, Vielfaches von 32
+    int16_t level;           // Amplitude der Samples
+} Config;
+
+/**
+ * A config file which is read again on SIGHUP. The new Config replaces
+ * `active` in one atomic swap, so a message is always encoded with either
+ * the old or the new settings, never a mix. The encoder marks itself `busy`
+ * while it uses a Config and bumps `epoch` when done; the old Config is only
+ * freed once the encoder is seen outside of the message it was in.
+ */
+typedef struct {
+    const char* path;
+    Config* active;
+    int busy;
+    uint64_t epoch;
+} LiveConfig;
+
+// Flugschreiber
+#define RECORDER_MAGIC "PCSGREC1"
+#define RECORDER_HEADER_SIZE 4096
+#define RECORDER_ENTRIES_PER_MINUTE 600 // Übertragungen, mehr passen kaum
+#define RECORDER_MARGIN 1               // Sekunden Abstand zum Schreiber beim Auslesen
+#define RECORDER_CHUNK (1 << 20)        // Bytes pro Schreibaufruf beim Auslesen
+#define RECORDER_MAX_MINUTES 10080      // Eine Woche
+
+/**
+ * Start of a flight recorder file, see openRecorder(). The counters only
+ * ever grow: sample k of the stream is at k % capacity in the ring, entry k
+ * at k % indexCapacity. The writer bumps them after the data is in place.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t sampleRate;
+    uint32_t headerSize;
+    uint64_t capacity;      // Samples im Ring
+    uint64_t indexCapacity; // Einträge im Ring
+    uint64_t written;       // Samples insgesamt
+    uint64_t indexWritten;  // Einträge insgesamt
+} RecorderHeader;
+
+/**
+ * One transmission in the recorder, as a line of --index would have it.
+ * The offset counts from the first sample the file ever recorded.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t numSamples;
+    uint32_t address;
+    uint32_t functionCode;
+    uint32_t crc;
+    uint32_t reserved;
+} RecorderEntry;
+
+/**
+ * A flight recorder file mapped for writing: the header page, then the
+ * index ring, then the sample ring from the next page boundary on.
+ */
+typedef struct {
+    RecorderHeader* header;
+    RecorderEntry* entries;
+    uint8_t* data;
+    size_t mappingSize;
+} Recorder;
+
+// Zustandsbericht
+#define STATUS_INTERVAL_MS 1000
+#define STATUS_STALL_TIMEOUT 5  // Sekunden
+#define STATUS_WRITE_CHUNK 16384
+
+/**
+ * What the encoder publishes about its progress, for the watchdog. Only
+ * the encoder writes it, with atomic stores; times are monotonic
+ * nanoseconds, 0 if there was no write yet. `pending` counts messages
+ * accepted but not yet sent or dropped.
+ */
+typedef struct {
+    uint64_t samples;
+    uint64_t writeStarted;
+    uint64_t writeFinished;
+    int64_t pending;
+    int stalled;
+    int watched;
+} Health;
+
+/**
+ * The watchdog thread of --status and where it reports to. `lock` only
+ * keeps its reports apart from the final one at the end of the output.
+ */
+typedef struct {
+    Health* health;
+    const uint64_t* sent;
+    const char* path;
+    char* temporary;
+    uint64_t timeout;
+    uint64_t begin;
+    int stalled;
+    int finished;
+    pthread_mutex_t lock;
+} Watchdog;
+
+// Dauertest
+#define SOAK_SAMPLES 20             // Messpunkte über die ganze Dauer
+#define SOAK_MIN_INTERVAL 60        // simulierte Sekunden zwischen zwei Messpunkten
+#define SOAK_MAX_CHARS 240
+#define SOAK_LINE_SIZE 320
+#define SOAK_HEAP_SLACK 16          // Bytes Wachstum pro Nachricht, die noch als flach gelten
+#define SOAK_HEAP_MIN_GROWTH (64 << 10) // darunter füllen sich nur die Caches des Allokators
+#define SOAK_RSS_SLACK (1 << 20)
+#define SOAK_LATENCY_SLACK 0.5      // so viel langsamer am Ende ist ein Trend
+#define SOAK_LATENCY_MIN_US 50
+
+/**
+ * One measurement of a soak run. `hours` is output time, the latencies
+ * are CPU microseconds per message since the previous sample and
+ * `speed` how many times faster than real time the output was made.
+ */
+typedef struct {
+    double hours;
+    uint64_t messages;
+    uint64_t rss;
+    uint64_t heap;
+    uint64_t arena;
+    double messagesPerSecond;
+    double speed;
+    double meanLatency;
+    double maxLatency;
+} SoakSample;
+
+// Netzwerkdienst
+#define LISTEN_RING_SIZE (16 << 20) // Bytes zwischen Ereignisschleife und Kodierer, Zweierpotenz
+#define LISTEN_LINE_SIZE 4096       // längste Zeile, die ein Client schicken darf
+#define LISTEN_READ_SIZE 65536      // höchstens so viel pro read(), dann ist der Nächste dran
+#define LISTEN_MAX_EVENTS 256
+#define LISTEN_MAX_UNSENT 65536     // ungelesene Antworten, ab denen nicht mehr gelesen wird
+#define LISTEN_BENCH_CONNECTING 256 // gleichzeitige Verbindungsaufbauten im Lasttest
+#define LISTEN_MAX_FILES (1 << 20)  // höchstens so weit wird das Dateilimit angehoben
+#define CONNECTION_CLOSED 0
+#define CONNECTION_OPEN 1     // liest Zeilen
+#define CONNECTION_SKIPPING 2 // verwirft den Rest einer zu langen Zeile
+#define CONNECTION_DRAINING 3 // Client hat geschlossen, Antworten gehen noch raus
+
+/**
+ * A record in a RecordRing, followed by its message and padded to 8
+ * bytes. An entry with `wrap` set, or less room than an entry at the end
+ * of the ring, means the next entry is at the start.
+ */
+typedef struct {
+    uint32_t address;
+    uint32_t functionCode;
+    uint32_t length;
+    uint32_t wrap;
+    uint64_t position;
+} RingEntry;
+
+/**
+ * Records on their way from the event loop to the encoder thread, without
+ * a lock: there is one producer, which only moves `head`, and one
+ * consumer, which only moves `tail`. Both count bytes since the start. An
+ * empty ring puts the consumer to sleep on the `doorbell` eventfd, which
+ * the producer only rings when it finds `sleeping` set.
+ */
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    int sleeping __attribute__((aligned(64)));
+    int closed;
+    int doorbell;
+    Health* health;
+} RecordRing;
+
+/**
+ * A client of --listen, found by its file descriptor. `partial` holds a
+ * line whose end hasn't arrived yet, `unsent` replies the client hasn't
+ * taken yet. `events` is what epoll currently watches for.
+ */
+typedef struct {
+    int state;
+    uint32_t events;
+    char* partial;
+    size_t partialLength;
+    char* unsent;
+    size_t unsentLength;
+    size_t unsentCapacity;
+} Connection;
+
+/**
+ * The event loop of --listen.
+ */
+typedef struct {
+    int poller;
+    int listener;
+    int signals;
+    int accepting;
+    int format;
+    Connection* connections;
+    size_t maxConnections;
+    size_t numConnections;
+    RecordRing* ring;
+    uint64_t position;
+    uint64_t numAccepted;
+    uint64_t numRejected;
+    uint64_t numClients;
+    char buffer[LISTEN_READ_SIZE];
+    char scratch[LISTEN_LINE_SIZE];
+} Listener;
+
+// Zeitschlitze
+#define SLOT_MAX 64
+#define SLOT_SITE_SIZE 32
+#define SLOT_LINE_SIZE 256
+#define SLOT_MAX_QUEUE 256
+#define SLOT_LEAD_MS 500            // so weit darf die Ausgabe der Uhr voraus sein
+#define SLOT_POLL_MS 20
+#define SLOT_STEP (SAMPLE_RATE / 10) // Stille am Stück, zwischendurch wird Eingabe gelesen
+#define SLOT_DRIFT_MS 10            // so weit darf die Ausgabe hinterherhinken, dann neu verankert
+#define SLOT_SEND_TIMEOUT 10        // Sekunden für das Verteilen des Plans an einen Standort
+
+/**
+ * A slot of a site, in nanoseconds from the start of the period.
+ */
+typedef struct {
+    char site[SLOT_SITE_SIZE];
+    uint64_t start;
+    uint64_t length;
+} Slot;
+
+/**
+ * The shared schedule of all sites on a channel, for --slots. Periods
+ * start at multiples of `period` since the UNIX epoch, so every site
+ * agrees on them without talking to the others. `longest` is the longest
+ * window of this site in nanoseconds, `startNanos` when its output sample
+ * 0 goes on air, at `sampleRate`; it is moved on whenever the output falls
+ * behind, by `slipped` nanoseconds in all. The output is paced by the
+ * monotonic clock, which is `clockOffset` behind the wall clock. Messages
+ * wait in `queue` for a slot they fit into.
+ */
+typedef struct {
+    uint64_t period;
+    uint64_t guard;
+    Slot slots[SLOT_MAX];
+    size_t numSlots;
+    size_t numOwnSlots;
+    const char* site;
+    uint64_t longest;
+    uint64_t startNanos;
+    uint64_t clockOffset;
+    uint64_t slipped;
+    uint32_t sampleRate;
+    Record* queue;
+    size_t count;
+} SlotSchedule;
+
+typedef struct {
+    int connection;
+    const char* schedulePath;
+} SlotScheduleClient;
+
+// Adaptive Baudrate
+#define CAPABILITY_TABLE_SIZE (MAX_ADDRESS + 1)
+#define SCHEDULER_THRESHOLD 16
+#define SCHEDULER_MAX_QUEUE 1024
+
+/**
+ * Messages waiting to be sent, for --capabilities. The capability table is
+ * a file with one byte per capcode: the fastest rate the pager takes, in
+ * units of 100 baud (12 = 1200, 24 = 2400; 0 or 5 = 512 only). It is
+ * mapped, not read, so only the pages for capcodes in use are ever loaded.
+ *
+ * The queue is flushed whenever the input has nothing more ready. If at
+ * least `threshold` messages are queued by then, the messages for pagers
+ * which can take a faster rate are grouped into one transmission per rate.
+ * The queued records own a copy of their text.
+ */
+typedef struct {
+    const uint8_t* capabilities;
+    size_t threshold;
+    Record* queue;
+    size_t count;
+} Scheduler;
+
+// Ergebnis von transmitRecord()
+#define TRANSMIT_SENT 0
+#define TRANSMIT_SCHEDULED 1    // Wartet im Scheduler oder auf einen Zeitschlitz
+#define TRANSMIT_DROPPED 2      // Verworfen: Filter, Speicher oder zu lang
+
+/**
+ * Everything a parsed record passes through on its way out. The index, if
+ * any, gets a line per transmission with its position in the output and a
+ * CRC32C of its samples. With a seed, the delay after each message depends
+ * only on the seed and where the message is in the input, so any slice of
+ * the input renders the same wherever and however often it is run.
+ * Samples are written at `sampleRate`.
+ */
+typedef struct {
+    DedupFilter* dedup;
+    RateLimiter* rateLimiter;
+    LiveConfig* config;
+    Scheduler* scheduler;
+    Recorder* recorder;
+    SlotSchedule* slots;
+    FILE* out;
+    FILE* index;
+    uint32_t sampleRate;
+    uint64_t samplesWritten;
+    uint64_t messagesSent;
+    int seeded;
+    uint64_t seed;
+    int stats;
+    Health health;
+    Watchdog* watchdog;
+} Transmitter;
+
+/**
+ * Receives the records of an input file one by one, in order.
+ */
+typedef void (*RecordConsumer)(void* context, const Record* record);
+
+/**
+ * Called when the next records of an input file aren't parsed yet, before
+ * waiting for them.
+ */
+typedef void (*IdleHandler)(void* context);
+
+/**
+ * The records of one chunk of a mapped input file. A chunk always starts and
+ * ends on a line boundary. Text which had to be unescaped lives in `text`,
+ * at the same offset as the raw line has in the chunk.
+ */
+typedef struct {
+    Record* records;
+    size_t count;
+    size_t capacity;
+    char* text;
+    size_t textCapacity;
+    int ready;
+} InputChunk;
+
+/**
+ * A memory-mapped input file being parsed by several threads. Chunks are
+ * claimed in order, and a worker may only run `window` chunks ahead of the
+ * encoder, so the memory for parsed records stays bounded however large the
+ * file is. Chunk k is parsed into slots[k % window].
+ *
+ * Only the part [base, base + size) of the mapping is read, which is the
+ * whole file unless it is one shard of a larger job.
+ */
+typedef struct {
+    const char* mapping;
+    size_t mappingSize;
+    uint64_t base;
+    const char* data;
+    size_t size;
+    int format;
+    size_t numChunks;
+    size_t window;
+    InputChunk* slots;
+    size_t nextChunk;
+    size_t consumed;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} MappedInput;
+
+// Mehrkanal-IQ
+#define IQ_CHANNEL_SPACING 12500 // Hz, Raster der Trägerfrequenzen
+#define IQ_DEVIATION 4500        // Hz, Frequenzhub nach POCSAG-Standard
+#define IQ_TAPS_PER_BRANCH 32    // Länge des Filters in jedem Polyphasenzweig
+#define IQ_BLOCK 4096            // Kanal-Samples pro Durchlauf
+#define IQ_MAX_CARRIERS 256
+
+/**
+ * One paging channel of a wideband IQ stream: the timeline of its messages
+ * at the channel rate (samples are +1, -1, or 0 while the carrier is off)
+ * and the phase of its FSK oscillator.
+ */
+typedef struct {
+    double offset; // Hz
+    int32_t bin;
+    const char* path;
+    PcmRenderer timeline;
+    float phaseRe;
+    float phaseIm;
+} Carrier;
+
+/**
+ * Polyphase synthesis filter bank with numBins channels spaced `spacing`
+ * apart, giving complex samples at numBins * spacing. Each channel sample
+ * period, one inverse FFT over all bins mixes every carrier at once, and
+ * branch p of the interpolation filter turns the last IQ_TAPS_PER_BRANCH
+ * FFT outputs into output sample p. The cost per output sample is
+ * log2(numBins) plus IQ_TAPS_PER_BRANCH, however many carriers are active.
+ *
+ * `filter` holds branch row l as 2 * numBins floats, each coefficient twice
+ * (for I and Q), so a row is applied with one straight multiply-add loop.
+ */
+typedef struct {
+    uint32_t spacing;
+    uint32_t numBins;
+    float* filter;
+    float* twiddles;
+    float* history; // IQ_TAPS_PER_BRANCH Zeilen, Ringpuffer
+    size_t newest;
+} Channelizer;
+
+/**
+ * What carrierConsumer() needs to append a record to a carrier's timeline.
+ */
+typedef struct {
+    const Transmitter* transmitter;
+    const Config* config;
+    PcmRenderer* timeline;
+} CarrierLoad;
+
+// Mitschnitt und Wiedergabe
+#define CAPTURE_MAGIC "PCSGCAP1" // 8 Bytes am Dateianfang
+#define CAPTURE_MAX_WAITING 65536 // Nachrichten, die auf den Encoder warten dürfen
+
+/**
+ * A binary log of every accepted message, for --capture. After the magic,
+ * each message is stored as
+ *
+ *   varint  microseconds since the previous message arrived
+ *   varint  bytes of input since the previous message (for --seed)
+ *   varint  address
+ *   byte    function code
+ *   byte    id length, then the id
+ *   varint  text length, then the text
+ *
+ * where a varint is 7 bits per byte, least significant first, with the top
+ * bit set on all but the last byte. A page typically takes a dozen bytes
+ * plus its text.
+ */
+typedef struct {
+    FILE* file;
+    uint64_t lastMicros;
+    uint64_t lastPosition;
+} Capture;
+
+/**
+ * A capture being fed back in, for --replay. Message k is released at
+ * start + (its arrival time) / speed, or at once if speed is 0. `maxLag`
+ * is how far behind that schedule the input ever fell, i.e. how long the
+ * encoder kept a message from being read.
+ */
+typedef struct {
+    FILE* file;
+    double speed;
+    uint64_t startMicros;
+    uint64_t micros;
+    uint64_t position;
+    uint64_t count;
+    uint64_t maxLag;
+    int peeked;
+    uint64_t peekedDelay;
+} Replay;
+
+/**
+ * Lines read from a file descriptor through a buffer of INPUT_LINE_SIZE.
+ * Unlike stdio, it can tell whether a whole line is ready without
+ * blocking, see lineReaderPending().
+ */
+typedef struct {
+    int fd;
+    char* buffer;
+    size_t start;
+    size_t end;
+    int eof;
+} LineReader;
+
+/**
+ * Where the messages on stdin come from: the lines themselves, or a
+ * replayed capture instead. Either way they can be captured. When stdin
+ * is captured, a reader thread takes the messages as they arrive, so
+ * their times are not held up by the encoder, and hands them over
+ * from `head` to `tail`, at most CAPTURE_MAX_WAITING at a time. The list
+ * is guarded by `lock`; `current` holds the text of the last message
+ * handed out.
+ */
+typedef struct {
+    LineReader in;
+    int format;
+    uint64_t position;
+    Capture* capture;
+    Replay* replay;
+    char* line;
+    char* text;
+    int threaded;
+    int withIds;
+    struct Arrival* head;
+    struct Arrival* tail;
+    struct Arrival* current;
+    size_t numWaiting;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} InputSource;
+
+// Warteschlange mit Nachrichten-IDs
+#define MESSAGE_ID_SIZE 64      // inklusive Nullbyte
+#define QUEUE_PRIORITIES 4      // 0 = dringendste
+#define QUEUE_DEFAULT_PRIORITY 2
+#define QUEUE_HISTORY 4096      // So viele erledigte IDs bleiben abfragbar
+#define QUEUE_MIN_BUCKETS 1024  // Zweierpotenz
+#define CONTROL_LINE_SIZE 256
+#define CONTROL_TIMEOUT 60      // Sekunden ohne Befehl, dann wird getrennt
+#define MESSAGE_PENDING 0
+#define MESSAGE_SENDING 1
+#define MESSAGE_SCHEDULED 2     // Liegt im Scheduler von --capabilities
+#define MESSAGE_SENT 3
+#define MESSAGE_CANCELLED 4
+#define MESSAGE_DROPPED 5
+
+/**
+ * A message waiting in a MessageQueue, with its text copied. It sits in
+ * the list of its priority while pending and in the history once done;
+ * messages with an id are also chained into a bucket of the id index.
+ */
+typedef struct QueuedMessage {
+    struct QueuedMessage* previous;
+    struct QueuedMessage* next;
+    struct QueuedMessage* nextInBucket;
+    uint64_t idHash;
+    char id[MESSAGE_ID_SIZE]; // leer = keine ID
+    int priority;
+    int state;
+    Record record;
+    char text[];
+} QueuedMessage;
+
+/**
+ * A message the reader thread of an InputSource has read and captured,
+ * with its text copied. EOF and errors which end the input are passed on
+ * the same way.
+ */
+typedef struct Arrival {
+    struct Arrival* next;
+    int error;
+    char id[MESSAGE_ID_SIZE];
+    Record record;
+    char text[];
+} Arrival;
+
+typedef struct {
+    QueuedMessage* head;
+    QueuedMessage* tail;
+} MessageList;
+
+/**
+ * Messages read from stdin but not yet sent, for --control. A reader
+ * thread appends, the encoder takes the oldest message of the most urgent
+ * priority, and the control socket can cancel, query or reprioritise a
+ * message by its id at any time before the encoder takes it. Every
+ * operation is O(1): the lists are doubly linked and ids are found through
+ * a chained hash index, which doubles when it gets as full as it has
+ * buckets. Messages handed to the --capabilities scheduler wait in
+ * `scheduled` until it sends them. The last QUEUE_HISTORY finished
+ * messages stay in the index so their fate can still be asked for.
+ * Everything is guarded by `lock`.
+ */
+typedef struct {
+    MessageList pending[QUEUE_PRIORITIES];
+    MessageList scheduled;
+    MessageList history;
+    size_t numPending;
+    size_t numHistory;
+    QueuedMessage** buckets;
+    size_t numBuckets;
+    size_t numIndexed;
+    int closed;
+    int error;
+    InputSource* source;
+    Health* health;
+    int listener;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} MessageQueue;
+
+typedef struct {
+    MessageQueue* queue;
+    int connection;
+} ControlClient;
+
+// Autotuning
+#define TUNE_VERSION 1
+#define TUNE_ROUNDS 5                 // Das Beste aus so vielen Läufen zählt
+#define TUNE_CODEWORDS (1 << 16)
+#define TUNE_TEXT_CHARS 4096
+#define TUNE_PCM_CHARS 200
+#define TUNE_LINE_SIZE 256
+
+typedef uint32_t (*CodewordKernel)(uint32_t msg);
+typedef uint32_t (*PackingKernel)(const char* str, size_t numChars, Batch* batches, size_t slot);
+typedef void (*PcmKernel)(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission,
+                          size_t transmissionLength, int16_t level, uint8_t* out);
+
+/**
+ * The kernel variants picked for this host, as indices into the variant
+ * tables; all zero are the plain ones. `nanos` holds what each choice took
+ * in the calibration, if it was measured in this run rather than read from
+ * the cache.
+ */
+typedef struct {
+    int codeword;
+    int packing;
+    int pcm;
+    int measured;
+    double nanos[3];
+} Tuning;
 
 // =========================================================
 // FUNKTIONSPROTOTYPEN (Müssen vor main() stehen)
@@ -43,14 +977,175 @@ typedef uint32_t FunctionCode;
 uint32_t crc(uint32_t inputMsg);
 uint32_t parity(uint32_t x);
 uint32_t encodeCodeword(uint32_t msg);
-uint32_t encodeASCII(uint32_t initial_offset, char* str, uint32_t* out);
+uint32_t encodeCodewordBitwise(uint32_t msg);
+uint32_t encodeCodewordTable(uint32_t msg);
+uint32_t encodeASCII(const char* str, size_t numChars, Batch* batches, size_t slot);
+uint32_t encodeASCIIBitwise(const char* str, size_t numChars, Batch* batches, size_t slot);
+uint32_t encodeASCIIReversed(const char* str, size_t numChars, Batch* batches, size_t slot);
 uint32_t addressOffset(uint32_t address);
+int addressWordReserved(uint32_t address, FunctionCode functionCode);
+uint32_t parseAddress(const char* str);
+Batch* allocBatches(size_t numBatches);
+void batchSet(Batch* batches, size_t slot, uint32_t codeword);
+int batchSlotFree(const Batch* batches, size_t slot);
+size_t batchFindSlot(const Batch* batches, size_t numBatches, size_t from, uint32_t frame, size_t numWords);
+size_t batchPlaceMessage(Batch* batches, size_t numBatches, size_t from, uint32_t address, const char* message, size_t numChars, FunctionCode functionCode);
+size_t batchSerialise(const Batch* batches, size_t numBatches, uint32_t* out);
 // NEU: functionCode als Parameter
-void encodeTransmission(int address, char* message, uint32_t* out, FunctionCode functionCode);
+int encodeTransmission(int address, const char* message, size_t numChars, uint32_t* out, FunctionCode functionCode, uint32_t preambleLength);
 // NEU: functionCode als Parameter
-size_t messageLength(int address, int numChars, FunctionCode functionCode); 
+size_t messageLength(int address, int numChars, FunctionCode functionCode, uint32_t preambleLength);
 size_t pcmTransmissionLength(uint32_t sampleRate, uint32_t baudRate, size_t transmissionLength);
-void pcmEncodeTransmission(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission, size_t transmissionLength, uint8_t* out);
+void pcmEncodeTransmission(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission, size_t transmissionLength, int16_t level, uint8_t* out);
+void pcmEncodeResampled(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission, size_t transmissionLength, int16_t level, uint8_t* out);
+void pcmEncodeDirect(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission, size_t transmissionLength, int16_t level, uint8_t* out);
+uint32_t pcmSamplesPerBit(uint32_t sampleRate, uint32_t baudRate);
+void pcmEncodeInteger(uint32_t sampleRate, uint32_t baudRate, uint32_t* transmission, size_t transmissionLength, int16_t level, uint8_t* out);
+void pcmRenderCodewords(uint32_t sampleRate, uint32_t baudRate, int16_t level, const uint32_t* transmission, uint64_t first, size_t numSamples, int16_t* out);
+void pcmRendererInit(PcmRenderer* renderer, uint32_t sampleRate, uint32_t baudRate);
+int pcmRendererAddTransmission(PcmRenderer* renderer, const uint32_t* transmission, size_t transmissionLength);
+int pcmRendererAddSilence(PcmRenderer* renderer, uint64_t numSamples);
+size_t pcmRendererRead(const PcmRenderer* renderer, uint64_t offset, size_t numSamples, int16_t* out);
+void pcmRendererFree(PcmRenderer* renderer);
+size_t transmissionOffsets(const uint32_t* addresses, const uint32_t* lengths, size_t count, uint32_t preambleLength, size_t* offsets);
+void* encodeWorker(void* arg);
+int encodeTransmissions(const MessageArrays* arrays, uint32_t preambleLength, const size_t* offsets, uint32_t* out, int numThreads);
+uint64_t monotonicMillis(void);
+uint64_t messageHash(uint32_t address, FunctionCode functionCode, const char* message, size_t length);
+int dedupSeen(DedupFilter* filter, uint64_t hash, uint64_t now);
+int rateLimitAllow(RateLimiter* limiter, uint32_t address, uint64_t now);
+int parseLine(const char* line, size_t length, Record* record);
+int parseMultimonLine(const char* line, size_t length, char* scratch, Record* record);
+int parseRecord(int format, const char* line, size_t length, char* scratch, Record* record);
+void printParseError(const Record* record);
+void lineReaderInit(LineReader* reader, int fd);
+size_t lineReaderNext(LineReader* reader, char* line, size_t lineSize);
+int lineReaderPending(LineReader* reader);
+int readRecord(LineReader* in, int format, char* line, size_t lineSize, char* text, uint64_t* position, char* id, Record* record);
+uint64_t monotonicMicros(void);
+int openCapture(const char* path, Capture* capture);
+int captureRecord(Capture* capture, const char* id, const Record* record);
+int openReplay(const char* path, double speed, Replay* replay);
+int replayRecord(Replay* replay, char* text, char* id, Record* record);
+void inputSourceInit(InputSource* source, int format);
+void* inputSourceReader(void* arg);
+int inputSourceStart(InputSource* source, int withIds);
+int nextRecord(InputSource* source, char* id, Record* record);
+int inputSourcePending(InputSource* source);
+void emitSamples(Transmitter* transmitter, const uint8_t* pcm, size_t numBytes);
+int transmitRecord(Transmitter* transmitter, const Record* record);
+int sendTransmission(Transmitter* transmitter, const Record* const* records, size_t numRecords, uint32_t baudRate);
+size_t encodeMultiTransmission(const Record* const* records, size_t numRecords, uint32_t preambleLength, uint32_t** out);
+int loadCapabilities(const char* path, Scheduler* scheduler);
+int setCapability(const char* path, uint32_t address, uint32_t baudRate);
+uint32_t capableBaudRate(const Scheduler* scheduler, uint32_t address);
+int schedulerSubmit(Transmitter* transmitter, const Record* record);
+void schedulerFlush(Transmitter* transmitter);
+int queueInit(MessageQueue* queue, InputSource* source);
+QueuedMessage* queueFind(MessageQueue* queue, const char* id);
+int queueSubmit(MessageQueue* queue, const char* id, const Record* record);
+QueuedMessage* queueTake(MessageQueue* queue);
+void queueFinish(MessageQueue* queue, QueuedMessage* message, int outcome);
+void queueScheduledSent(MessageQueue* queue);
+void queueControl(MessageQueue* queue, char* command, char* reply, size_t replySize);
+void* queueReader(void* arg);
+void* controlClient(void* arg);
+void* controlWorker(void* arg);
+int runQueued(Transmitter* transmitter, InputSource* source, const char* controlPath);
+uint64_t realtimeNanos(void);
+int parseSlotSchedule(FILE* file, const char* name, const char* site, SlotSchedule* schedule);
+int openSlotSchedule(const char* path, const char* site, SlotSchedule* schedule);
+void* slotScheduleClient(void* arg);
+int serveSlotSchedule(const char* socketPath, const char* schedulePath);
+uint64_t slotSampleTime(const SlotSchedule* schedule, uint64_t k);
+void slotWindow(const SlotSchedule* schedule, uint64_t k, uint64_t* start, uint64_t* end);
+int slotSubmit(Transmitter* transmitter, const Record* record);
+void slotStep(Transmitter* transmitter);
+uint64_t slotClock(const SlotSchedule* schedule);
+int runSlotted(Transmitter* transmitter, InputSource* source);
+uint64_t monotonicNanos(void);
+void healthPending(Health* health, int64_t delta);
+void watchdogReport(Watchdog* watchdog, int final);
+void* watchdogWorker(void* arg);
+int startWatchdog(Transmitter* transmitter, const char* path, double timeout);
+void soakMemory(uint64_t* rss, uint64_t* heap, uint64_t* arena);
+double soakSlope(const double* x, const double* y, size_t n);
+int runSoak(Transmitter* transmitter, double hours);
+int listenAddress(const char* text, int passive, struct sockaddr_storage* address, socklen_t* length);
+size_t raiseFileLimit(void);
+int ringInit(RecordRing* ring, size_t size, Health* health);
+int ringPush(RecordRing* ring, const Record* record);
+size_t ringPeek(RecordRing* ring, Record* record);
+void ringRelease(RecordRing* ring, size_t consumed);
+void ringClose(RecordRing* ring);
+void ringEncode(Transmitter* transmitter, RecordRing* ring);
+void listenWatch(Listener* listener, int fd, uint32_t events);
+int listenReply(Listener* listener, int fd, const char* reply);
+void listenClose(Listener* listener, int fd);
+void listenFlush(Listener* listener, int fd);
+int listenLine(Listener* listener, int fd, const char* line, size_t length);
+void listenRead(Listener* listener, int fd);
+void listenAccept(Listener* listener);
+void listenerFree(Listener* listener, const char* address, int local);
+void* listenLoop(void* arg);
+int runListen(Transmitter* transmitter, const char* address, int format);
+int runListenBench(const char* address, size_t numClients, size_t numPages);
+void fftInverse(const float* twiddles, uint32_t n, float* data);
+int channelizerInit(Channelizer* channelizer, uint32_t spacing, uint32_t numBins);
+void channelizerStep(Channelizer* channelizer, const float* bins, float* out);
+void channelizerFree(Channelizer* channelizer);
+void carrierConsumer(void* context, const Record* record);
+int runMultiCarrier(Transmitter* transmitter, Carrier* carriers, size_t numCarriers, uint32_t spacing, int inputFormat, int numThreads);
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+int verifyDump(const char* indexPath, const char* dumpPath);
+int openRecorder(const char* path, double minutes, uint32_t sampleRate, Recorder* recorder);
+void recorderWrite(Recorder* recorder, const uint8_t* pcm, size_t numBytes);
+void recorderIndex(Recorder* recorder, uint64_t numSamples, uint32_t address, FunctionCode functionCode, uint32_t crc);
+int extractRecorder(const char* path, double minutes, const char* outputPath);
+char* manifestPath(const char* segmentPath);
+int mergeShards(const char* outputPath, char** segmentPaths, int numSegments);
+int runBeacon(Transmitter* transmitter, int pattern, int inputFormat, double gapSeconds, uint64_t repeat);
+void finishTransmission(Transmitter* transmitter);
+size_t delaySamples(const Transmitter* transmitter, const Config* config, uint64_t position, uint32_t sampleRate);
+size_t lineBoundary(const char* data, size_t size, size_t offset);
+size_t chunkBoundary(const MappedInput* input, size_t chunk);
+void* inputWorker(void* arg);
+int readMappedFile(const char* path, int format, int numThreads, int shard, int numShards, RecordConsumer consume, IdleHandler idle, void* context);
+int transmitMappedFile(Transmitter* transmitter, const char* path, int format, int numThreads, int shard, int numShards);
+int decodeCodeword(uint32_t codeword, uint32_t* msg);
+void pcmDecodeWords(uint32_t sampleRate, uint32_t baudRate, const uint8_t* pcm, size_t numWords, uint32_t* out);
+int decodeTransmission(const uint32_t* transmission, size_t transmissionLength, uint32_t preambleLength, DecodedPage* page);
+int sweepCase(uint64_t index, uint32_t* address, FunctionCode* functionCode, char* message, size_t* numChars);
+int checkRoundTrip(uint32_t address, FunctionCode functionCode, const char* message, size_t numChars, int viaPcm);
+void* sweepWorker(void* arg);
+int runSweep(int numThreads);
+void goldenGenerate(GoldenCorpus* corpus);
+int goldenIntegerRate(const GoldenCase* golden, const uint32_t* transmission, size_t length);
+int goldenRenderer(const GoldenCase* golden, const uint32_t* transmission, size_t length, const uint8_t* pcm);
+void goldenDigest(const GoldenCase* golden, uint32_t* codewordDigest, uint32_t* pcmDigest, const char** crossMismatch);
+void* goldenWorker(void* arg);
+void goldenRun(GoldenCorpus* corpus, int numThreads);
+int readGoldenCorpus(const char* path, GoldenCorpus* corpus);
+int writeGoldenCorpus(const char* path, int numThreads);
+int runGolden(const char* path, int numThreads);
+uint64_t simulatePlace(FrameSimulation* simulation, uint32_t frame, size_t numWords);
+void analysisConsumer(void* context, const Record* record);
+size_t suggestCapcodes(const FrameAnalysis* analysis, uint32_t* from, uint32_t* to, uint8_t* frames, uint8_t* taken);
+void printSimulation(const char* label, const FrameSimulation* simulation);
+int runAnalysis(const char* path, int format, int numThreads);
+void defaultConfig(Config* config);
+int loadConfig(const char* path, Config* config);
+const Config* configAcquire(LiveConfig* live);
+void configRelease(LiveConfig* live);
+void* configReloadWorker(void* arg);
+void kernelTablesInit(void);
+void applyTuning(const Tuning* tuning);
+int loadTuning(const char* path, Tuning* tuning);
+void saveTuning(const char* path, const Tuning* tuning);
+void measureTuning(Tuning* tuning);
+void autotune(const char* cachePath, int force, Tuning* tuning);
+void printTuning(const Tuning* tuning, const char* cachePath);
+void usage(const char* name);
 
 
 // =========================================================
@@ -86,46 +1181,67 @@ uint32_t parity(uint32_t x) {
     return p;
 }
 
+//Kernel-Varianten, von autotune() gewählt
+static CodewordKernel codewordKernel = encodeCodewordBitwise;
+static PackingKernel packingKernel = encodeASCIIBitwise;
+static PcmKernel pcmKernel = pcmEncodeResampled;
+
+//Prüfbits und Parität der oberen 10 und unteren 11 Nachrichtenbits
+static uint16_t codewordHigh[1 << 10];
+static uint16_t codewordLow[1 << 11];
+//Die 7 Bits jedes Zeichens in Sendereihenfolge
+static uint8_t reversedChars[128];
+
 /**
  * Encodes a 21-bit message by calculating and adding a CRC code and parity bit.
  */
 uint32_t encodeCodeword(uint32_t msg) {
+    return codewordKernel(msg);
+}
+
+uint32_t encodeCodewordBitwise(uint32_t msg) {
     uint32_t fullCRC = (msg << CRC_BITS) | crc(msg);
     uint32_t p = parity(fullCRC);
     return (fullCRC << 1) | p;
 }
 
 /**
- * ASCII encode a null-terminated string as a series of codewords, written
- * to (*out). Returns the number of codewords written.
+ * Same as encodeCodewordBitwise() by table lookup. The CRC and the parity
+ * are both linear in the message bits, so the 11 check bits are the XOR of
+ * those of the upper and the lower part. Needs kernelTablesInit().
  */
-uint32_t encodeASCII(uint32_t initial_offset, char* str, uint32_t* out) {
+uint32_t encodeCodewordTable(uint32_t msg) {
+    return (msg << (CRC_BITS + 1))
+         | (codewordHigh[(msg >> 11) & 0x3FF] ^ codewordLow[msg & 0x7FF]);
+}
+
+/**
+ * ASCII encode numChars characters of a string as a series of message codewords,
+ * placed into consecutive batch slots starting at the given slot. Crossing
+ * into the next batch needs no special care here, the sync word belongs to
+ * the batch itself. Returns the number of codewords written.
+ */
+uint32_t encodeASCII(const char* str, size_t numChars, Batch* batches, size_t slot) {
+    return packingKernel(str, numChars, batches, slot);
+}
+
+uint32_t encodeASCIIBitwise(const char* str, size_t numChars, Batch* batches, size_t slot) {
     uint32_t numWordsWritten = 0;
     uint32_t currentWord = 0;
     uint32_t currentNumBits = 0;
-    uint32_t wordPosition = initial_offset;
 
-    while (*str != 0) {
-        unsigned char c = *str;
-        str++;
+    for (size_t n = 0; n < numChars; n++) {
+        unsigned char c = str[n];
         for (int i = 0; i < TEXT_BITS_PER_CHAR; i++) {
             currentWord <<= 1;
             currentWord |= (c >> i) & 1;
             currentNumBits++;
             if (currentNumBits == TEXT_BITS_PER_WORD) {
-                *out = encodeCodeword(currentWord | FLAG_MESSAGE);
-                out++;
+                batchSet(batches, slot + numWordsWritten,
+                         encodeCodeword(currentWord | FLAG_MESSAGE));
                 currentWord = 0;
                 currentNumBits = 0;
                 numWordsWritten++;
-
-                wordPosition++;
-                if (wordPosition == BATCH_SIZE) {
-                    *out = SYNC;
-                    out++;
-                    numWordsWritten++;
-                    wordPosition = 0;
-                }
             }
         }
     }
@@ -133,19 +1249,43 @@ uint32_t encodeASCII(uint32_t initial_offset, char* str, uint32_t* out) {
     //Write remainder of message
     if (currentNumBits > 0) {
         currentWord <<= 20 - currentNumBits;
-        *out = encodeCodeword(currentWord | FLAG_MESSAGE);
-        out++;
+        batchSet(batches, slot + numWordsWritten,
+                 encodeCodeword(currentWord | FLAG_MESSAGE));
         numWordsWritten++;
+    }
+
+    return numWordsWritten;
+}
+
+/**
+ * Same as encodeASCIIBitwise(), a whole character at a time: the 7 bits go
+ * in through a table which turns them into sending order. Needs
+ * kernelTablesInit().
+ */
+uint32_t encodeASCIIReversed(const char* str, size_t numChars, Batch* batches, size_t slot) {
+    uint32_t numWordsWritten = 0;
+    uint32_t bits = 0;
+    uint32_t numBits = 0;
 
-        wordPosition++;
-        if (wordPosition == BATCH_SIZE) {
-            *out = SYNC;
-            out++;
+    for (size_t n = 0; n < numChars; n++) {
+        bits = (bits << TEXT_BITS_PER_CHAR) | reversedChars[(unsigned char) str[n] & 0x7F];
+        numBits += TEXT_BITS_PER_CHAR;
+        if (numBits >= TEXT_BITS_PER_WORD) {
+            numBits -= TEXT_BITS_PER_WORD;
+            batchSet(batches, slot + numWordsWritten,
+                     encodeCodeword(((bits >> numBits) & 0xFFFFF) | FLAG_MESSAGE));
+            bits &= (1u << numBits) - 1;
             numWordsWritten++;
-            wordPosition = 0;
         }
     }
 
+    //Write remainder of message
+    if (numBits > 0) {
+        batchSet(batches, slot + numWordsWritten,
+                 encodeCodeword((bits << (TEXT_BITS_PER_WORD - numBits)) | FLAG_MESSAGE));
+        numWordsWritten++;
+    }
+
     return numWordsWritten;
 }
 
@@ -157,56 +1297,180 @@ uint32_t addressOffset(uint32_t address) {
 }
 
 /**
- * Encode a full POCSAG transmission with a specified function code.
- * (Funktion geändert: Nimmt jetzt FunctionCode entgegen)
+ * True if the address word for this address and function code would be
+ * the SYNC or IDLE codeword. Pagers can't tell such a page from the
+ * framing, so it must not be sent.
  */
-void encodeTransmission(int address, char* message, uint32_t* out, FunctionCode functionCode) {
+int addressWordReserved(uint32_t address, FunctionCode functionCode) {
+    uint32_t word = encodeCodeword(((address >> 3) << 2) | functionCode);
+    return word == SYNC || word == IDLE;
+}
 
-    //Encode preamble
-    for (int i = 0; i < PREAMBLE_LENGTH / 32; i++) {
-        *out = 0xAAAAAAAA;
-        out++;
+// =========================================================
+// BATCHES UND SLOTS
+// =========================================================
+
+/**
+ * Allocates batches on cache line boundaries, every slot IDLE and free.
+ */
+Batch* allocBatches(size_t numBatches) {
+    void* memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(Batch) * numBatches) != 0) {
+        return NULL;
     }
+    Batch* batches = (Batch*) memory;
+    for (size_t b = 0; b < numBatches; b++) {
+        batches[b].sync = SYNC;
+        for (int f = 0; f < BATCH_SIZE / FRAME_SIZE; f++) {
+            for (int w = 0; w < FRAME_SIZE; w++) {
+                batches[b].frames[f][w] = IDLE;
+            }
+        }
+        batches[b].occupied = 0;
+    }
+    return batches;
+}
+
+/**
+ * Writes a codeword into a slot and marks it as taken. Slots are numbered
+ * across batches, slot / BATCH_SIZE being the batch and slot % BATCH_SIZE
+ * the position after its sync word.
+ */
+void batchSet(Batch* batches, size_t slot, uint32_t codeword) {
+    Batch* batch = &batches[slot / BATCH_SIZE];
+    uint32_t position = slot % BATCH_SIZE;
+    batch->frames[position / FRAME_SIZE][position % FRAME_SIZE] = codeword;
+    batch->occupied |= 1 << position;
+}
 
-    uint32_t* start = out;
+int batchSlotFree(const Batch* batches, size_t slot) {
+    return !(batches[slot / BATCH_SIZE].occupied & (1 << (slot % BATCH_SIZE)));
+}
 
-    //Sync
-    *out = SYNC;
-    out++;
+/**
+ * Finds the first slot at or after `from` which lies in the given frame and
+ * is followed by enough free slots to hold numWords consecutive codewords.
+ * Returns NO_SLOT if the batches are too full.
+ */
+size_t batchFindSlot(
+        const Batch* batches,
+        size_t numBatches,
+        size_t from,
+        uint32_t frame,
+        size_t numWords) {
 
-    //Write out padding before address word
-    int prefixLength = addressOffset(address);
-    for (int i = 0; i < prefixLength; i++) {
-        *out = IDLE;
-        out++;
+    size_t total = numBatches * BATCH_SIZE;
+    for (size_t b = from / BATCH_SIZE; b < numBatches; b++) {
+        //Free slots of this frame, as bits in the occupancy bitmap
+        uint32_t candidates = ~batches[b].occupied & (0x3u << (frame * FRAME_SIZE));
+        if (b == from / BATCH_SIZE) {
+            candidates &= ~0u << (from % BATCH_SIZE);
+        }
+
+        while (candidates != 0) {
+            size_t start = b * BATCH_SIZE + __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+
+            if (start + numWords > total) {
+                return NO_SLOT;
+            }
+            size_t run = 1;
+            while (run < numWords && batchSlotFree(batches, start + run)) {
+                run++;
+            }
+            if (run == numWords) {
+                return start;
+            }
+        }
+    }
+    return NO_SLOT;
+}
+
+/**
+ * Places the address word and the text of a message into the first free
+ * slots of its frame at or after `from`. Returns the slot just behind the
+ * message, which is where a following message may start, or NO_SLOT if it
+ * doesn't fit.
+ *
+ * The word after the message is left alone: if nothing else is placed there
+ * it stays IDLE, which tells the pager that the message has ended.
+ */
+size_t batchPlaceMessage(
+        Batch* batches,
+        size_t numBatches,
+        size_t from,
+        uint32_t address,
+        const char* message,
+        size_t numChars,
+        FunctionCode functionCode) {
+
+    size_t numWords = 1 + (numChars * TEXT_BITS_PER_CHAR
+                            + (TEXT_BITS_PER_WORD - 1)) / TEXT_BITS_PER_WORD;
+    size_t slot = batchFindSlot(
+            batches, numBatches, from, addressOffset(address) / FRAME_SIZE, numWords);
+    if (slot == NO_SLOT) {
+        return NO_SLOT;
     }
 
     // Write address word. Der Function Code wird hier eingefügt.
-    *out = encodeCodeword( ((address >> 3) << 2) | functionCode);
-    out++;
+    batchSet(batches, slot, encodeCodeword(((address >> 3) << 2) | functionCode));
 
     //Encode the message itself
-    out += encodeASCII(addressOffset(address) + 1, message, out);
-
-
-    //Finally, write an IDLE word indicating the end of the message
-    *out = IDLE;
-    out++;
-    
-    //Pad out the last batch with IDLE
-    size_t written = out - start;
-    size_t padding = (BATCH_SIZE + 1) - written % (BATCH_SIZE + 1);
-    for (int i = 0; i < padding; i++) {
-        *out = IDLE;
+    encodeASCII(message, numChars, batches, slot + 1);
+
+    return slot + numWords;
+}
+
+/**
+ * Writes batches out in their on-air layout: sync word, then the 16
+ * codewords. Returns the number of words written.
+ */
+size_t batchSerialise(const Batch* batches, size_t numBatches, uint32_t* out) {
+    for (size_t b = 0; b < numBatches; b++) {
+        *out = batches[b].sync;
+        out++;
+        memcpy(out, batches[b].frames, sizeof(uint32_t) * BATCH_SIZE);
+        out += BATCH_SIZE;
+    }
+    return numBatches * BATCH_WORDS;
+}
+
+/**
+ * Encode a full POCSAG transmission with a specified function code.
+ * (Funktion geändert: Nimmt jetzt FunctionCode entgegen)
+ * The preamble is preambleLength bits long, PREAMBLE_LENGTH by default.
+ * Returns 1 if there was no memory for the batches, leaving out unfilled.
+ */
+int encodeTransmission(int address, const char* message, size_t numChars, uint32_t* out, FunctionCode functionCode, uint32_t preambleLength) {
+
+    //Encode preamble
+    for (uint32_t i = 0; i < preambleLength / 32; i++) {
+        *out = 0xAAAAAAAA;
         out++;
     }
+
+    //The batches hold the padding before the address word, the message, the
+    //IDLE word marking its end and the IDLE padding of the last batch.
+    size_t numBatches =
+        (messageLength(address, numChars, functionCode, preambleLength) - preambleLength / 32)
+        / BATCH_WORDS;
+    Batch* batches = allocBatches(numBatches);
+    if (batches == NULL) {
+        return 1;
+    }
+
+    batchPlaceMessage(batches, numBatches, 0, address, message, numChars, functionCode);
+    batchSerialise(batches, numBatches, out);
+
+    free(batches);
+    return 0;
 }
 
 /**
  * Calculates the length in words of a POCSAG message.
  * (Funktion geändert: Nimmt jetzt FunctionCode entgegen, beeinflusst aber die Logik nicht)
  */
-size_t messageLength(int address, int numChars, FunctionCode functionCode) {
+size_t messageLength(int address, int numChars, FunctionCode functionCode, uint32_t preambleLength) {
     size_t numWords = 0;
 
     //Padding before address word.
@@ -229,7 +1493,7 @@ size_t messageLength(int address, int numChars, FunctionCode functionCode) {
     numWords += numWords / BATCH_SIZE;
 
     //Preamble
-    numWords += PREAMBLE_LENGTH / 32;
+    numWords += preambleLength / 32;
 
     return numWords;
 }
@@ -245,13 +1509,33 @@ size_t pcmTransmissionLength(
 }
 
 /**
- * PCM-encodes the transmission for SDR use.
+ * PCM-encodes the transmission for SDR use. When every bit is a whole
+ * number of samples, pcmEncodeInteger() does it without any resampling.
  */
 void pcmEncodeTransmission(
         uint32_t sampleRate,
         uint32_t baudRate,
         uint32_t* transmission,
         size_t transmissionLength,
+        int16_t level,
+        uint8_t* out) {
+    if (pcmSamplesPerBit(sampleRate, baudRate) != 0) {
+        pcmEncodeInteger(sampleRate, baudRate, transmission, transmissionLength, level, out);
+        return;
+    }
+    pcmKernel(sampleRate, baudRate, transmission, transmissionLength, level, out);
+}
+
+/**
+ * Renders every bit at SYMRATE first and picks the output samples from
+ * that.
+ */
+void pcmEncodeResampled(
+        uint32_t sampleRate,
+        uint32_t baudRate,
+        uint32_t* transmission,
+        size_t transmissionLength,
+        int16_t level,
         uint8_t* out) {
 
     int repeatsPerBit = SYMRATE / baudRate;
@@ -265,9 +1549,9 @@ void pcmEncodeTransmission(
             int bit = (val >> (31 - bitNum)) & 1;
             int16_t sample;
             if (bit == 0) {
-                sample = 32767 / 2;
+                sample = level;
             } else {
-                sample = -32767 / 2;
+                sample = -level;
             }
             for (int r = 0; r < repeatsPerBit; r++) {
                 *psamples = sample;
@@ -290,133 +1574,7361 @@ void pcmEncodeTransmission(
     free(samples);
 }
 
-
+/**
+ * Same as pcmEncodeResampled(), straight from the codewords with
+ * pcmRenderCodewords() and without the SYMRATE buffer.
+ */
+void pcmEncodeDirect(
+        uint32_t sampleRate,
+        uint32_t baudRate,
+        uint32_t* transmission,
+        size_t transmissionLength,
+        int16_t level,
+        uint8_t* out) {
+
+    size_t numSamples = pcmTransmissionLength(sampleRate, baudRate, transmissionLength) / 2;
+    int16_t* samples = (int16_t*) out;
+    pcmRenderCodewords(sampleRate, baudRate, level, transmission, 0, numSamples, samples);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    //Write little-endian
+    for (size_t i = 0; i < numSamples; i++) {
+        samples[i] = (int16_t) __builtin_bswap16((uint16_t) samples[i]);
+    }
+#endif
+}
+
+/**
+ * Samples per bit when sampleRate is a whole multiple of baudRate, else 0.
+ * Then output sample k shows bit k / samplesPerBit, exactly what the
+ * SYMRATE mapping gives, as long as SYMRATE is a multiple of the baud rate
+ * too.
+ */
+uint32_t pcmSamplesPerBit(uint32_t sampleRate, uint32_t baudRate) {
+    if (baudRate == 0 || sampleRate % baudRate != 0 || SYMRATE % baudRate != 0) {
+        return 0;
+    }
+    return sampleRate / baudRate;
+}
+
+/**
+ * Fills n samples with one value, eight at a time with vector stores. The
+ * last store is moved back to end at n, overlapping the one before it
+ * rather than running past the bit.
+ */
+static void pcmFill(int16_t* out, int16_t value, size_t n) {
+#if defined(__SSE2__)
+    if (n >= 8) {
+        __m128i samples = _mm_set1_epi16(value);
+        for (size_t j = 0; j + 8 <= n; j += 8) {
+            _mm_storeu_si128((__m128i*) (out + j), samples);
+        }
+        _mm_storeu_si128((__m128i*) (out + n - 8), samples);
+        return;
+    }
+#elif defined(__aarch64__)
+    if (n >= 8) {
+        int16x8_t samples = vdupq_n_s16(value);
+        for (size_t j = 0; j + 8 <= n; j += 8) {
+            vst1q_s16(out + j, samples);
+        }
+        vst1q_s16(out + n - 8, samples);
+        return;
+    }
+#endif
+    for (size_t j = 0; j < n; j++) {
+        out[j] = value;
+    }
+}
+
+/**
+ * Renders samples [first, first + numSamples) at samplesPerBit samples per
+ * bit, `space` for a 0 bit and `mark` for a 1 bit: one fill per bit, with
+ * no per-sample work at all.
+ */
+static void pcmRenderInteger(
+        uint32_t samplesPerBit,
+        int16_t space,
+        int16_t mark,
+        const uint32_t* transmission,
+        uint64_t first,
+        size_t numSamples,
+        int16_t* out) {
+
+    uint64_t bit = first / samplesPerBit;
+    size_t positionInBit = first % samplesPerBit;
+    size_t k = 0;
+    while (k < numSamples) {
+        size_t n = samplesPerBit - positionInBit;
+        if (n > numSamples - k) {
+            n = numSamples - k;
+        }
+        uint32_t val = transmission[bit / 32];
+        pcmFill(out + k, (val >> (31 - bit % 32)) & 1 ? mark : space, n);
+        k += n;
+        positionInBit = 0;
+        bit++;
+    }
+}
+
+/**
+ * Same as pcmEncodeResampled(), for rates where pcmSamplesPerBit() isn't
+ * 0. Output runs at about the speed of memory.
+ */
+void pcmEncodeInteger(
+        uint32_t sampleRate,
+        uint32_t baudRate,
+        uint32_t* transmission,
+        size_t transmissionLength,
+        int16_t level,
+        uint8_t* out) {
+
+    int16_t space = level;
+    int16_t mark = -level;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    //Write little-endian: every sample is one of these two
+    space = (int16_t) __builtin_bswap16((uint16_t) space);
+    mark = (int16_t) __builtin_bswap16((uint16_t) mark);
+#endif
+    size_t numSamples = pcmTransmissionLength(sampleRate, baudRate, transmissionLength) / 2;
+    pcmRenderInteger(pcmSamplesPerBit(sampleRate, baudRate), space, mark,
+                     transmission, 0, numSamples, (int16_t*) out);
+}
+
+
+// =========================================================
+// PCM MIT WAHLFREIEM ZUGRIFF
+// =========================================================
+
+/**
+ * Renders samples [first, first + numSamples) of a transmission straight
+ * from its codewords. This is the same mapping pcmEncodeTransmission()
+ * does through its SYMRATE buffer: output sample k shows the bit containing
+ * symbol k * SYMRATE / sampleRate. The symbol position is stepped forward
+ * with a running remainder, so there's no division per sample. At whole
+ * samples per bit, pcmRenderInteger() does the work.
+ */
+void pcmRenderCodewords(
+        uint32_t sampleRate,
+        uint32_t baudRate,
+        int16_t level,
+        const uint32_t* transmission,
+        uint64_t first,
+        size_t numSamples,
+        int16_t* out) {
+
+    uint32_t samplesPerBit = pcmSamplesPerBit(sampleRate, baudRate);
+    if (samplesPerBit != 0) {
+        pcmRenderInteger(samplesPerBit, level, -level, transmission, first, numSamples, out);
+        return;
+    }
+    uint32_t repeatsPerBit = SYMRATE / baudRate;
+    uint64_t symbol = first * SYMRATE / sampleRate;
+    uint64_t remainder = first * SYMRATE % sampleRate;
+    uint64_t bit = symbol / repeatsPerBit;
+    uint32_t positionInBit = symbol % repeatsPerBit;
+
+    for (size_t k = 0; k < numSamples; k++) {
+        uint32_t val = transmission[bit / 32];
+        out[k] = (val >> (31 - bit % 32)) & 1 ? -level : level;
+
+        //Advance by SYMRATE / sampleRate symbols
+        positionInBit += SYMRATE / sampleRate;
+        remainder += SYMRATE % sampleRate;
+        if (remainder >= sampleRate) {
+            remainder -= sampleRate;
+            positionInBit++;
+        }
+        while (positionInBit >= repeatsPerBit) {
+            positionInBit -= repeatsPerBit;
+            bit++;
+        }
+    }
+}
+
+void pcmRendererInit(PcmRenderer* renderer, uint32_t sampleRate, uint32_t baudRate) {
+    memset(renderer, 0, sizeof(PcmRenderer));
+    renderer->sampleRate = sampleRate;
+    renderer->baudRate = baudRate;
+    renderer->level = PCM_LEVEL;
+}
+
+/**
+ * Adds a segment to the end of the timeline, or returns NULL and leaves the
+ * timeline as it was if there is no memory for it.
+ */
+static PcmSegment* pcmRendererAppend(PcmRenderer* renderer, uint64_t numSamples) {
+    if (renderer->numSegments == renderer->capacity) {
+        size_t capacity = renderer->capacity == 0 ? 16 : renderer->capacity * 2;
+        PcmSegment* segments = (PcmSegment*)
+            realloc(renderer->segments, sizeof(PcmSegment) * capacity);
+        if (segments == NULL) {
+            return NULL;
+        }
+        renderer->segments = segments;
+        renderer->capacity = capacity;
+    }
+    PcmSegment* segment = &renderer->segments[renderer->numSegments++];
+    segment->start = renderer->totalSamples;
+    segment->numSamples = numSamples;
+    segment->codewords = NULL;
+    segment->numCodewords = 0;
+    renderer->totalSamples += numSamples;
+    return segment;
+}
+
+/**
+ * Appends a transmission to the end of the timeline. The codewords are
+ * copied. Returns non-zero, with the timeline unchanged, if there is no
+ * memory for it.
+ */
+int pcmRendererAddTransmission(
+        PcmRenderer* renderer,
+        const uint32_t* transmission,
+        size_t transmissionLength) {
+
+    uint32_t* codewords = (uint32_t*) malloc(sizeof(uint32_t) * transmissionLength);
+    if (codewords == NULL) {
+        return 1;
+    }
+    PcmSegment* segment = pcmRendererAppend(renderer,
+        pcmTransmissionLength(renderer->sampleRate, renderer->baudRate, transmissionLength) / 2);
+    if (segment == NULL) {
+        free(codewords);
+        return 1;
+    }
+    memcpy(codewords, transmission, sizeof(uint32_t) * transmissionLength);
+    segment->codewords = codewords;
+    segment->numCodewords = transmissionLength;
+    return 0;
+}
+
+/**
+ * Appends numSamples of silence. Returns non-zero, with the timeline
+ * unchanged, if there is no memory for it.
+ */
+int pcmRendererAddSilence(PcmRenderer* renderer, uint64_t numSamples) {
+    return pcmRendererAppend(renderer, numSamples) == NULL;
+}
+
+/**
+ * Renders the samples [offset, offset + numSamples) of the timeline into out,
+ * in host byte order. The window may start anywhere, so playout can seek
+ * and rewind freely. Returns the number of samples rendered, which is less
+ * than asked for only at the end of the timeline.
+ */
+size_t pcmRendererRead(
+        const PcmRenderer* renderer,
+        uint64_t offset,
+        size_t numSamples,
+        int16_t* out) {
+
+    if (offset >= renderer->totalSamples) {
+        return 0;
+    }
+    if (numSamples > renderer->totalSamples - offset) {
+        numSamples = renderer->totalSamples - offset;
+    }
+
+    //Binary search for the segment holding the first sample
+    size_t low = 0;
+    size_t high = renderer->numSegments;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (renderer->segments[middle].start <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    size_t rendered = 0;
+    for (size_t s = low; rendered < numSamples; s++) {
+        const PcmSegment* segment = &renderer->segments[s];
+        uint64_t within = offset + rendered - segment->start;
+        size_t count = segment->numSamples - within;
+        if (count > numSamples - rendered) {
+            count = numSamples - rendered;
+        }
+
+        if (segment->codewords == NULL) {
+            memset(out + rendered, 0, sizeof(int16_t) * count);
+        } else {
+            pcmRenderCodewords(renderer->sampleRate, renderer->baudRate, renderer->level,
+                               segment->codewords, within, count, out + rendered);
+        }
+        rendered += count;
+    }
+    return rendered;
+}
+
+void pcmRendererFree(PcmRenderer* renderer) {
+    for (size_t s = 0; s < renderer->numSegments; s++) {
+        free(renderer->segments[s].codewords);
+    }
+    free(renderer->segments);
+    memset(renderer, 0, sizeof(PcmRenderer));
+}
+
+
+// =========================================================
+// VIELE NACHRICHTEN AUF EINMAL (STRUCT OF ARRAYS)
+// =========================================================
+
+/*
+ * messageLength() for four messages at once. Per lane:
+ *   words = 2 * (address & 7) + 1 + ceil(7 * length / 20) + 1
+ *   words = (words | 15) + 1         (bis zum Ende des Batches auffüllen)
+ *   words += words / 16              (ein SYNC je Batch)
+ * The division by 20 is a multiplication by 0xCCCCCCCD >> 36, which is
+ * exact for every 32-bit value. Both SSE2 and NEON are always there on
+ * their architectures, so no runtime check is needed.
+ */
+#if defined(__SSE2__)
+static __m128i messageLengths4(const uint32_t* addresses, const uint32_t* lengths, uint32_t preambleWords) {
+    __m128i address = _mm_loadu_si128((const __m128i*) addresses);
+    __m128i length = _mm_loadu_si128((const __m128i*) lengths);
+    __m128i bits = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(length, 3), length),
+                                 _mm_set1_epi32(TEXT_BITS_PER_WORD - 1));
+
+    __m128i magic = _mm_set1_epi32(0xCCCCCCCD);
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(bits, magic), 36);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(bits, 32), magic), 36);
+    __m128i textWords = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+
+    __m128i words = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(address, _mm_set1_epi32(0x7)), 1),
+                                  _mm_add_epi32(textWords, _mm_set1_epi32(2)));
+    words = _mm_add_epi32(_mm_or_si128(words, _mm_set1_epi32(BATCH_SIZE - 1)), _mm_set1_epi32(1));
+    words = _mm_add_epi32(words, _mm_srli_epi32(words, 4));
+    return _mm_add_epi32(words, _mm_set1_epi32(preambleWords));
+}
+
+/**
+ * Inclusive prefix sum of the four lanes.
+ */
+static void prefixSum4(__m128i words, uint32_t* out) {
+    words = _mm_add_epi32(words, _mm_slli_si128(words, 4));
+    words = _mm_add_epi32(words, _mm_slli_si128(words, 8));
+    _mm_storeu_si128((__m128i*) out, words);
+}
+#define HAVE_SIMD_LENGTHS
+#elif defined(__aarch64__)
+static uint32x4_t messageLengths4(const uint32_t* addresses, const uint32_t* lengths, uint32_t preambleWords) {
+    uint32x4_t address = vld1q_u32(addresses);
+    uint32x4_t length = vld1q_u32(lengths);
+    uint32x4_t bits = vaddq_u32(vmulq_n_u32(length, TEXT_BITS_PER_CHAR),
+                                vdupq_n_u32(TEXT_BITS_PER_WORD - 1));
+
+    uint32x2_t magic = vdup_n_u32(0xCCCCCCCD);
+    uint32x2_t low = vshrn_n_u64(vmull_u32(vget_low_u32(bits), magic), 32);
+    uint32x2_t high = vshrn_n_u64(vmull_u32(vget_high_u32(bits), magic), 32);
+    uint32x4_t textWords = vshrq_n_u32(vcombine_u32(low, high), 4);
+
+    uint32x4_t words = vaddq_u32(vshlq_n_u32(vandq_u32(address, vdupq_n_u32(0x7)), 1),
+                                 vaddq_u32(textWords, vdupq_n_u32(2)));
+    words = vaddq_u32(vorrq_u32(words, vdupq_n_u32(BATCH_SIZE - 1)), vdupq_n_u32(1));
+    words = vaddq_u32(words, vshrq_n_u32(words, 4));
+    return vaddq_u32(words, vdupq_n_u32(preambleWords));
+}
+
+/**
+ * Inclusive prefix sum of the four lanes.
+ */
+static void prefixSum4(uint32x4_t words, uint32_t* out) {
+    uint32x4_t zero = vdupq_n_u32(0);
+    words = vaddq_u32(words, vextq_u32(zero, words, 3));
+    words = vaddq_u32(words, vextq_u32(zero, words, 2));
+    vst1q_u32(out, words);
+}
+#define HAVE_SIMD_LENGTHS
+#endif
+
+/**
+ * Computes where each message's transmission starts in one contiguous
+ * output: offsets[i] for message i, and offsets[count] for the end, which
+ * is also returned. Messages must be shorter than 2^28 characters.
+ */
+size_t transmissionOffsets(
+        const uint32_t* addresses,
+        const uint32_t* lengths,
+        size_t count,
+        uint32_t preambleLength,
+        size_t* offsets) {
+
+    size_t total = 0;
+    size_t i = 0;
+    offsets[0] = 0;
+#ifdef HAVE_SIMD_LENGTHS
+    uint32_t sums[4];
+    for (; i + 4 <= count; i += 4) {
+        prefixSum4(messageLengths4(addresses + i, lengths + i, preambleLength / 32), sums);
+        for (int k = 0; k < 4; k++) {
+            offsets[i + k + 1] = total + sums[k];
+        }
+        total += sums[3];
+    }
+#endif
+    for (; i < count; i++) {
+        total += messageLength(addresses[i], lengths[i], FLAG_FUNC_3, preambleLength);
+        offsets[i + 1] = total;
+    }
+    return total;
+}
+
+void* encodeWorker(void* arg) {
+    EncodeJob* job = (EncodeJob*) arg;
+    const MessageArrays* arrays = job->arrays;
+
+    for (;;) {
+        size_t first = __atomic_fetch_add(&job->next, ENCODE_BLOCK, __ATOMIC_RELAXED);
+        if (first >= arrays->count) {
+            return NULL;
+        }
+        size_t last = first + ENCODE_BLOCK < arrays->count ? first + ENCODE_BLOCK : arrays->count;
+        for (size_t i = first; i < last; i++) {
+            if (encodeTransmission(arrays->addresses[i], arrays->messages[i], arrays->lengths[i],
+                                   job->out + job->offsets[i],
+                                   arrays->functionCodes != NULL ? arrays->functionCodes[i] : FLAG_FUNC_3,
+                                   job->preambleLength) != 0) {
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+/**
+ * Encodes all messages into `out` at the offsets from
+ * transmissionOffsets(), on numThreads threads. The transmissions don't
+ * overlap, so the threads need no locking; the output is the same as
+ * encodeTransmission() one message after the other. Returns 1 if memory
+ * ran out for any of them.
+ */
+int encodeTransmissions(
+        const MessageArrays* arrays,
+        uint32_t preambleLength,
+        const size_t* offsets,
+        uint32_t* out,
+        int numThreads) {
+
+    EncodeJob job;
+    job.arrays = arrays;
+    job.preambleLength = preambleLength;
+    job.offsets = offsets;
+    job.out = out;
+    job.next = 0;
+    job.failed = 0;
+
+    //Not worth a thread for a handful of messages
+    pthread_t* workers = NULL;
+    if (numThreads > 1 && arrays->count > ENCODE_BLOCK) {
+        workers = (pthread_t*) malloc(sizeof(pthread_t) * numThreads);
+    }
+    if (workers == NULL) {
+        encodeWorker(&job);
+        return job.failed;
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_create(&workers[t], NULL, encodeWorker, &job);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    return job.failed;
+}
+
+
+// =========================================================
+// DUPLIKATFILTER UND RATENBEGRENZUNG
+// =========================================================
+
+/**
+ * Milliseconds from an arbitrary, monotonically increasing starting point.
+ */
+uint64_t monotonicMillis(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * 64-bit FNV-1a hash over everything that makes two pages identical on air:
+ * the address, the function code and the text.
+ */
+uint64_t messageHash(uint32_t address, FunctionCode functionCode, const char* message, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t header[2] = { address, functionCode };
+    const unsigned char* p = (const unsigned char*) header;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+    p = (const unsigned char*) message;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Returns 1 if a message with this hash was already seen within the window,
+ * otherwise remembers it and returns 0.
+ *
+ * Entries expire by themselves once they are older than the window, so the
+ * table never has to be cleared. All DEDUP_PROBES candidate slots are
+ * checked for the hash first, since an expired entry may sit in front of a
+ * live one. A new hash then goes into the first free or expired slot; when
+ * every candidate is still live the oldest one is evicted, and a duplicate
+ * may slip through rather than the filter growing without bound.
+ */
+int dedupSeen(DedupFilter* filter, uint64_t hash, uint64_t now) {
+    size_t home = hash & (DEDUP_SLOTS - 1);
+    DedupEntry* unused = NULL;
+    DedupEntry* oldest = NULL;
+
+    for (int probe = 0; probe < DEDUP_PROBES; probe++) {
+        DedupEntry* entry = &filter->entries[(home + probe) & (DEDUP_SLOTS - 1)];
+        int live = entry->used && now - entry->seenAt < filter->windowMs;
+
+        if (!live) {
+            if (unused == NULL) {
+                unused = entry;
+            }
+            continue;
+        }
+        if (entry->hash == hash) {
+            return 1;
+        }
+        if (oldest == NULL || entry->seenAt < oldest->seenAt) {
+            oldest = entry;
+        }
+    }
+
+    DedupEntry* victim = unused != NULL ? unused : oldest;
+    victim->hash = hash;
+    victim->seenAt = now;
+    victim->used = 1;
+    return 0;
+}
+
+/**
+ * Credits the tokens earned since the last refill, capped at the burst.
+ */
+static void rateBucketRefill(const RateLimiter* limiter, RateBucket* bucket, uint64_t now) {
+    uint64_t capacity = limiter->burst * 1000;
+
+    //Refill burst tokens per period, spread evenly over the period. The
+    //clock only moves on once a whole milli-token was earned, so frequent
+    //calls don't round the refill away.
+    uint64_t earned = (now - bucket->lastRefill) * capacity / limiter->periodMs;
+    if (earned > 0) {
+        bucket->milliTokens += earned;
+        bucket->lastRefill = now;
+    }
+    if (bucket->milliTokens >= capacity) {
+        bucket->milliTokens = capacity;
+        bucket->lastRefill = now;
+    }
+}
+
+/**
+ * Takes one token from the bucket of the given address. Returns 1 if the
+ * message may be sent, 0 if the pager has used up its burst.
+ *
+ * Buckets are grouped into sets of RATE_LIMIT_WAYS by address. A newcomer
+ * only takes over a bucket that is unused or has refilled completely, since
+ * such a bucket holds nothing a fresh one wouldn't. When every bucket of the
+ * set is still throttling its pager the newcomer passes untracked, so a
+ * colliding address can never reset a flooded pager's bucket.
+ */
+int rateLimitAllow(RateLimiter* limiter, uint32_t address, uint64_t now) {
+    uint32_t set = ((address * 2654435761u) >> 20) & (RATE_LIMIT_SLOTS / RATE_LIMIT_WAYS - 1);
+    RateBucket* ways = &limiter->buckets[set * RATE_LIMIT_WAYS];
+    uint64_t capacity = limiter->burst * 1000;
+
+    RateBucket* bucket = NULL;
+    RateBucket* replaceable = NULL;
+    for (int way = 0; way < RATE_LIMIT_WAYS; way++) {
+        RateBucket* candidate = &ways[way];
+        if (candidate->used && candidate->address == address) {
+            bucket = candidate;
+            break;
+        }
+        if (replaceable != NULL) {
+            continue;
+        }
+        if (candidate->used) {
+            rateBucketRefill(limiter, candidate, now);
+        }
+        if (!candidate->used || candidate->milliTokens == capacity) {
+            replaceable = candidate;
+        }
+    }
+
+    if (bucket == NULL) {
+        if (replaceable == NULL) {
+            return 1;
+        }
+        bucket = replaceable;
+        bucket->address = address;
+        bucket->used = 1;
+        bucket->milliTokens = capacity;
+        bucket->lastRefill = now;
+    }
+
+    rateBucketRefill(limiter, bucket, now);
+    if (bucket->milliTokens < 1000) {
+        return 0;
+    }
+    bucket->milliTokens -= 1000;
+    return 1;
+}
+
+
+// =========================================================
+// EINGABE PARSEN UND SENDEN
+// =========================================================
+
+/**
+ * Reads a decimal address. Values beyond 32 bits saturate instead of
+ * wrapping around, negative ones wrap as before, so both end up above
+ * MAX_ADDRESS.
+ */
+uint32_t parseAddress(const char* str) {
+    long long value = strtoll(str, NULL, 10);
+    if (value > UINT32_MAX) {
+        value = UINT32_MAX;
+    }
+    return (uint32_t) value;
+}
+
+/**
+ * Parses one line without its line ending.
+ * Lines are in the format of address:message OR address:function:message.
+ * The line is not modified and need not be null-terminated, but it has to
+ * stay alive as long as the record is used. Returns record->error.
+ */
+int parseLine(const char* line, size_t length, Record* record) {
+    size_t colonIndex1 = 0;
+    size_t colonIndex2 = 0;
+    uint32_t colonCount = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if (line[i] == ':') {
+            colonCount++;
+            if (colonCount == 1) {
+                colonIndex1 = i;
+            } else if (colonCount == 2) {
+                colonIndex2 = i;
+                break;
+            }
+        }
+    }
+
+    record->error = PARSE_OK;
+    if (colonCount == 0) {
+        record->error = PARSE_MISSING_COLON;
+        return record->error;
+    }
+
+    //strtol stops at the colon, so the numbers need no terminator of their own
+    // Fall 1: ADRESSE:NACHRICHT (Ein Doppelpunkt)
+    if (colonCount == 1) {
+        record->address = parseAddress(line);
+        record->message = line + colonIndex1 + 1;
+        record->functionCode = FLAG_FUNC_3; // Standard: Alpha (3)
+
+    // Fall 2: ADRESSE:FUNKTION:NACHRICHT (Zwei Doppelpunkte)
+    } else if (colonCount == 2) {
+        record->address = parseAddress(line);
+        record->functionCode = (uint32_t) strtol(line + colonIndex1 + 1, NULL, 10);
+        if (record->functionCode > 3) {
+            record->error = PARSE_INVALID_FUNCTION;
+            return record->error;
+        }
+        record->message = line + colonIndex2 + 1;
+    } else {
+        record->error = PARSE_TOO_MANY_COLONS;
+        return record->error;
+    }
+    record->length = line + length - record->message;
+
+    // Adressprüfung
+    if (record->address > MAX_ADDRESS) {
+        record->error = PARSE_INVALID_ADDRESS;
+    } else if (addressWordReserved(record->address, record->functionCode)) {
+        record->error = PARSE_RESERVED_ADDRESS;
+    }
+    return record->error;
+}
+
+/**
+ * Control characters as multimon-ng writes them, indexed by character code.
+ */
+static const char* const CONTROL_NAMES[32] = {
+    "NUL", "SOH", "STX", "ETX", "EOT", "ENQ", "ACK", "BEL",
+    "BS", "HT", "LF", "VT", "FF", "CR", "SO", "SI",
+    "DLE", "DC1", "DC2", "DC3", "DC4", "NAK", "SYN", "ETB",
+    "CAN", "EM", "SUB", "ESC", "FS", "GS", "RS", "US"
+};
+
+/**
+ * Matches a `<NAME>` escape at the start of str. Returns the character it
+ * stands for, or -1 if it isn't one, with the escape's length in *used.
+ */
+static int unescapeControl(const char* str, size_t available, size_t* used) {
+    const char* close = memchr(str, '>', available < 6 ? available : 6);
+    if (close == NULL) {
+        return -1;
+    }
+    size_t nameLength = close - str - 1;
+    *used = nameLength + 2;
+    for (int c = 0; c < 32; c++) {
+        if (strlen(CONTROL_NAMES[c]) == nameLength
+                && memcmp(str + 1, CONTROL_NAMES[c], nameLength) == 0) {
+            return c;
+        }
+    }
+    if (nameLength == 3 && memcmp(str + 1, "DEL", 3) == 0) {
+        return 127;
+    }
+    return -1;
+}
+
+/**
+ * Parses a decoded page as logged by multimon-ng, e.g.
+ *   POCSAG512: Address:       1  Function: 3  Alpha:   hello
+ * Lines that aren't pages (banners, other decoders) are PARSE_IGNORED.
+ *
+ * Control characters logged as <NUL>, <LF> and so on are turned back into
+ * bytes. If there are any, the text is unescaped into scratch, at the same
+ * offset as in line, otherwise the record points into the line itself.
+ * Trailing NULs are dropped: they are what the decoder makes of the zero
+ * bits padding the last codeword, not part of the original page.
+ *
+ * Numeric pages are re-encoded as their text like any other message, as the
+ * encoder doesn't support the numeric character set.
+ */
+int parseMultimonLine(const char* line, size_t length, char* scratch, Record* record) {
+    const char* end = line + length;
+    const char* p = line;
+
+    //Find "POCSAG<baud>: Address:", skipping anything in front of it such as
+    //a timestamp. Lines without it are banners or other decoders' output.
+    for (;; p++) {
+        while (end - p >= 6 && memcmp(p, "POCSAG", 6) != 0) {
+            p++;
+        }
+        if (end - p < 6) {
+            record->error = PARSE_IGNORED;
+            return record->error;
+        }
+        const char* field = p + 6;
+        while (field < end && *field >= '0' && *field <= '9') {
+            field++;
+        }
+        if (end - field >= 10 && memcmp(field, ": Address:", 10) == 0) {
+            p = field + 10;
+            break;
+        }
+    }
+
+    record->error = PARSE_MALFORMED_LOG;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    uint32_t address = 0;
+    const char* digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        //Saturate, anything above 21 bits is rejected below anyway
+        if (address <= MAX_ADDRESS) {
+            address = address * 10 + (*p - '0');
+        }
+        p++;
+    }
+    if (p == digits) {
+        return record->error;
+    }
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (end - p < 11 || memcmp(p, "Function: ", 10) != 0
+            || p[10] < '0' || p[10] > '9') {
+        return record->error;
+    }
+    record->address = address;
+    record->functionCode = p[10] - '0';
+    p += 11;
+
+    //Alpha text follows after three spaces, numeric text after one
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    record->message = p;
+    record->length = 0;
+    if (end - p >= 9 && memcmp(p, "Alpha:   ", 9) == 0) {
+        record->message = p + 9;
+    } else if (end - p >= 9 && memcmp(p, "Numeric: ", 9) == 0) {
+        record->message = p + 9;
+    } else if (p != end) {
+        return record->error;
+    }
+    record->length = end - record->message;
+
+    if (memchr(record->message, '<', record->length) != NULL) {
+        char* out = scratch + (record->message - line);
+        const char* in = record->message;
+        record->message = out;
+        while (in < end) {
+            size_t used;
+            int c = *in == '<' ? unescapeControl(in, end - in, &used) : -1;
+            if (c >= 0) {
+                *out++ = (char) c;
+                in += used;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        record->length = out - record->message;
+    }
+    while (record->length > 0 && record->message[record->length - 1] == 0) {
+        record->length--;
+    }
+
+    record->error = PARSE_OK;
+    if (record->address > MAX_ADDRESS) {
+        record->error = PARSE_INVALID_ADDRESS;
+    } else if (record->functionCode > 3) {
+        record->error = PARSE_INVALID_FUNCTION;
+    } else if (addressWordReserved(record->address, record->functionCode)) {
+        record->error = PARSE_RESERVED_ADDRESS;
+    }
+    return record->error;
+}
+
+/**
+ * Parses one line in the given input format. Scratch must have room for
+ * `length` bytes, it is only used by formats which need to rewrite the text.
+ */
+int parseRecord(int format, const char* line, size_t length, char* scratch, Record* record) {
+    if (format == INPUT_MULTIMON) {
+        return parseMultimonLine(line, length, scratch, record);
+    }
+    return parseLine(line, length, record);
+}
+
+/**
+ * Explains on stderr why a line was rejected.
+ */
+void printParseError(const Record* record) {
+    switch (record->error) {
+    case PARSE_MISSING_COLON:
+        fprintf(stderr, "Malformed Line: Missing colon separator(s)!\n");
+        break;
+    case PARSE_TOO_MANY_COLONS:
+        fprintf(stderr, "Malformed Line: Too many colons! Expected ADDR:MSG or ADDR:FUNC:MSG.\n");
+        break;
+    case PARSE_INVALID_FUNCTION:
+        fprintf(stderr, "Invalid Function: %u. Must be between 0 and 3.\n", record->functionCode);
+        break;
+    case PARSE_INVALID_ADDRESS:
+        fprintf(stderr, "Address exceeds 21 bits: %u\n", record->address);
+        break;
+    case PARSE_RESERVED_ADDRESS:
+        fprintf(stderr, "Address %u with function %u can't be paged: "
+                        "its address word is a SYNC or IDLE codeword\n",
+                record->address, record->functionCode);
+        break;
+    case PARSE_MALFORMED_LOG:
+        fprintf(stderr, "Malformed Line: Expected POCSAG<baud>: Address: ... Function: ...\n");
+        break;
+    case PARSE_INVALID_ID:
+        fprintf(stderr, "Malformed Line: Expected @ID and a space, with at most %d "
+                        "characters of ID.\n", MESSAGE_ID_SIZE - 1);
+        break;
+    }
+}
+
+void lineReaderInit(LineReader* reader, int fd) {
+    memset(reader, 0, sizeof(LineReader));
+    reader->fd = fd;
+    reader->buffer = (char*) malloc(INPUT_LINE_SIZE);
+}
+
+/**
+ * Copies the next line, with its newline, into `line` and null-terminates
+ * it. Like fgets(), a line too long for lineSize comes in several pieces.
+ * Returns its length, or 0 at the end of the input.
+ */
+size_t lineReaderNext(LineReader* reader, char* line, size_t lineSize) {
+    for (;;) {
+        size_t available = reader->end - reader->start;
+        const char* data = reader->buffer + reader->start;
+        const char* newline = (const char*) memchr(data, '\n', available);
+        size_t length = newline != NULL ? (size_t) (newline + 1 - data) : available;
+        if (newline != NULL || length >= lineSize - 1 || (reader->eof && length > 0)) {
+            if (length > lineSize - 1) {
+                length = lineSize - 1;
+            }
+            memcpy(line, data, length);
+            line[length] = 0;
+            reader->start += length;
+            return length;
+        }
+        if (reader->eof || reader->buffer == NULL) {
+            return 0;
+        }
+
+        memmove(reader->buffer, data, available);
+        reader->start = 0;
+        reader->end = available;
+        ssize_t got = read(reader->fd, reader->buffer + reader->end, INPUT_LINE_SIZE - reader->end);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            //Read errors end the input, as they do for fgets()
+            reader->eof = 1;
+        } else {
+            reader->end += got;
+        }
+    }
+}
+
+/**
+ * True if lineReaderNext() wouldn't block: a whole line is buffered, or
+ * more input (or the end of it) is waiting to be read.
+ */
+int lineReaderPending(LineReader* reader) {
+    if (reader->eof
+            || memchr(reader->buffer + reader->start, '\n', reader->end - reader->start) != NULL) {
+        return 1;
+    }
+    struct pollfd input = { reader->fd, POLLIN, 0 };
+    return poll(&input, 1, 0) > 0;
+}
+
+/**
+ * Reads the next line from `in` and parses it. Returns PARSE_OK or a
+ * parse error with the record filled in, PARSE_IGNORED for lines without
+ * a message, or EOF. `position` is the byte offset of the line in the
+ * input and is moved on past it. If `id` is given, a leading "@ID " is
+ * split off into it first, otherwise it is set to an empty string.
+ */
+int readRecord(
+        LineReader* in,
+        int format,
+        char* line,
+        size_t lineSize,
+        char* text,
+        uint64_t* position,
+        char* id,
+        Record* record) {
+
+    size_t line_length = lineReaderNext(in, line, lineSize);
+    if (line_length == 0) {
+        return EOF;
+    }
+
+    // --- Bereinigung der Eingabe
+    uint64_t linePosition = *position;
+    *position += line_length;
+
+    if (line[line_length - 1] == '\n') {
+        line_length--;
+        line[line_length] = 0;
+    }
+    if (line_length > 0 && line[line_length - 1] == '\r') {
+        line_length--;
+        line[line_length] = 0;
+    }
+
+    // --- Nachrichten-ID abtrennen
+    const char* start = line;
+    if (id != NULL) {
+        id[0] = 0;
+        if (line[0] == '@') {
+            size_t idLength = strcspn(line + 1, " ");
+            if (idLength == 0 || idLength >= MESSAGE_ID_SIZE || line[1 + idLength] != ' ') {
+                record->error = PARSE_INVALID_ID;
+                return PARSE_INVALID_ID;
+            }
+            memcpy(id, line + 1, idLength);
+            id[idLength] = 0;
+            start = line + idLength + 2;
+            line_length -= idLength + 2;
+        }
+    }
+
+    // --- Parsing
+    int error = parseRecord(format, start, line_length, text, record);
+    record->position = linePosition;
+    return error;
+}
+
+/**
+ * Writes PCM bytes to the output, keeping count of the samples so far.
+ */
+void emitSamples(Transmitter* transmitter, const uint8_t* pcm, size_t numBytes) {
+    if (transmitter->recorder != NULL) {
+        recorderWrite(transmitter->recorder, pcm, numBytes);
+    }
+    if (!transmitter->health.watched) {
+        fwrite(pcm, sizeof(uint8_t), numBytes, transmitter->out);
+        transmitter->samplesWritten += numBytes / 2;
+        return;
+    }
+
+    Health* health = &transmitter->health;
+    for (size_t offset = 0; offset < numBytes; offset += STATUS_WRITE_CHUNK) {
+        size_t length = numBytes - offset < STATUS_WRITE_CHUNK ? numBytes - offset : STATUS_WRITE_CHUNK;
+        __atomic_store_n(&health->writeStarted, monotonicNanos(), __ATOMIC_RELEASE);
+        fwrite(pcm + offset, sizeof(uint8_t), length, transmitter->out);
+        __atomic_store_n(&health->samples, transmitter->samplesWritten + (offset + length) / 2,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&health->writeFinished, monotonicNanos(), __ATOMIC_RELEASE);
+    }
+    transmitter->samplesWritten += numBytes / 2;
+}
+
+/**
+ * Encodes a parsed record and writes it out, followed by a random delay,
+ * unless a filter drops it or the scheduler queues it. Returns
+ * TRANSMIT_SENT, TRANSMIT_SCHEDULED or TRANSMIT_DROPPED.
+ */
+int transmitRecord(Transmitter* transmitter, const Record* record) {
+    uint32_t address = record->address;
+    FunctionCode functionCode = record->functionCode;
+    healthPending(&transmitter->health, 1);
+
+    // --- Filter: Wiederholungen und Fluten verwerfen, bevor sie Sendezeit kosten
+    uint64_t now = monotonicMillis();
+    if (transmitter->dedup != NULL
+            && dedupSeen(transmitter->dedup,
+                         messageHash(address, functionCode, record->message, record->length),
+                         now)) {
+        fprintf(stderr, "Dropping duplicate message for address %u\n", address);
+        healthPending(&transmitter->health, -1);
+        return TRANSMIT_DROPPED;
+    }
+    if (transmitter->rateLimiter != NULL
+            && !rateLimitAllow(transmitter->rateLimiter, address, now)) {
+        fprintf(stderr, "Rate limit exceeded, dropping message for address %u\n", address);
+        healthPending(&transmitter->health, -1);
+        return TRANSMIT_DROPPED;
+    }
+
+    if (transmitter->scheduler != NULL) {
+        return schedulerSubmit(transmitter, record);
+    }
+    if (transmitter->slots != NULL) {
+        return slotSubmit(transmitter, record);
+    }
+    return sendTransmission(transmitter, &record, 1, BAUD_RATE);
+}
+
+/**
+ * Encodes one transmission at the given baud rate and writes it out,
+ * followed by a random delay. A single record is sent on its own, several
+ * share the batches of one transmission. The index and the recorder get
+ * one entry per transmission, under the address of its first record.
+ * Returns TRANSMIT_SENT, or TRANSMIT_DROPPED if it ran out of memory.
+ */
+int sendTransmission(
+        Transmitter* transmitter,
+        const Record* const* records,
+        size_t numRecords,
+        uint32_t baudRate) {
+
+    const Record* record = records[0];
+    uint32_t address = record->address;
+    FunctionCode functionCode = record->functionCode;
+
+    // --- Kodierung und Ausgabe
+    Config defaults;
+    const Config* config = &defaults;
+    if (transmitter->config != NULL) {
+        config = configAcquire(transmitter->config);
+    } else {
+        defaultConfig(&defaults);
+    }
+
+    // Korrektur: Variable umbenannt, um Kollision zu vermeiden
+    size_t requiredMessageLength;
+    uint32_t* transmission;
+    if (numRecords == 1) {
+        requiredMessageLength =
+             messageLength(address, record->length, functionCode, config->preambleLength);
+
+        transmission =
+             (uint32_t*) malloc(sizeof(uint32_t) * requiredMessageLength);
+
+        // NEU: functionCode wird übergeben
+        if (transmission != NULL
+                && encodeTransmission(address, record->message, record->length, transmission,
+                                      functionCode, config->preambleLength) != 0) {
+            free(transmission);
+            transmission = NULL;
+        }
+    } else {
+        requiredMessageLength = encodeMultiTransmission(
+             records, numRecords, config->preambleLength, &transmission);
+    }
+    if (transmission == NULL) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", address);
+        healthPending(&transmitter->health, -(int64_t) numRecords);
+        if (transmitter->config != NULL) {
+            configRelease(transmitter->config);
+        }
+        return TRANSMIT_DROPPED;
+    }
+
+    size_t pcmLength =
+         pcmTransmissionLength(transmitter->sampleRate, baudRate, requiredMessageLength);
+
+    uint8_t* pcm =
+         (uint8_t*) malloc(sizeof(uint8_t) * pcmLength);
+    if (pcm == NULL) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", address);
+        healthPending(&transmitter->health, -(int64_t) numRecords);
+        free(transmission);
+        if (transmitter->config != NULL) {
+            configRelease(transmitter->config);
+        }
+        return TRANSMIT_DROPPED;
+    }
+
+    pcmEncodeTransmission(
+             transmitter->sampleRate, baudRate, transmission, requiredMessageLength,
+             config->level, pcm);
+
+    if (transmitter->index != NULL || transmitter->recorder != NULL) {
+        uint32_t crc = crc32c(0, pcm, pcmLength);
+        if (transmitter->index != NULL) {
+            fprintf(transmitter->index, "%llu %llu %u %u %08x\n",
+                    (unsigned long long) transmitter->samplesWritten,
+                    (unsigned long long) pcmLength / 2,
+                    address, functionCode, crc);
+        }
+        if (transmitter->recorder != NULL) {
+            recorderIndex(transmitter->recorder, pcmLength / 2, address, functionCode, crc);
+        }
+    }
+
+    //Write as series of little endian 16 bit samples
+    emitSamples(transmitter, pcm, pcmLength);
+    __atomic_add_fetch(&transmitter->messagesSent, numRecords, __ATOMIC_RELAXED);
+    healthPending(&transmitter->health, -(int64_t) numRecords);
+
+    free(transmission);
+    free(pcm);
+
+    // --- Stille generieren
+    size_t silenceLength = delaySamples(transmitter, config, record->position,
+                                        transmitter->sampleRate);
+    if (transmitter->config != NULL) {
+        configRelease(transmitter->config);
+    }
+    //Written from a block of zeros, however long the delay
+    static const uint8_t silence[SILENCE_CHUNK];
+    for (size_t left = sizeof(uint16_t) * silenceLength; left > 0; ) {
+        size_t length = left < SILENCE_CHUNK ? left : SILENCE_CHUNK;
+        emitSamples(transmitter, silence, length);
+        left -= length;
+    }
+    return TRANSMIT_SENT;
+}
+
+/**
+ * Picks the length of the silence after the message at the given input
+ * position, in samples at sampleRate.
+ */
+size_t delaySamples(
+        const Transmitter* transmitter,
+        const Config* config,
+        uint64_t position,
+        uint32_t sampleRate) {
+
+    if (transmitter->slots != NULL) {
+        //The schedule decides when to send
+        return 0;
+    }
+    size_t silenceRange = (size_t) sampleRate * (config->maxDelay - config->minDelay);
+    size_t silenceLength = (size_t) sampleRate * config->minDelay;
+    if (silenceRange == 0) {
+        //Feste Pause
+    } else if (transmitter->seeded) {
+        //splitmix64 over seed and line position
+        uint64_t z = transmitter->seed + (position + 1) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        silenceLength += z % silenceRange;
+    } else {
+        silenceLength += rand() % silenceRange;
+    }
+    return silenceLength;
+}
+
+/**
+ * Completes the output after the last message. The total at the end of the
+ * index also shows that the run wasn't cut short.
+ */
+void finishTransmission(Transmitter* transmitter) {
+    if (transmitter->scheduler != NULL) {
+        schedulerFlush(transmitter);
+    }
+    if (transmitter->index != NULL) {
+        fprintf(transmitter->index, "# total_samples %llu\n",
+                (unsigned long long) transmitter->samplesWritten);
+        fflush(transmitter->index);
+    }
+    fflush(transmitter->out);
+    if (transmitter->watchdog != NULL) {
+        watchdogReport(transmitter->watchdog, 1);
+    }
+    if (transmitter->stats) {
+        fprintf(stderr, "Sent %llu messages, %llu samples\n",
+                (unsigned long long) transmitter->messagesSent,
+                (unsigned long long) transmitter->samplesWritten);
+    }
+}
+
+
+// =========================================================
+// ADAPTIVE BAUDRATE (FÄHIGKEITSTABELLE UND WARTESCHLANGE)
+// =========================================================
+
+/**
+ * Encodes several messages as one transmission, each placed into the first
+ * free slots of its frame, so short messages fill the gaps in front of the
+ * frames of the others. A message is always followed by IDLE or the
+ * address word of another one. Stores the malloc'd codewords in *out and
+ * returns their number.
+ */
+size_t encodeMultiTransmission(
+        const Record* const* records,
+        size_t numRecords,
+        uint32_t preambleLength,
+        uint32_t** out) {
+
+    //Every message fits into its own words plus one batch of waiting
+    size_t maxBatches = 1;
+    for (size_t r = 0; r < numRecords; r++) {
+        maxBatches += 1 + (1 + (records[r]->length * TEXT_BITS_PER_CHAR
+                                + (TEXT_BITS_PER_WORD - 1)) / TEXT_BITS_PER_WORD
+                           + BATCH_SIZE - 1) / BATCH_SIZE;
+    }
+    Batch* batches = allocBatches(maxBatches);
+    if (batches == NULL) {
+        *out = NULL;
+        return 0;
+    }
+
+    size_t end = 0;
+    for (size_t r = 0; r < numRecords; r++) {
+        size_t next = batchPlaceMessage(batches, maxBatches, 0, records[r]->address,
+                                        records[r]->message, records[r]->length,
+                                        records[r]->functionCode);
+        end = next > end ? next : end;
+    }
+
+    //Like messageLength(): a last message ending on a batch boundary still
+    //gets a batch of IDLE after it
+    size_t numBatches = end / BATCH_SIZE + 1;
+    size_t length = preambleLength / 32 + numBatches * BATCH_WORDS;
+    *out = (uint32_t*) malloc(sizeof(uint32_t) * length);
+    if (*out == NULL) {
+        free(batches);
+        return 0;
+    }
+    for (uint32_t i = 0; i < preambleLength / 32; i++) {
+        (*out)[i] = 0xAAAAAAAA;
+    }
+    batchSerialise(batches, numBatches, *out + preambleLength / 32);
+    free(batches);
+    return length;
+}
+
+/**
+ * Maps the capability table. Returns 1 on error.
+ */
+int loadCapabilities(const char* path, Scheduler* scheduler) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size != CAPABILITY_TABLE_SIZE) {
+        fprintf(stderr, "%s: capability table must be %d bytes, one per capcode\n",
+                path, CAPABILITY_TABLE_SIZE);
+        close(fd);
+        return 1;
+    }
+    void* mapping = mmap(NULL, CAPABILITY_TABLE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+    //Lookups are scattered over the whole table
+    madvise(mapping, CAPABILITY_TABLE_SIZE, MADV_RANDOM);
+    scheduler->capabilities = (const uint8_t*) mapping;
+    return 0;
+}
+
+/**
+ * Records the fastest rate of a pager in a capability table, creating the
+ * table if needed. Returns the exit code for main().
+ */
+int setCapability(const char* path, uint32_t address, uint32_t baudRate) {
+    if (address > MAX_ADDRESS) {
+        fprintf(stderr, "Address exceeds 21 bits: %u\n", address);
+        return 1;
+    }
+    if (baudRate != 512 && baudRate != 1200 && baudRate != 2400) {
+        fprintf(stderr, "Unsupported baud rate: %u. Must be 512, 1200 or 2400.\n", baudRate);
+        return 1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    uint8_t value = baudRate / 100;
+    if (ftruncate(fd, CAPABILITY_TABLE_SIZE) != 0
+            || pwrite(fd, &value, 1, address) != 1) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+/**
+ * The fastest rate the pager at this address takes, BAUD_RATE if unknown.
+ */
+uint32_t capableBaudRate(const Scheduler* scheduler, uint32_t address) {
+    uint8_t value = scheduler->capabilities[address];
+    if (value >= 24) {
+        return 2400;
+    }
+    if (value >= 12) {
+        return 1200;
+    }
+    return BAUD_RATE;
+}
+
+/**
+ * Queues a record which passed the filters, with a copy of its text.
+ * Returns TRANSMIT_SCHEDULED, or TRANSMIT_SENT if the queue was full and
+ * got flushed right away, or TRANSMIT_DROPPED if there is no memory to
+ * queue it.
+ */
+int schedulerSubmit(Transmitter* transmitter, const Record* record) {
+    Scheduler* scheduler = transmitter->scheduler;
+    if (scheduler->queue == NULL) {
+        scheduler->queue = (Record*) malloc(sizeof(Record) * SCHEDULER_MAX_QUEUE);
+    }
+    char* text = (char*) malloc(record->length > 0 ? record->length : 1);
+    if (scheduler->queue == NULL || text == NULL) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", record->address);
+        free(text);
+        healthPending(&transmitter->health, -1);
+        return TRANSMIT_DROPPED;
+    }
+    Record* queued = &scheduler->queue[scheduler->count++];
+    *queued = *record;
+    memcpy(text, record->message, record->length);
+    queued->message = text;
+
+    if (scheduler->count == SCHEDULER_MAX_QUEUE) {
+        schedulerFlush(transmitter);
+        return TRANSMIT_SENT;
+    }
+    return TRANSMIT_SCHEDULED;
+}
+
+/**
+ * Sends everything queued, in order. With a deep enough queue, the first
+ * message for a faster pager pulls all queued messages for pagers of the
+ * same rate into its transmission. Each transmission is rendered at one
+ * rate from its preamble to its end, the rate only changes in the silence
+ * between two transmissions. Without memory for the grouping, each message
+ * goes out on its own at BAUD_RATE.
+ */
+void schedulerFlush(Transmitter* transmitter) {
+    Scheduler* scheduler = transmitter->scheduler;
+    int grouping = scheduler->count >= scheduler->threshold;
+    const Record** members = (const Record**) malloc(sizeof(Record*) * (scheduler->count + 1));
+    uint8_t* sent = (uint8_t*) calloc(scheduler->count + 1, 1);
+
+    for (size_t i = 0; i < scheduler->count; i++) {
+        if (members == NULL || sent == NULL) {
+            const Record* record = &scheduler->queue[i];
+            sendTransmission(transmitter, &record, 1, BAUD_RATE);
+            continue;
+        }
+        if (sent[i]) {
+            continue;
+        }
+        uint32_t baudRate = grouping
+                          ? capableBaudRate(scheduler, scheduler->queue[i].address) : BAUD_RATE;
+        size_t numMembers = 0;
+        for (size_t j = i; j < scheduler->count; j++) {
+            if (!sent[j] && (j == i || (baudRate != BAUD_RATE
+                    && capableBaudRate(scheduler, scheduler->queue[j].address) == baudRate))) {
+                members[numMembers++] = &scheduler->queue[j];
+                sent[j] = 1;
+            }
+        }
+        sendTransmission(transmitter, members, numMembers, baudRate);
+    }
+
+    for (size_t i = 0; i < scheduler->count; i++) {
+        free((char*) scheduler->queue[i].message);
+    }
+    scheduler->count = 0;
+    free(members);
+    free(sent);
+}
+
+
+// =========================================================
+// MITSCHNITT UND WIEDERGABE
+// =========================================================
+
+uint64_t monotonicMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void writeVarint(FILE* file, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((int) (value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc((int) value, file);
+}
+
+/**
+ * Returns 0, or EOF if the file ends first.
+ */
+static int readVarint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return EOF;
+        }
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return EOF;
+}
+
+/**
+ * Creates a capture file. Returns non-zero on error.
+ */
+int openCapture(const char* path, Capture* capture) {
+    memset(capture, 0, sizeof(Capture));
+    capture->file = fopen(path, "wb");
+    if (capture->file == NULL) {
+        perror(path);
+        return 1;
+    }
+    if (fwrite(CAPTURE_MAGIC, 1, 8, capture->file) != 8 || fflush(capture->file) != 0) {
+        perror(path);
+        fclose(capture->file);
+        return 1;
+    }
+    capture->lastMicros = monotonicMicros();
+    return 0;
+}
+
+/**
+ * Logs a message as it arrives. Each message is flushed, so the log holds
+ * everything up to a crash. If the log can't be written, it is closed and
+ * the capture stops; returns non-zero then.
+ */
+int captureRecord(Capture* capture, const char* id, const Record* record) {
+    if (capture->file == NULL) {
+        return 1;
+    }
+    uint64_t now = monotonicMicros();
+    size_t idLength = id != NULL ? strlen(id) : 0;
+    writeVarint(capture->file, now - capture->lastMicros);
+    writeVarint(capture->file, record->position - capture->lastPosition);
+    writeVarint(capture->file, record->address);
+    fputc((int) record->functionCode, capture->file);
+    fputc((int) idLength, capture->file);
+    fwrite(id, 1, idLength, capture->file);
+    writeVarint(capture->file, record->length);
+    fwrite(record->message, 1, record->length, capture->file);
+    //The stream remembers any failed fputc() or fwrite() above
+    if (fflush(capture->file) != 0 || ferror(capture->file)) {
+        fprintf(stderr, "Writing the capture failed: %s, stopping the capture\n",
+                strerror(errno));
+        fclose(capture->file);
+        capture->file = NULL;
+        return 1;
+    }
+    capture->lastMicros = now;
+    capture->lastPosition = record->position;
+    return 0;
+}
+
+/**
+ * Opens a capture for replay at the given speed (1 = as recorded, 0 = as
+ * fast as the encoder takes it). Returns non-zero on error.
+ */
+int openReplay(const char* path, double speed, Replay* replay) {
+    memset(replay, 0, sizeof(Replay));
+    replay->speed = speed;
+    replay->file = fopen(path, "rb");
+    if (replay->file == NULL) {
+        perror(path);
+        return 1;
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, replay->file) != 8 || memcmp(magic, CAPTURE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        fclose(replay->file);
+        return 1;
+    }
+    replay->startMicros = monotonicMicros();
+    return 0;
+}
+
+/**
+ * Waits until the next message of the capture is due and returns it like
+ * readRecord() does, or EOF at the end. The text goes to `text`, which
+ * must hold INPUT_LINE_SIZE bytes, and the id to `id` if given. A message
+ * with an address or function no input line could have is a parse error.
+ */
+int replayRecord(Replay* replay, char* text, char* id, Record* record) {
+    uint64_t delay, advance, address, length;
+    int functionCode, idLength;
+    char idBuffer[256];
+
+    if (replay->peeked) {
+        delay = replay->peekedDelay;
+        replay->peeked = 0;
+    } else if (readVarint(replay->file, &delay) == EOF) {
+        return EOF;
+    }
+    if (readVarint(replay->file, &advance) == EOF
+            || readVarint(replay->file, &address) == EOF
+            || (functionCode = fgetc(replay->file)) == EOF
+            || (idLength = fgetc(replay->file)) == EOF
+            || fread(idBuffer, 1, idLength, replay->file) != (size_t) idLength
+            || readVarint(replay->file, &length) == EOF
+            || length > INPUT_LINE_SIZE
+            || fread(text, 1, length, replay->file) != length) {
+        fprintf(stderr, "Capture ends in the middle of a message, stopping the replay\n");
+        return EOF;
+    }
+
+    replay->micros += delay;
+    replay->position += advance;
+
+    //A damaged or foreign capture is rejected like a bad input line
+    record->address = address > UINT32_MAX ? UINT32_MAX : (uint32_t) address;
+    record->functionCode = functionCode;
+    record->error = PARSE_OK;
+    if (functionCode > 3) {
+        record->error = PARSE_INVALID_FUNCTION;
+    } else if (address > MAX_ADDRESS) {
+        record->error = PARSE_INVALID_ADDRESS;
+    } else if (addressWordReserved(record->address, record->functionCode)) {
+        record->error = PARSE_RESERVED_ADDRESS;
+    }
+    if (record->error != PARSE_OK) {
+        return record->error;
+    }
+
+    replay->count++;
+    if (replay->speed > 0) {
+        uint64_t due = replay->startMicros + (uint64_t) (replay->micros / replay->speed);
+        uint64_t now = monotonicMicros();
+        if (due > now) {
+            struct timespec wake = { (time_t) (due / 1000000), (long) (due % 1000000) * 1000 };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+            }
+        } else if (now - due > replay->maxLag) {
+            replay->maxLag = now - due;
+        }
+    }
+
+    if (id != NULL) {
+        size_t kept = idLength < MESSAGE_ID_SIZE ? idLength : MESSAGE_ID_SIZE - 1;
+        memcpy(id, idBuffer, kept);
+        id[kept] = 0;
+    }
+    record->message = text;
+    record->length = length;
+    record->position = replay->position;
+    return PARSE_OK;
+}
+
+void inputSourceInit(InputSource* source, int format) {
+    memset(source, 0, sizeof(InputSource));
+    lineReaderInit(&source->in, STDIN_FILENO);
+    source->format = format;
+    source->line = (char*) malloc(INPUT_LINE_SIZE);
+    source->text = (char*) malloc(INPUT_LINE_SIZE);
+}
+
+/**
+ * Gets the next message from stdin or the replay, see readRecord(), and
+ * captures it if it was accepted. At the end of a replay, reports on
+ * stderr how well the encoder kept up.
+ */
+static int readSourceRecord(InputSource* source, char* id, Record* record) {
+    int error;
+    if (source->replay != NULL) {
+        error = replayRecord(source->replay, source->text, id, record);
+        if (error == EOF && source->replay->speed > 0) {
+            fprintf(stderr, "Replayed %llu messages, at most %.3f s behind the capture\n",
+                    (unsigned long long) source->replay->count,
+                    source->replay->maxLag / 1e6);
+        } else if (error == EOF) {
+            fprintf(stderr, "Replayed %llu messages in %.3f s\n",
+                    (unsigned long long) source->replay->count,
+                    (monotonicMicros() - source->replay->startMicros) / 1e6);
+        }
+    } else {
+        error = readRecord(&source->in, source->format, source->line, INPUT_LINE_SIZE,
+                           source->text, &source->position, id, record);
+    }
+    if (error == PARSE_OK && source->capture != NULL) {
+        captureRecord(source->capture, id, record);
+    }
+    return error;
+}
+
+/**
+ * The reader thread of a captured InputSource, see inputSourceStart().
+ * Reads and captures messages until the input ends or has an error, and
+ * queues them for nextRecord().
+ */
+void* inputSourceReader(void* arg) {
+    InputSource* source = (InputSource*) arg;
+    char id[MESSAGE_ID_SIZE];
+    for (;;) {
+        Record record;
+        memset(&record, 0, sizeof(Record));
+        int error = readSourceRecord(source, source->withIds ? id : NULL, &record);
+        if (error == PARSE_IGNORED) {
+            continue;
+        }
+        size_t length = error == PARSE_OK ? record.length : 0;
+        Arrival* arrival = (Arrival*) malloc(sizeof(Arrival) + length);
+        if (arrival == NULL) {
+            fprintf(stderr, "Out of memory, dropping message for address %u\n", record.address);
+            continue;
+        }
+        arrival->next = NULL;
+        arrival->error = error;
+        arrival->record = record;
+        memcpy(arrival->text, record.message, length);
+        strcpy(arrival->id, source->withIds ? id : "");
+
+        pthread_mutex_lock(&source->lock);
+        while (source->numWaiting >= CAPTURE_MAX_WAITING) {
+            pthread_cond_wait(&source->changed, &source->lock);
+        }
+        if (source->tail != NULL) {
+            source->tail->next = arrival;
+        } else {
+            source->head = arrival;
+        }
+        source->tail = arrival;
+        source->numWaiting++;
+        pthread_cond_broadcast(&source->changed);
+        pthread_mutex_unlock(&source->lock);
+        if (error != PARSE_OK) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Moves the reading of stdin onto a thread of its own, so that a capture
+ * has the time each message arrived rather than the time the encoder got
+ * round to it. If `withIds`, nextRecord() must be given an id buffer.
+ * Returns non-zero on error.
+ */
+int inputSourceStart(InputSource* source, int withIds) {
+    pthread_t reader;
+    source->withIds = withIds;
+    source->threaded = 1;
+    pthread_mutex_init(&source->lock, NULL);
+    pthread_cond_init(&source->changed, NULL);
+    if (pthread_create(&reader, NULL, inputSourceReader, source) != 0) {
+        fprintf(stderr, "Can't start the input thread\n");
+        return 1;
+    }
+    pthread_detach(reader);
+    return 0;
+}
+
+/**
+ * Gets the next message, with the same results as readSourceRecord(). With
+ * the input on a thread of its own, see inputSourceStart(), it waits for
+ * the reader thread to queue one and takes it from there; the text stays
+ * valid until the next call. Otherwise it calls readSourceRecord() itself.
+ */
+int nextRecord(InputSource* source, char* id, Record* record) {
+    if (!source->threaded) {
+        return readSourceRecord(source, id, record);
+    }
+    pthread_mutex_lock(&source->lock);
+    while (source->head == NULL) {
+        pthread_cond_wait(&source->changed, &source->lock);
+    }
+    Arrival* arrival = source->head;
+    int error = arrival->error;
+    //The last one stays, so the input keeps ending the same way
+    if (error == PARSE_OK) {
+        source->head = arrival->next;
+        if (source->head == NULL) {
+            source->tail = NULL;
+        }
+        source->numWaiting--;
+        pthread_cond_broadcast(&source->changed);
+    }
+    pthread_mutex_unlock(&source->lock);
+
+    *record = arrival->record;
+    if (id != NULL) {
+        strcpy(id, arrival->id);
+    }
+    if (error == PARSE_OK) {
+        record->message = arrival->text;
+        free(source->current);
+        source->current = arrival;
+    }
+    return error;
+}
+
+/**
+ * Returns non-zero if the next message could be had without waiting, see
+ * lineReaderPending(). In a replay that means it is already due.
+ */
+int inputSourcePending(InputSource* source) {
+    Replay* replay = source->replay;
+    if (source->threaded) {
+        pthread_mutex_lock(&source->lock);
+        int pending = source->head != NULL;
+        pthread_mutex_unlock(&source->lock);
+        return pending;
+    }
+    if (replay == NULL) {
+        return lineReaderPending(&source->in);
+    }
+    if (!replay->peeked) {
+        if (readVarint(replay->file, &replay->peekedDelay) == EOF) {
+            return 0;
+        }
+        replay->peeked = 1;
+    }
+    if (replay->speed == 0) {
+        return 1;
+    }
+    uint64_t due = replay->startMicros
+                 + (uint64_t) ((replay->micros + replay->peekedDelay) / replay->speed);
+    return due <= monotonicMicros();
+}
+
+
+// =========================================================
+// WARTESCHLANGE MIT NACHRICHTEN-IDS (ABBRECHEN, PRIORITÄT)
+// =========================================================
+
+static void listAppend(MessageList* list, QueuedMessage* message) {
+    message->previous = list->tail;
+    message->next = NULL;
+    if (list->tail != NULL) {
+        list->tail->next = message;
+    } else {
+        list->head = message;
+    }
+    list->tail = message;
+}
+
+static void listRemove(MessageList* list, QueuedMessage* message) {
+    if (message->previous != NULL) {
+        message->previous->next = message->next;
+    } else {
+        list->head = message->next;
+    }
+    if (message->next != NULL) {
+        message->next->previous = message->previous;
+    } else {
+        list->tail = message->previous;
+    }
+    message->previous = message->next = NULL;
+}
+
+static void indexInsert(MessageQueue* queue, QueuedMessage* message) {
+    if (queue->numIndexed >= queue->numBuckets) {
+        //Rehash into twice the buckets
+        size_t numBuckets = queue->numBuckets * 2;
+        QueuedMessage** buckets = (QueuedMessage**) calloc(numBuckets, sizeof(QueuedMessage*));
+        if (buckets == NULL) {
+            //Out of memory, the chains just get longer
+            numBuckets = 0;
+        }
+        for (size_t b = 0; numBuckets > 0 && b < queue->numBuckets; b++) {
+            QueuedMessage* entry = queue->buckets[b];
+            while (entry != NULL) {
+                QueuedMessage* next = entry->nextInBucket;
+                size_t bucket = entry->idHash & (numBuckets - 1);
+                entry->nextInBucket = buckets[bucket];
+                buckets[bucket] = entry;
+                entry = next;
+            }
+        }
+        if (numBuckets > 0) {
+            free(queue->buckets);
+            queue->buckets = buckets;
+            queue->numBuckets = numBuckets;
+        }
+    }
+    size_t bucket = message->idHash & (queue->numBuckets - 1);
+    message->nextInBucket = queue->buckets[bucket];
+    queue->buckets[bucket] = message;
+    queue->numIndexed++;
+}
+
+static void indexRemove(MessageQueue* queue, QueuedMessage* message) {
+    QueuedMessage** link = &queue->buckets[message->idHash & (queue->numBuckets - 1)];
+    while (*link != message) {
+        link = &(*link)->nextInBucket;
+    }
+    *link = message->nextInBucket;
+    queue->numIndexed--;
+}
+
+/**
+ * Keeps a finished message for status queries, dropping the oldest one
+ * when the history is full.
+ */
+static void historyAppend(MessageQueue* queue, QueuedMessage* message) {
+    listAppend(&queue->history, message);
+    queue->numHistory++;
+    if (queue->numHistory > QUEUE_HISTORY) {
+        QueuedMessage* oldest = queue->history.head;
+        listRemove(&queue->history, oldest);
+        queue->numHistory--;
+        indexRemove(queue, oldest);
+        free(oldest);
+    }
+}
+
+static uint64_t idHash(const char* id) {
+    //FNV-1a, as for the duplicate filter
+    return messageHash(0, 0, id, strlen(id));
+}
+
+/**
+ * Sets up an empty queue. Returns non-zero if out of memory.
+ */
+int queueInit(MessageQueue* queue, InputSource* source) {
+    memset(queue, 0, sizeof(MessageQueue));
+    queue->source = source;
+    queue->listener = -1;
+    queue->numBuckets = QUEUE_MIN_BUCKETS;
+    queue->buckets = (QueuedMessage**) calloc(queue->numBuckets, sizeof(QueuedMessage*));
+    if (queue->buckets == NULL) {
+        return 1;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    return 0;
+}
+
+/**
+ * Looks up a message by id, pending or recently finished. The lock must be
+ * held.
+ */
+QueuedMessage* queueFind(MessageQueue* queue, const char* id) {
+    uint64_t hash = idHash(id);
+    QueuedMessage* entry = queue->buckets[hash & (queue->numBuckets - 1)];
+    while (entry != NULL && (entry->idHash != hash || strcmp(entry->id, id) != 0)) {
+        entry = entry->nextInBucket;
+    }
+    return entry;
+}
+
+/**
+ * Copies a record into the queue at the default priority. `id` may be
+ * empty, which makes the message unreachable from the control socket.
+ * Returns 1 if a message with the same id is still on its way, -1 if out
+ * of memory.
+ */
+int queueSubmit(MessageQueue* queue, const char* id, const Record* record) {
+    QueuedMessage* message = (QueuedMessage*) malloc(sizeof(QueuedMessage) + record->length);
+    if (message == NULL) {
+        return -1;
+    }
+    memcpy(message->text, record->message, record->length);
+    message->record = *record;
+    message->record.message = message->text;
+    strcpy(message->id, id);
+    message->idHash = idHash(id);
+    message->priority = QUEUE_DEFAULT_PRIORITY;
+    message->state = MESSAGE_PENDING;
+    message->nextInBucket = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (id[0] != 0) {
+        QueuedMessage* existing = queueFind(queue, id);
+        if (existing != NULL && existing->state <= MESSAGE_SCHEDULED) {
+            pthread_mutex_unlock(&queue->lock);
+            free(message);
+            return 1;
+        }
+        if (existing != NULL) {
+            //The id is reused, forget the old message
+            listRemove(&queue->history, existing);
+            queue->numHistory--;
+            indexRemove(queue, existing);
+            free(existing);
+        }
+        indexInsert(queue, message);
+    }
+    listAppend(&queue->pending[message->priority], message);
+    queue->numPending++;
+    if (queue->health != NULL) {
+        healthPending(queue->health, 1);
+    }
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/**
+ * Waits for the next message to send: the oldest one of the most urgent
+ * priority. From here on it can't be cancelled any more. Returns NULL once
+ * the input is closed and nothing is left.
+ */
+QueuedMessage* queueTake(MessageQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->numPending == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    QueuedMessage* message = NULL;
+    for (int priority = 0; priority < QUEUE_PRIORITIES && message == NULL; priority++) {
+        message = queue->pending[priority].head;
+        if (message != NULL) {
+            listRemove(&queue->pending[priority], message);
+            queue->numPending--;
+            message->state = MESSAGE_SENDING;
+            if (queue->health != NULL) {
+                healthPending(queue->health, -1);
+            }
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return message;
+}
+
+/**
+ * Files a message away once transmitRecord() is done with it, or frees it
+ * if it has no id. The oldest entry of the history is dropped when it is
+ * full. A message the scheduler only queued is kept aside until
+ * queueScheduledSent().
+ */
+void queueFinish(MessageQueue* queue, QueuedMessage* message, int outcome) {
+    pthread_mutex_lock(&queue->lock);
+    if (outcome == TRANSMIT_SCHEDULED) {
+        message->state = MESSAGE_SCHEDULED;
+        listAppend(&queue->scheduled, message);
+    } else {
+        message->state = outcome == TRANSMIT_DROPPED ? MESSAGE_DROPPED : MESSAGE_SENT;
+        if (message->id[0] == 0) {
+            free(message);
+        } else {
+            historyAppend(queue, message);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Marks every message the scheduler held as sent, once it has sent them.
+ */
+void queueScheduledSent(MessageQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    QueuedMessage* message;
+    while ((message = queue->scheduled.head) != NULL) {
+        listRemove(&queue->scheduled, message);
+        message->state = MESSAGE_SENT;
+        if (message->id[0] == 0) {
+            free(message);
+        } else {
+            historyAppend(queue, message);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Runs one command from the control socket and writes the reply line:
+ *
+ *   cancel ID          pulls a pending message out of the queue
+ *   priority ID LEVEL  moves a pending message to priority LEVEL
+ *   status ID          only reports
+ *
+ * Each replies with the id and the message's state afterwards: "pending"
+ * and its priority, "sending", "scheduled" (waiting in the --capabilities
+ * scheduler), "sent", "cancelled", "dropped" (by a filter, or for lack of
+ * memory) or "unknown".
+ */
+void queueControl(MessageQueue* queue, char* command, char* reply, size_t replySize) {
+    char* verb = strtok(command, " \t\r\n");
+    char* id = strtok(NULL, " \t\r\n");
+    char* argument = strtok(NULL, " \t\r\n");
+    if (verb == NULL || id == NULL
+            || (strcmp(verb, "cancel") != 0 && strcmp(verb, "status") != 0
+                && strcmp(verb, "priority") != 0)
+            || (strcmp(verb, "priority") == 0) != (argument != NULL)) {
+        snprintf(reply, replySize, "error expected cancel ID, status ID or priority ID LEVEL\n");
+        return;
+    }
+    int priority = 0;
+    if (argument != NULL) {
+        char* end;
+        priority = strtol(argument, &end, 10);
+        if (*end != 0 || priority < 0 || priority >= QUEUE_PRIORITIES) {
+            snprintf(reply, replySize, "error priority must be 0 to %d\n", QUEUE_PRIORITIES - 1);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    QueuedMessage* message = queueFind(queue, id);
+    if (message != NULL && message->state == MESSAGE_PENDING) {
+        if (strcmp(verb, "cancel") == 0) {
+            listRemove(&queue->pending[message->priority], message);
+            queue->numPending--;
+            message->state = MESSAGE_CANCELLED;
+            if (queue->health != NULL) {
+                healthPending(queue->health, -1);
+            }
+            historyAppend(queue, message);
+        } else if (strcmp(verb, "priority") == 0) {
+            listRemove(&queue->pending[message->priority], message);
+            message->priority = priority;
+            listAppend(&queue->pending[priority], message);
+        }
+    }
+
+    static const char* const states[] = {
+        "pending", "sending", "scheduled", "sent", "cancelled", "dropped"
+    };
+    if (message == NULL) {
+        snprintf(reply, replySize, "%s unknown\n", id);
+    } else if (message->state == MESSAGE_PENDING) {
+        snprintf(reply, replySize, "%s pending %d\n", id, message->priority);
+    } else {
+        snprintf(reply, replySize, "%s %s\n", id, states[message->state]);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Reads the input into the queue until EOF or a malformed line, which
+ * stops the input like it does without a queue. Messages already queued
+ * are still sent.
+ */
+void* queueReader(void* arg) {
+    MessageQueue* queue = (MessageQueue*) arg;
+    char id[MESSAGE_ID_SIZE];
+
+    for (;;) {
+        Record record;
+        int error = nextRecord(queue->source, id, &record);
+        if (error == EOF) {
+            break;
+        }
+        if (error == PARSE_IGNORED) {
+            continue;
+        }
+        if (error != PARSE_OK) {
+            printParseError(&record);
+            queue->error = 1;
+            break;
+        }
+        int result = queueSubmit(queue, id, &record);
+        if (result < 0) {
+            fprintf(stderr, "Out of memory, dropping message for address %u\n", record.address);
+        } else if (result != 0) {
+            fprintf(stderr, "Message id %s is already queued, dropping the new message\n", id);
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+/**
+ * Serves one connection to the control socket, one command per line,
+ * until the client hangs up or stays silent for CONTROL_TIMEOUT seconds.
+ */
+void* controlClient(void* arg) {
+    ControlClient* control = (ControlClient*) arg;
+    struct timeval timeout = { CONTROL_TIMEOUT, 0 };
+    setsockopt(control->connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(control->connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    FILE* client = fdopen(control->connection, "r");
+    if (client == NULL) {
+        close(control->connection);
+        free(control);
+        return NULL;
+    }
+    char command[CONTROL_LINE_SIZE];
+    char reply[CONTROL_LINE_SIZE + 64];
+    while (fgets(command, sizeof(command), client) != NULL) {
+        queueControl(control->queue, command, reply, sizeof(reply));
+        ssize_t length = strlen(reply);
+        //A client which is gone (EPIPE) or doesn't read is dropped
+        if (send(control->connection, reply, length, MSG_NOSIGNAL) != length) {
+            break;
+        }
+    }
+    fclose(client);
+    free(control);
+    return NULL;
+}
+
+/**
+ * Accepts connections to the control socket, each served on a thread of
+ * its own, so a client which keeps its connection open doesn't lock the
+ * others out.
+ */
+void* controlWorker(void* arg) {
+    MessageQueue* queue = (MessageQueue*) arg;
+    for (;;) {
+        int connection = accept(queue->listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE
+                    || errno == ENFILE) {
+                continue;
+            }
+            break;
+        }
+        ControlClient* control = (ControlClient*) malloc(sizeof(ControlClient));
+        pthread_t thread;
+        if (control == NULL) {
+            close(connection);
+            continue;
+        }
+        control->queue = queue;
+        control->connection = connection;
+        if (pthread_create(&thread, NULL, controlClient, control) != 0) {
+            close(connection);
+            free(control);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/**
+ * Sends messages from the input through a MessageQueue which can be
+ * controlled on a Unix socket at controlPath while they wait. Returns the
+ * exit code for main().
+ */
+int runQueued(Transmitter* transmitter, InputSource* source, const char* controlPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(controlPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", controlPath);
+        return 1;
+    }
+    strcpy(address.sun_path, controlPath);
+
+    //Replace a socket left over from an earlier run, but nothing else
+    struct stat info;
+    if (lstat(controlPath, &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", controlPath);
+            return 1;
+        }
+        unlink(controlPath);
+    }
+
+    MessageQueue queue;
+    if (queueInit(&queue, source) != 0) {
+        fprintf(stderr, "Out of memory for the message queue\n");
+        return 1;
+    }
+    queue.health = &transmitter->health;
+    queue.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (queue.listener < 0
+            || bind(queue.listener, (struct sockaddr*) &address, sizeof(address)) != 0
+            || listen(queue.listener, 16) != 0) {
+        perror(controlPath);
+        return 1;
+    }
+
+    pthread_t reader;
+    pthread_t control;
+    if (pthread_create(&control, NULL, controlWorker, &queue) != 0) {
+        fprintf(stderr, "Can't start the control thread\n");
+        close(queue.listener);
+        unlink(controlPath);
+        return 1;
+    }
+    pthread_detach(control);
+    if (pthread_create(&reader, NULL, queueReader, &queue) != 0) {
+        fprintf(stderr, "Can't start the input thread\n");
+        unlink(controlPath);
+        return 1;
+    }
+
+    QueuedMessage* message;
+    while ((message = queueTake(&queue)) != NULL) {
+        int outcome = transmitRecord(transmitter, &message->record);
+        Scheduler* scheduler = transmitter->scheduler;
+        queueFinish(&queue, message, outcome);
+
+        //The queue is as deep as it gets until more input arrives
+        if (scheduler != NULL) {
+            pthread_mutex_lock(&queue.lock);
+            int empty = queue.numPending == 0;
+            pthread_mutex_unlock(&queue.lock);
+            if (empty) {
+                schedulerFlush(transmitter);
+            }
+            if (scheduler->count == 0) {
+                queueScheduledSent(&queue);
+            }
+        }
+    }
+    pthread_join(reader, NULL);
+    finishTransmission(transmitter);
+    queueScheduledSent(&queue);
+
+    //The control thread stays blocked in accept() until the process exits
+    unlink(controlPath);
+    return queue.error;
+}
+
+// =========================================================
+// ZEITSCHLITZE (MEHRERE STANDORTE)
+// =========================================================
+
+/**
+ * Nanoseconds since the UNIX epoch. Sites agree on slots through their
+ * clocks, so these have to be kept in sync (NTP, PTP or GPS).
+ */
+uint64_t realtimeNanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int parseSeconds(const char* text, uint64_t* nanos) {
+    char* end;
+    double seconds = strtod(text, &end);
+    if (end == text || seconds < 0 || seconds > 86400) {
+        return 1;
+    }
+    *nanos = (uint64_t) llround(seconds * 1e9);
+    return 0;
+}
+
+/**
+ * Reads a schedule of `key = value` lines: `period` and `guard` in seconds
+ * and one `slot = SITE START LENGTH` per slot, START and LENGTH in seconds
+ * within the period. Every site keys up only inside its own slots, and
+ * stops `guard` before a slot ends. Slots of all sites must not overlap.
+ * Returns 1 on error.
+ */
+int parseSlotSchedule(FILE* file, const char* name, const char* site, SlotSchedule* schedule) {
+    memset(schedule, 0, sizeof(SlotSchedule));
+    char line[SLOT_LINE_SIZE];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char key[32];
+        char value[SLOT_LINE_SIZE];
+        char* start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+        if (sscanf(start, "%31[a-z_] = %[^\n]", key, value) != 2) {
+            fprintf(stderr, "%s:%d: expected key = value\n", name, lineNumber);
+            return 1;
+        }
+        int error = 0;
+        if (strcmp(key, "period") == 0) {
+            error = parseSeconds(value, &schedule->period) || schedule->period == 0;
+        } else if (strcmp(key, "guard") == 0) {
+            error = parseSeconds(value, &schedule->guard);
+        } else if (strcmp(key, "slot") == 0) {
+            char slotSite[SLOT_SITE_SIZE];
+            char slotStart[32];
+            char slotLength[32];
+            if (schedule->numSlots == SLOT_MAX) {
+                fprintf(stderr, "%s:%d: too many slots, at most %d\n", name, lineNumber, SLOT_MAX);
+                return 1;
+            }
+            Slot* slot = &schedule->slots[schedule->numSlots];
+            error = sscanf(value, "%31s %31s %31s", slotSite, slotStart, slotLength) != 3
+                 || parseSeconds(slotStart, &slot->start)
+                 || parseSeconds(slotLength, &slot->length) || slot->length == 0;
+            strcpy(slot->site, slotSite);
+            schedule->numSlots++;
+        } else {
+            fprintf(stderr, "%s:%d: unknown key %s\n", name, lineNumber, key);
+            return 1;
+        }
+        if (error) {
+            fprintf(stderr, "%s:%d: invalid %s: %s\n", name, lineNumber, key, value);
+            return 1;
+        }
+    }
+
+    if (schedule->period == 0) {
+        fprintf(stderr, "%s: no period\n", name);
+        return 1;
+    }
+    for (size_t i = 0; i < schedule->numSlots; i++) {
+        const Slot* slot = &schedule->slots[i];
+        if (slot->start + slot->length > schedule->period || slot->length <= schedule->guard) {
+            fprintf(stderr, "%s: slot %zu of %s must end within the period and be longer "
+                            "than the guard\n", name, i + 1, slot->site);
+            return 1;
+        }
+        for (size_t j = 0; j < i; j++) {
+            const Slot* other = &schedule->slots[j];
+            if (slot->start < other->start + other->length
+                    && other->start < slot->start + slot->length) {
+                fprintf(stderr, "%s: slots %zu (%s) and %zu (%s) overlap\n",
+                        name, j + 1, other->site, i + 1, slot->site);
+                return 1;
+            }
+        }
+        if (site != NULL && strcmp(slot->site, site) == 0) {
+            uint64_t window = slot->length - schedule->guard;
+            if (window > schedule->longest) {
+                schedule->longest = window;
+            }
+            schedule->numOwnSlots++;
+        }
+    }
+    if (site != NULL && schedule->numOwnSlots == 0) {
+        fprintf(stderr, "%s: no slots for site %s\n", name, site);
+        return 1;
+    }
+    schedule->site = site;
+    return 0;
+}
+
+/**
+ * Connects to the Unix socket of --serve-slots. Returns -1 on error.
+ */
+static int connectSlotServer(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        perror(path);
+        if (connection >= 0) {
+            close(connection);
+        }
+        return -1;
+    }
+    return connection;
+}
+
+/**
+ * Loads the schedule for a site from a file, or from the socket of a
+ * --serve-slots process if path is a socket. Returns 1 on error.
+ */
+int openSlotSchedule(const char* path, const char* site, SlotSchedule* schedule) {
+    struct stat info;
+    FILE* file;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        int connection = connectSlotServer(path);
+        file = connection < 0 ? NULL : fdopen(connection, "r");
+    } else {
+        file = fopen(path, "r");
+        if (file == NULL) {
+            perror(path);
+        }
+    }
+    if (file == NULL) {
+        return 1;
+    }
+    int error = parseSlotSchedule(file, path, site, schedule);
+    fclose(file);
+    return error;
+}
+
+/**
+ * Sends the schedule file to one site, on a thread of its own so that a
+ * site which doesn't read can't hold up the others. It is given
+ * SLOT_SEND_TIMEOUT seconds.
+ */
+void* slotScheduleClient(void* arg) {
+    SlotScheduleClient* client = (SlotScheduleClient*) arg;
+    struct timeval timeout = { SLOT_SEND_TIMEOUT, 0 };
+    setsockopt(client->connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int fd = open(client->schedulePath, O_RDONLY);
+    if (fd >= 0) {
+        char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0
+                && send(client->connection, buffer, length, MSG_NOSIGNAL) == length) {
+        }
+        close(fd);
+    }
+    close(client->connection);
+    free(client);
+    return NULL;
+}
+
+/**
+ * Hands out a schedule file to every site that connects to the Unix socket
+ * at socketPath. The file is read again for every connection, so changes
+ * reach each site when it next starts. Runs until killed.
+ */
+int serveSlotSchedule(const char* socketPath, const char* schedulePath) {
+    SlotSchedule schedule;
+    if (openSlotSchedule(schedulePath, NULL, &schedule) != 0) {
+        return 1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+    struct stat info;
+    if (lstat(socketPath, &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", socketPath);
+            return 1;
+        }
+        unlink(socketPath);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0
+            || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0
+            || listen(listener, 16) != 0) {
+        perror(socketPath);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        SlotScheduleClient* client = (SlotScheduleClient*) malloc(sizeof(SlotScheduleClient));
+        pthread_t thread;
+        if (client == NULL) {
+            close(connection);
+            continue;
+        }
+        client->connection = connection;
+        client->schedulePath = schedulePath;
+        if (pthread_create(&thread, NULL, slotScheduleClient, client) != 0) {
+            close(connection);
+            free(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+/**
+ * The wall clock as it was when the output started, carried on by the
+ * monotonic clock, so that steps of the wall clock don't disturb the pace.
+ */
+uint64_t slotClock(const SlotSchedule* schedule) {
+    return monotonicNanos() + schedule->clockOffset;
+}
+
+/**
+ * Wall-clock time at which output sample k goes on air.
+ */
+uint64_t slotSampleTime(const SlotSchedule* schedule, uint64_t k) {
+    return schedule->startNanos + (k / schedule->sampleRate) * 1000000000
+         + (k % schedule->sampleRate) * 1000000000 / schedule->sampleRate;
+}
+
+/**
+ * The first output sample at or after (roundUp) or before a wall-clock
+ * time no earlier than sample 0.
+ */
+static uint64_t slotSampleAt(const SlotSchedule* schedule, uint64_t nanos, int roundUp) {
+    uint64_t since = nanos - schedule->startNanos;
+    uint64_t fraction = (since % 1000000000) * schedule->sampleRate;
+    return (since / 1000000000) * schedule->sampleRate + fraction / 1000000000
+         + (roundUp && fraction % 1000000000 != 0);
+}
+
+/**
+ * Finds the window of this site which sample k is in, or else the next
+ * one, as output samples [*start, *end). The guard is already taken off.
+ */
+void slotWindow(const SlotSchedule* schedule, uint64_t k, uint64_t* start, uint64_t* end) {
+    uint64_t now = slotSampleTime(schedule, k);
+    uint64_t periodStart = now - now % schedule->period;
+    uint64_t bestStart = 0;
+    uint64_t bestEnd = 0;
+    for (size_t i = 0; i < schedule->numSlots; i++) {
+        const Slot* slot = &schedule->slots[i];
+        if (strcmp(slot->site, schedule->site) != 0) {
+            continue;
+        }
+        for (uint64_t cycle = 0; cycle < 2; cycle++) {
+            uint64_t windowStart = periodStart + cycle * schedule->period + slot->start;
+            uint64_t windowEnd = windowStart + slot->length - schedule->guard;
+            if (windowEnd > now && (bestEnd == 0 || windowStart < bestStart)) {
+                bestStart = windowStart;
+                bestEnd = windowEnd;
+            }
+        }
+    }
+    *start = bestStart <= now ? k : slotSampleAt(schedule, bestStart, 1);
+    *end = slotSampleAt(schedule, bestEnd, 0);
+}
+
+/**
+ * Queues a record which passed the filters, with a copy of its text. A
+ * page that wouldn't fit into even the longest slot of this site can
+ * never be sent and is dropped. Returns TRANSMIT_SCHEDULED or
+ * TRANSMIT_DROPPED.
+ */
+int slotSubmit(Transmitter* transmitter, const Record* record) {
+    SlotSchedule* schedule = transmitter->slots;
+    Config defaults;
+    const Config* config = &defaults;
+    if (transmitter->config != NULL) {
+        config = configAcquire(transmitter->config);
+    } else {
+        defaultConfig(&defaults);
+    }
+    size_t length = messageLength(record->address, record->length, record->functionCode,
+                                  config->preambleLength);
+    if (transmitter->config != NULL) {
+        configRelease(transmitter->config);
+    }
+
+    //Sent on its own, as it would be in the longest slot
+    uint64_t samples = pcmTransmissionLength(transmitter->sampleRate, BAUD_RATE, length) / 2;
+    uint64_t room = (schedule->longest / 1000000000) * schedule->sampleRate
+                  + (schedule->longest % 1000000000) * schedule->sampleRate / 1000000000;
+    if (samples > room) {
+        fprintf(stderr, "Message for address %u is too long for any slot, dropping it\n",
+                record->address);
+        healthPending(&transmitter->health, -1);
+        return TRANSMIT_DROPPED;
+    }
+
+    if (schedule->queue == NULL) {
+        schedule->queue = (Record*) malloc(sizeof(Record) * SLOT_MAX_QUEUE);
+    }
+    char* text = (char*) malloc(record->length > 0 ? record->length : 1);
+    if (schedule->queue == NULL || text == NULL) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", record->address);
+        free(text);
+        healthPending(&transmitter->health, -1);
+        return TRANSMIT_DROPPED;
+    }
+    Record* queued = &schedule->queue[schedule->count++];
+    *queued = *record;
+    memcpy(text, record->message, record->length);
+    queued->message = text;
+    return TRANSMIT_SCHEDULED;
+}
+
+/**
+ * Picks the queued messages which fit into `room` output samples as one
+ * transmission, first come first served, into `members` and marks them in
+ * `taken`. Only the occupancy of the batches is tracked, the way
+ * encodeMultiTransmission() will place them, so each candidate costs a
+ * search for its slots rather than encoding the whole transmission again.
+ * Returns the number of messages picked.
+ */
+static size_t slotPack(Transmitter* transmitter, uint64_t room, const Record** members,
+                       uint8_t* taken) {
+    SlotSchedule* schedule = transmitter->slots;
+    Config defaults;
+    const Config* config = &defaults;
+    if (transmitter->config != NULL) {
+        config = configAcquire(transmitter->config);
+    } else {
+        defaultConfig(&defaults);
+    }
+    uint32_t preambleWords = config->preambleLength / 32;
+    if (transmitter->config != NULL) {
+        configRelease(transmitter->config);
+    }
+
+    //Room for all of them, as in encodeMultiTransmission()
+    size_t maxBatches = 1;
+    for (size_t i = 0; i < schedule->count; i++) {
+        maxBatches += 1 + (1 + (schedule->queue[i].length * TEXT_BITS_PER_CHAR
+                                + (TEXT_BITS_PER_WORD - 1)) / TEXT_BITS_PER_WORD
+                           + BATCH_SIZE - 1) / BATCH_SIZE;
+    }
+    Batch* batches = allocBatches(maxBatches);
+    if (batches == NULL) {
+        return 0;
+    }
+
+    size_t numMembers = 0;
+    size_t end = 0;
+    for (size_t i = 0; i < schedule->count; i++) {
+        const Record* record = &schedule->queue[i];
+        size_t numWords = 1 + (record->length * TEXT_BITS_PER_CHAR
+                               + (TEXT_BITS_PER_WORD - 1)) / TEXT_BITS_PER_WORD;
+        size_t slot = batchFindSlot(batches, maxBatches, 0,
+                                    addressOffset(record->address) / FRAME_SIZE, numWords);
+        if (slot == NO_SLOT) {
+            continue;
+        }
+        size_t next = slot + numWords > end ? slot + numWords : end;
+        //A lone page goes out through encodeTransmission(), which may pad
+        //one batch more than encodeMultiTransmission() would
+        size_t length = numMembers == 0
+                      ? messageLength(record->address, record->length, record->functionCode,
+                                      preambleWords * 32)
+                      : preambleWords + (next / BATCH_SIZE + 1) * BATCH_WORDS;
+        if (pcmTransmissionLength(transmitter->sampleRate, BAUD_RATE, length) / 2 > room) {
+            continue;
+        }
+        for (size_t w = slot; w < slot + numWords; w++) {
+            batches[w / BATCH_SIZE].occupied |= 1 << (w % BATCH_SIZE);
+        }
+        end = next;
+        members[numMembers++] = record;
+        taken[i] = 1;
+    }
+    free(batches);
+    return numMembers;
+}
+
+/**
+ * Renders the next piece of the output: outside this site's slots, or
+ * with nothing queued that fits into the rest of the slot, up to
+ * SLOT_STEP samples of silence; inside a slot, the queued messages which
+ * fit, first come first served, as one transmission.
+ */
+void slotStep(Transmitter* transmitter) {
+    SlotSchedule* schedule = transmitter->slots;
+    uint64_t k = transmitter->samplesWritten;
+    uint64_t start;
+    uint64_t end;
+    slotWindow(schedule, k, &start, &end);
+
+    size_t numMembers = 0;
+    const Record** members = (const Record**) malloc(sizeof(Record*) * (schedule->count + 1));
+    uint8_t* taken = (uint8_t*) calloc(schedule->count + 1, 1);
+    if (k >= start && schedule->count > 0 && members != NULL && taken != NULL) {
+        numMembers = slotPack(transmitter, end - k, members, taken);
+    }
+
+    if (numMembers == 0) {
+        uint64_t silenceLength = (k < start ? start : end) - k;
+        if (silenceLength == 0) {
+            //Less than a sample of the slot left
+            silenceLength = 1;
+        } else if (silenceLength > SLOT_STEP) {
+            silenceLength = SLOT_STEP;
+        }
+        static const uint16_t silence[SLOT_STEP];
+        emitSamples(transmitter, (const uint8_t*) silence, sizeof(uint16_t) * silenceLength);
+    } else {
+        sendTransmission(transmitter, members, numMembers, BAUD_RATE);
+        size_t kept = 0;
+        for (size_t i = 0; i < schedule->count; i++) {
+            if (taken[i]) {
+                free((char*) schedule->queue[i].message);
+            } else {
+                schedule->queue[kept++] = schedule->queue[i];
+            }
+        }
+        schedule->count = kept;
+    }
+    free(members);
+    free(taken);
+}
+
+/**
+ * Sends the messages from stdin in this site's slots, and silence in
+ * between. The output is a continuous stream kept SLOT_LEAD_MS ahead of
+ * the wall clock, so sample k goes on air at the time slotSampleTime()
+ * gives for it as long as the receiving end plays it at the sample rate.
+ */
+int runSlotted(Transmitter* transmitter, InputSource* source) {
+    SlotSchedule* schedule = transmitter->slots;
+    schedule->sampleRate = transmitter->sampleRate;
+    schedule->startNanos = realtimeNanos();
+    schedule->clockOffset = schedule->startNanos - monotonicNanos();
+    if (transmitter->stats) {
+        fprintf(stderr, "Slots: site %s, %zu of %zu slots, period %.6f s, "
+                        "first sample %.6f s into the period\n",
+                schedule->site, schedule->numOwnSlots, schedule->numSlots,
+                schedule->period / 1e9, (schedule->startNanos % schedule->period) / 1e9);
+    }
+
+    int eof = 0;
+    for (;;) {
+        while (!eof && schedule->count < SLOT_MAX_QUEUE && inputSourcePending(source)) {
+            Record record;
+            int error = nextRecord(source, NULL, &record);
+            if (error == EOF) {
+                eof = 1;
+            } else if (error == PARSE_OK) {
+                transmitRecord(transmitter, &record);
+            } else if (error != PARSE_IGNORED) {
+                printParseError(&record);
+                return 1;
+            }
+        }
+        if (eof && schedule->count == 0) {
+            if (transmitter->stats && schedule->slipped > 0) {
+                fprintf(stderr, "Slots: output fell %.3f s behind the clock in all\n",
+                        schedule->slipped / 1e9);
+            }
+            finishTransmission(transmitter);
+            return 0;
+        }
+
+        //Wait for the clock rather than run ahead of it
+        uint64_t next = slotSampleTime(schedule, transmitter->samplesWritten);
+        uint64_t now = slotClock(schedule);
+        if (next + SLOT_DRIFT_MS * 1000000ULL < now) {
+            //The sink took the samples slower than their rate, or the
+            //encoder fell behind: the rest goes on air later than planned
+            schedule->startNanos += now - next;
+            schedule->slipped += now - next;
+            next = now;
+        }
+        if (next > now + SLOT_LEAD_MS * 1000000ULL) {
+            uint64_t wait = next - now - SLOT_LEAD_MS * 1000000ULL;
+            if (wait > SLOT_POLL_MS * 1000000ULL) {
+                wait = SLOT_POLL_MS * 1000000ULL;
+            }
+            struct timespec pause = { 0, (long) wait };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        slotStep(transmitter);
+        //Only samples handed on count as written when checking the pace
+        fflush(transmitter->out);
+    }
+}
+
+// =========================================================
+// ZUSTANDSBERICHT UND WACHHUND
+// =========================================================
+
+uint64_t monotonicNanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Counts messages in (positive) or out (negative) of the waiting state.
+ */
+void healthPending(Health* health, int64_t delta) {
+    __atomic_add_fetch(&health->pending, delta, __ATOMIC_RELAXED);
+}
+
+/**
+ * Checks on the encoder and rewrites the status file. The output counts as
+ * stalled if a write has been blocked for longer than the timeout, or if
+ * messages are waiting but nothing was written for that long. Only reads
+ * what emitSamples() and the queues publish with atomic stores, so the
+ * encoder never waits for it. The file is written under a temporary name
+ * and renamed, so a reader never sees half of it. After the final report
+ * nothing is written any more.
+ */
+void watchdogReport(Watchdog* watchdog, int final) {
+    Health* health = watchdog->health;
+    pthread_mutex_lock(&watchdog->lock);
+    if (watchdog->finished) {
+        pthread_mutex_unlock(&watchdog->lock);
+        return;
+    }
+    uint64_t samples = __atomic_load_n(&health->samples, __ATOMIC_RELAXED);
+    uint64_t finished = __atomic_load_n(&health->writeFinished, __ATOMIC_ACQUIRE);
+    uint64_t started = __atomic_load_n(&health->writeStarted, __ATOMIC_ACQUIRE);
+    int64_t pending = __atomic_load_n(&health->pending, __ATOMIC_RELAXED);
+    uint64_t sent = __atomic_load_n(watchdog->sent, __ATOMIC_RELAXED);
+    uint64_t now = monotonicNanos();
+
+    uint64_t blocked = started > finished ? now - started : 0;
+    uint64_t idle = now - (finished != 0 ? finished : watchdog->begin);
+    int stalled = !final
+               && (blocked > watchdog->timeout || (pending > 0 && idle > watchdog->timeout));
+    __atomic_store_n(&health->stalled, stalled, __ATOMIC_RELAXED);
+    if (stalled && !watchdog->stalled) {
+        fprintf(stderr, "Output stalled: %s for %.1f s, %lld messages waiting\n",
+                blocked > 0 ? "write blocked" : "nothing written",
+                (blocked > 0 ? blocked : idle) / 1e9, (long long) pending);
+    } else if (!stalled && watchdog->stalled && !final) {
+        fprintf(stderr, "Output moving again\n");
+    }
+    watchdog->stalled = stalled;
+
+    FILE* file = fopen(watchdog->temporary, "w");
+    if (file != NULL) {
+        //Report times on the wall clock
+        double wall = realtimeNanos() / 1e9;
+        fprintf(file, "pid = %ld\n", (long) getpid());
+        fprintf(file, "samples_written = %llu\n", (unsigned long long) samples);
+        if (finished != 0) {
+            fprintf(file, "last_write = %.6f\n", wall - (now - finished) / 1e9);
+        } else {
+            fprintf(file, "last_write = never\n");
+        }
+        fprintf(file, "write_blocked = %.3f\n", blocked / 1e9);
+        fprintf(file, "queue_depth = %lld\n", (long long) pending);
+        fprintf(file, "messages_sent = %llu\n", (unsigned long long) sent);
+        fprintf(file, "stalled = %d\n", stalled);
+        fprintf(file, "finished = %d\n", final);
+        fprintf(file, "updated = %.6f\n", wall);
+        if (fclose(file) == 0) {
+            rename(watchdog->temporary, watchdog->path);
+        }
+    }
+    watchdog->finished = final;
+    pthread_mutex_unlock(&watchdog->lock);
+}
+
+/**
+ * Reports once every STATUS_INTERVAL_MS.
+ */
+void* watchdogWorker(void* arg) {
+    Watchdog* watchdog = (Watchdog*) arg;
+    for (;;) {
+        watchdogReport(watchdog, 0);
+        struct timespec pause = { STATUS_INTERVAL_MS / 1000, (STATUS_INTERVAL_MS % 1000) * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the watchdog for --status. From here on emitSamples() writes in
+ * pieces of STATUS_WRITE_CHUNK bytes, so a slow reader shows as progress
+ * and only one which stopped reading as a blocked write. Returns non-zero
+ * if the watchdog couldn't be started.
+ */
+int startWatchdog(Transmitter* transmitter, const char* path, double timeout) {
+    Watchdog* watchdog = (Watchdog*) calloc(1, sizeof(Watchdog));
+    size_t size = strlen(path) + 32;
+    char* temporary = (char*) malloc(size);
+    if (watchdog == NULL || temporary == NULL) {
+        fprintf(stderr, "Out of memory for the watchdog\n");
+        free(watchdog);
+        free(temporary);
+        return 1;
+    }
+    watchdog->health = &transmitter->health;
+    watchdog->sent = &transmitter->messagesSent;
+    watchdog->path = path;
+    watchdog->temporary = temporary;
+    snprintf(watchdog->temporary, size, "%s.%ld", path, (long) getpid());
+    watchdog->timeout = (uint64_t) (timeout * 1e9);
+    watchdog->begin = monotonicNanos();
+    pthread_mutex_init(&watchdog->lock, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, watchdogWorker, watchdog) != 0) {
+        fprintf(stderr, "Can't start the watchdog thread\n");
+        pthread_mutex_destroy(&watchdog->lock);
+        free(watchdog->temporary);
+        free(watchdog);
+        return 1;
+    }
+    pthread_detach(thread);
+    transmitter->health.watched = 1;
+    transmitter->watchdog = watchdog;
+    return 0;
+}
+
+// =========================================================
+// DAUERTEST (SPEICHER UND DURCHSATZ)
+// =========================================================
+
+/**
+ * Resident set size of the process, and the bytes the allocator has handed
+ * out and holds from the system, where it can tell.
+ */
+void soakMemory(uint64_t* rss, uint64_t* heap, uint64_t* arena) {
+    *rss = 0;
+    *heap = 0;
+    *arena = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    unsigned long long size;
+    unsigned long long resident;
+    if (statm != NULL) {
+        if (fscanf(statm, "%llu %llu", &size, &resident) == 2) {
+            *rss = resident * (uint64_t) sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    } else {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        *rss = (uint64_t) usage.ru_maxrss * 1024;
+    }
+#if SOAK_MALLINFO
+    struct mallinfo2 info = mallinfo2();
+    *heap = info.uordblks + info.hblkhd;
+    *arena = info.arena + info.hblkhd;
+#endif
+}
+
+/**
+ * CPU time of the calling thread, so time slices lost to other processes do
+ * not show up as slower messages.
+ */
+static uint64_t soakCpuNanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Least-squares slope of y over x.
+ */
+double soakSlope(const double* x, const double* y, size_t n) {
+    double meanX = 0;
+    double meanY = 0;
+    for (size_t i = 0; i < n; i++) {
+        meanX += x[i] / n;
+        meanY += y[i] / n;
+    }
+    double covariance = 0;
+    double variance = 0;
+    for (size_t i = 0; i < n; i++) {
+        covariance += (x[i] - meanX) * (y[i] - meanY);
+        variance += (x[i] - meanX) * (x[i] - meanX);
+    }
+    return variance > 0 ? covariance / variance : 0;
+}
+
+/**
+ * The next line of the generated workload: a random address and function
+ * code, and mostly short texts with now and then a long one.
+ */
+static size_t soakLine(uint64_t* state, char* line) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    uint32_t address = z & MAX_ADDRESS;
+    FunctionCode functionCode = (z >> 21) & 0x3;
+    if (addressWordReserved(address, functionCode)) {
+        address ^= 0x8;
+    }
+    uint32_t kind = (z >> 23) % 100;
+    size_t numChars = kind < 70 ? (z >> 30) % 41
+                    : kind < 95 ? 41 + (z >> 30) % 80
+                    : 121 + (z >> 30) % (SOAK_MAX_CHARS - 120);
+    size_t length = snprintf(line, SOAK_LINE_SIZE, "%u:%u:", address, functionCode);
+    for (size_t n = 0; n < numChars; n++) {
+        char c = (char) (' ' + ((z >> (n % 40)) + n * 7) % 95);
+        line[length++] = c == ':' ? '.' : c;
+    }
+    return length;
+}
+
+/**
+ * Feeds a generated workload through the parser, the filters and the
+ * encoder for the given hours of output, as fast as it will go, and
+ * samples the memory use, throughput and time per message
+ * SOAK_SAMPLES times on the way. Samples after the first quarter, once the
+ * allocator has settled, are checked for trends: heap use growing with the
+ * number of messages, a resident set that keeps growing, or messages
+ * taking longer towards the end. Returns 1 if it found any.
+ */
+int runSoak(Transmitter* transmitter, double hours) {
+    uint64_t totalSamples = (uint64_t) (hours * 3600 * transmitter->sampleRate);
+    uint64_t interval = totalSamples / SOAK_SAMPLES;
+    if (interval < (uint64_t) SOAK_MIN_INTERVAL * transmitter->sampleRate) {
+        interval = (uint64_t) SOAK_MIN_INTERVAL * transmitter->sampleRate;
+    }
+    //The same workload every time, unless a seed says otherwise
+    uint64_t state = transmitter->seeded ? transmitter->seed : 1;
+    if (!transmitter->seeded) {
+        transmitter->seeded = 1;
+        transmitter->seed = 1;
+    }
+
+    SoakSample samples[SOAK_SAMPLES + 2];
+    size_t numSamples = 0;
+    char line[SOAK_LINE_SIZE];
+    uint64_t messages = 0;
+    uint64_t intervalMessages = 0;
+    uint64_t intervalNanos = 0;
+    uint64_t maxNanos = 0;
+    uint64_t intervalStart = monotonicNanos();
+    uint64_t intervalSamples = 0;
+
+    printf("# hours  messages   rss_kib  heap_kib arena_kib   msg/s    speed  mean_us   max_us\n");
+    while (transmitter->samplesWritten < totalSamples) {
+        size_t length = soakLine(&state, line);
+        Record record;
+        if (parseLine(line, length, &record) != PARSE_OK) {
+            fprintf(stderr, "Soak workload produced an invalid line: %.*s\n", (int) length, line);
+            return 1;
+        }
+        record.position = messages;
+
+        uint64_t start = soakCpuNanos();
+        transmitRecord(transmitter, &record);
+        if (transmitter->scheduler != NULL) {
+            schedulerFlush(transmitter);
+        }
+        uint64_t nanos = soakCpuNanos() - start;
+        intervalNanos += nanos;
+        maxNanos = nanos > maxNanos ? nanos : maxNanos;
+        messages++;
+        intervalMessages++;
+
+        if (transmitter->samplesWritten - intervalSamples < interval
+                && transmitter->samplesWritten < totalSamples) {
+            continue;
+        }
+        uint64_t now = monotonicNanos();
+        double wall = (now - intervalStart) / 1e9;
+        SoakSample* sample = &samples[numSamples < SOAK_SAMPLES + 1 ? numSamples++ : numSamples];
+        sample->hours = (double) transmitter->samplesWritten / transmitter->sampleRate / 3600;
+        sample->messages = messages;
+        soakMemory(&sample->rss, &sample->heap, &sample->arena);
+        sample->messagesPerSecond = intervalMessages / wall;
+        sample->speed = (double) (transmitter->samplesWritten - intervalSamples) / transmitter->sampleRate
+                      / wall;
+        sample->meanLatency = intervalNanos / 1e3 / intervalMessages;
+        sample->maxLatency = maxNanos / 1e3;
+        printf("%7.2f %9llu %9llu %9llu %9llu %7.0f %7.0fx %8.1f %8.1f\n",
+               sample->hours, (unsigned long long) sample->messages,
+               (unsigned long long) sample->rss / 1024, (unsigned long long) sample->heap / 1024,
+               (unsigned long long) sample->arena / 1024, sample->messagesPerSecond,
+               sample->speed, sample->meanLatency, sample->maxLatency);
+        fflush(stdout);
+
+        intervalStart = now;
+        intervalSamples = transmitter->samplesWritten;
+        intervalMessages = 0;
+        intervalNanos = 0;
+        maxNanos = 0;
+    }
+    finishTransmission(transmitter);
+
+    //Leave out the warm-up
+    size_t first = numSamples / 4;
+    size_t n = numSamples - first;
+    if (n < 3) {
+        printf("Too few samples for a trend, soak longer\n");
+        return 0;
+    }
+    double x[SOAK_SAMPLES + 2];
+    double heap[SOAK_SAMPLES + 2];
+    double rss[SOAK_SAMPLES + 2];
+    double latency[SOAK_SAMPLES + 2];
+    double meanLatency = 0;
+    for (size_t i = 0; i < n; i++) {
+        x[i] = samples[first + i].messages;
+        heap[i] = samples[first + i].heap;
+        rss[i] = samples[first + i].rss;
+        latency[i] = samples[first + i].meanLatency;
+        meanLatency += latency[i] / n;
+    }
+    double span = x[n - 1] - x[0];
+    double heapSlope = soakSlope(x, heap, n);
+    double rssSlope = soakSlope(x, rss, n);
+    //Time per message at both ends of the fitted line
+    double latencySlope = soakSlope(x, latency, n);
+    double early = meanLatency - latencySlope * span / 2;
+    double late = meanLatency + latencySlope * span / 2;
+
+    int trends = 0;
+    if (heapSlope > SOAK_HEAP_SLACK && heapSlope * span > SOAK_HEAP_MIN_GROWTH) {
+        printf("Heap grows by %.0f bytes per message\n", heapSlope);
+        trends++;
+    }
+    if (rssSlope * span > SOAK_RSS_SLACK) {
+        printf("Resident set grows by %.0f bytes per message, %.1f MiB over %.0f messages\n",
+               rssSlope, rssSlope * span / (1 << 20), span);
+        trends++;
+    }
+    if (late - early > early * SOAK_LATENCY_SLACK && late - early > SOAK_LATENCY_MIN_US) {
+        printf("Messages take longer: %.1f us at the start, %.1f us at the end\n", early, late);
+        trends++;
+    }
+    if (trends == 0) {
+        printf("No upward trend in memory or time per message over %llu messages\n",
+               (unsigned long long) messages);
+    }
+    return trends > 0;
+}
+
+
+// =========================================================
+// NETZWERKDIENST (EREIGNISSCHLEIFE)
+// =========================================================
+
+/**
+ * Resolves a --listen address: a path with a '/' in it is a Unix socket,
+ * anything else is [HOST:]PORT. Without a host, a listening socket takes
+ * every interface and a client connects to localhost. Returns 1 on error.
+ */
+int listenAddress(const char* text, int passive, struct sockaddr_storage* address,
+                  socklen_t* length) {
+    memset(address, 0, sizeof(struct sockaddr_storage));
+    if (strchr(text, '/') != NULL) {
+        struct sockaddr_un* local = (struct sockaddr_un*) address;
+        if (strlen(text) >= sizeof(local->sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", text);
+            return 1;
+        }
+        local->sun_family = AF_UNIX;
+        strcpy(local->sun_path, text);
+        *length = sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    char host[256];
+    const char* port = strrchr(text, ':');
+    const char* name = passive ? NULL : "localhost";
+    if (port != NULL) {
+        //[::1]:PORT for IPv6
+        const char* start = text[0] == '[' ? text + 1 : text;
+        size_t hostLength = port - start - (port > start && port[-1] == ']');
+        if (hostLength >= sizeof(host)) {
+            fprintf(stderr, "Host name too long: %s\n", text);
+            return 1;
+        }
+        memcpy(host, start, hostLength);
+        host[hostLength] = 0;
+        name = host;
+        port++;
+    } else {
+        port = text;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo* result;
+    int error = getaddrinfo(name, port, &hints, &result);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", text, gai_strerror(error));
+        return 1;
+    }
+    memcpy(address, result->ai_addr, result->ai_addrlen);
+    *length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/**
+ * Raises the soft limit on open files towards the hard limit, as every
+ * client takes one, but not beyond LISTEN_MAX_FILES. The hard limit is
+ * left alone. Returns how many files may be open, at most
+ * LISTEN_MAX_FILES.
+ */
+size_t raiseFileLimit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    rlim_t wanted = limit.rlim_max;
+    if (wanted == RLIM_INFINITY || wanted > LISTEN_MAX_FILES) {
+        wanted = LISTEN_MAX_FILES;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+        limit.rlim_cur = wanted;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted
+         ? (size_t) limit.rlim_cur : (size_t) wanted;
+}
+
+#if defined(__linux__)
+
+/**
+ * Sets up an empty ring of `size` bytes, a power of two. Returns non-zero
+ * with nothing left to free if there is no memory or no eventfd.
+ */
+int ringInit(RecordRing* ring, size_t size, Health* health) {
+    memset(ring, 0, sizeof(RecordRing));
+    ring->data = (uint8_t*) malloc(size);
+    if (ring->data == NULL) {
+        fprintf(stderr, "Out of memory for the page queue\n");
+        return 1;
+    }
+    ring->size = size;
+    ring->doorbell = eventfd(0, EFD_CLOEXEC);
+    if (ring->doorbell < 0) {
+        perror("eventfd");
+        free(ring->data);
+        return 1;
+    }
+    ring->health = health;
+    return 0;
+}
+
+/**
+ * Wakes the consumer if it is waiting for the doorbell.
+ */
+static void ringWake(RecordRing* ring) {
+    if (__atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(ring->doorbell, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+    }
+}
+
+/**
+ * Copies a record and its message into the ring. Returns 1 if the ring is
+ * full. Only the producer may call this.
+ */
+int ringPush(RecordRing* ring, const Record* record) {
+    size_t need = (sizeof(RingEntry) + record->length + 7) & ~(size_t) 7;
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t offset = head & (ring->size - 1);
+    size_t skip = ring->size - offset < need ? ring->size - offset : 0;
+    if (head + skip + need - tail > ring->size) {
+        return 1;
+    }
+    if (skip >= sizeof(RingEntry)) {
+        ((RingEntry*) (ring->data + offset))->wrap = 1;
+    }
+    head += skip;
+
+    RingEntry* entry = (RingEntry*) (ring->data + (head & (ring->size - 1)));
+    entry->address = record->address;
+    entry->functionCode = record->functionCode;
+    entry->length = (uint32_t) record->length;
+    entry->wrap = 0;
+    entry->position = record->position;
+    memcpy(entry + 1, record->message, record->length);
+    if (ring->health != NULL) {
+        healthPending(ring->health, 1);
+    }
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+    ringWake(ring);
+    return 0;
+}
+
+/**
+ * Fills in the oldest record of the ring, its message pointing into the
+ * ring. Returns how many bytes to hand to ringRelease() once the record
+ * is done with, or 0 if the ring is empty. Only the consumer may call this.
+ */
+size_t ringPeek(RecordRing* ring, Record* record) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    while (tail != head) {
+        size_t offset = tail & (ring->size - 1);
+        const RingEntry* entry = (const RingEntry*) (ring->data + offset);
+        if (ring->size - offset < sizeof(RingEntry) || entry->wrap) {
+            tail += ring->size - offset;
+            continue;
+        }
+        memset(record, 0, sizeof(Record));
+        record->address = entry->address;
+        record->functionCode = entry->functionCode;
+        record->message = (const char*) (entry + 1);
+        record->length = entry->length;
+        record->position = entry->position;
+        size_t need = (sizeof(RingEntry) + entry->length + 7) & ~(size_t) 7;
+        return tail + need - ring->tail;
+    }
+    return 0;
+}
+
+void ringRelease(RecordRing* ring, size_t consumed) {
+    __atomic_store_n(&ring->tail, ring->tail + consumed, __ATOMIC_RELEASE);
+}
+
+/**
+ * Tells the consumer no more records will come.
+ */
+void ringClose(RecordRing* ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    ringWake(ring);
+}
+
+/**
+ * Encodes the records from the ring until it is closed and empty. Before
+ * waiting for more, the scheduler gets its chance and the output is
+ * flushed, so nothing sits in a buffer while the clients are quiet.
+ */
+void ringEncode(Transmitter* transmitter, RecordRing* ring) {
+    for (;;) {
+        Record record;
+        size_t consumed = ringPeek(ring, &record);
+        if (consumed != 0) {
+            if (ring->health != NULL) {
+                healthPending(ring->health, -1);
+            }
+            transmitRecord(transmitter, &record);
+            ringRelease(ring, consumed);
+            continue;
+        }
+
+        //Closed after the last push, so empty now means empty for good
+        if (__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+            if (ringPeek(ring, &record) == 0) {
+                return;
+            }
+            continue;
+        }
+        if (transmitter->scheduler != NULL) {
+            schedulerFlush(transmitter);
+        }
+        fflush(transmitter->out);
+
+        __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (ringPeek(ring, &record) != 0 || __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        uint64_t count;
+        if (read(ring->doorbell, &count, sizeof(count)) < 0 && errno != EINTR) {
+            perror("eventfd");
+            return;
+        }
+    }
+}
+
+static const char* listenErrorText(int error) {
+    switch (error) {
+    case PARSE_MISSING_COLON:
+        return "missing colon";
+    case PARSE_TOO_MANY_COLONS:
+        return "too many colons";
+    case PARSE_INVALID_FUNCTION:
+        return "invalid function";
+    case PARSE_INVALID_ADDRESS:
+        return "address exceeds 21 bits";
+    case PARSE_RESERVED_ADDRESS:
+        return "reserved address";
+    case PARSE_MALFORMED_LOG:
+        return "malformed log line";
+    default:
+        return "malformed line";
+    }
+}
+
+/**
+ * Changes what epoll watches a client for, if it differs.
+ */
+void listenWatch(Listener* listener, int fd, uint32_t events) {
+    Connection* connection = &listener->connections[fd];
+    if (connection->events == events) {
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(listener->poller, EPOLL_CTL_MOD, fd, &event);
+    connection->events = events;
+}
+
+/**
+ * Queues a reply for the client. Returns non-zero if there is no memory
+ * for it, in which case the caller closes the connection.
+ */
+int listenReply(Listener* listener, int fd, const char* reply) {
+    Connection* connection = &listener->connections[fd];
+    size_t length = strlen(reply);
+    if (connection->unsentLength + length > connection->unsentCapacity) {
+        size_t capacity = (connection->unsentLength + length) * 2;
+        char* unsent = (char*) realloc(connection->unsent, capacity);
+        if (unsent == NULL) {
+            return 1;
+        }
+        connection->unsent = unsent;
+        connection->unsentCapacity = capacity;
+    }
+    memcpy(connection->unsent + connection->unsentLength, reply, length);
+    connection->unsentLength += length;
+    return 0;
+}
+
+void listenClose(Listener* listener, int fd) {
+    Connection* connection = &listener->connections[fd];
+    epoll_ctl(listener->poller, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    free(connection->partial);
+    free(connection->unsent);
+    memset(connection, 0, sizeof(Connection));
+    listener->numConnections--;
+
+    if (!listener->accepting) {
+        //A file descriptor is free again
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listener->listener;
+        epoll_ctl(listener->poller, EPOLL_CTL_ADD, listener->listener, &event);
+        listener->accepting = 1;
+    }
+}
+
+/**
+ * Sends what the client will take of its replies, then decides what to
+ * wait for next: more lines, unless the client has stopped reading
+ * replies, and room to send the rest. A draining client is closed once
+ * everything is out.
+ */
+void listenFlush(Listener* listener, int fd) {
+    Connection* connection = &listener->connections[fd];
+    size_t sent = 0;
+    while (sent < connection->unsentLength) {
+        ssize_t written = send(fd, connection->unsent + sent, connection->unsentLength - sent,
+                               MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            listenClose(listener, fd);
+            return;
+        }
+        sent += written;
+    }
+    connection->unsentLength -= sent;
+    memmove(connection->unsent, connection->unsent + sent, connection->unsentLength);
+
+    if (connection->state == CONNECTION_DRAINING && connection->unsentLength == 0) {
+        listenClose(listener, fd);
+        return;
+    }
+    uint32_t events = 0;
+    if (connection->state != CONNECTION_DRAINING && connection->unsentLength < LISTEN_MAX_UNSENT) {
+        events |= EPOLLIN;
+    }
+    if (connection->unsentLength > 0) {
+        events |= EPOLLOUT;
+    }
+    listenWatch(listener, fd, events);
+}
+
+/**
+ * Parses one line from a client, hands it to the encoder and queues the
+ * reply: "ok", "ignored" for a line without a page, "error busy" if the
+ * encoder is too far behind, or "error" and what is wrong with the line.
+ * "ok" means the page is in the ring, not yet on air: the ring is the
+ * backpressure, a client learns of a backlog by "error busy" only once
+ * LISTEN_RING_SIZE bytes of pages are waiting. Returns non-zero if the
+ * reply couldn't be queued, see listenReply().
+ */
+int listenLine(Listener* listener, int fd, const char* line, size_t length) {
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    Record record;
+    int error = length == 0 ? PARSE_IGNORED
+              : parseRecord(listener->format, line, length, listener->scratch, &record);
+    if (error == PARSE_IGNORED) {
+        return listenReply(listener, fd, "ignored\n");
+    }
+    if (error != PARSE_OK) {
+        char reply[64];
+        snprintf(reply, sizeof(reply), "error %s\n", listenErrorText(error));
+        return listenReply(listener, fd, reply);
+    }
+    record.position = listener->position++;
+    if (ringPush(listener->ring, &record) != 0) {
+        listener->numRejected++;
+        return listenReply(listener, fd, "error busy\n");
+    }
+    listener->numAccepted++;
+    return listenReply(listener, fd, "ok\n");
+}
+
+/**
+ * Reads what a client has sent, once, so one busy client can't hold up
+ * the others, and works through the complete lines in it. Lines split
+ * across reads are put together in `partial`. A client whose line or
+ * replies can't be buffered for lack of memory is disconnected.
+ */
+void listenRead(Listener* listener, int fd) {
+    Connection* connection = &listener->connections[fd];
+    ssize_t got = recv(fd, listener->buffer, LISTEN_READ_SIZE, 0);
+    if (got < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            listenClose(listener, fd);
+        }
+        return;
+    }
+    if (got == 0) {
+        //The client is done sending, a last line without newline counts
+        if (connection->state == CONNECTION_OPEN && connection->partialLength > 0
+                && listenLine(listener, fd, connection->partial, connection->partialLength) != 0) {
+            listenClose(listener, fd);
+            return;
+        }
+        connection->partialLength = 0;
+        connection->state = CONNECTION_DRAINING;
+        listenFlush(listener, fd);
+        return;
+    }
+
+    const char* data = listener->buffer;
+    size_t left = got;
+    while (left > 0) {
+        const char* newline = (const char*) memchr(data, '\n', left);
+        size_t length = newline != NULL ? (size_t) (newline - data) : left;
+        if (connection->state == CONNECTION_SKIPPING) {
+            if (newline != NULL) {
+                connection->state = CONNECTION_OPEN;
+            }
+        } else if (connection->partialLength + length > LISTEN_LINE_SIZE) {
+            if (listenReply(listener, fd, "error line too long\n") != 0) {
+                listenClose(listener, fd);
+                return;
+            }
+            connection->partialLength = 0;
+            connection->state = newline != NULL ? CONNECTION_OPEN : CONNECTION_SKIPPING;
+        } else if (newline != NULL && connection->partialLength == 0) {
+            if (listenLine(listener, fd, data, length) != 0) {
+                listenClose(listener, fd);
+                return;
+            }
+        } else {
+            if (connection->partial == NULL) {
+                connection->partial = (char*) malloc(LISTEN_LINE_SIZE);
+                if (connection->partial == NULL) {
+                    listenClose(listener, fd);
+                    return;
+                }
+            }
+            memcpy(connection->partial + connection->partialLength, data, length);
+            connection->partialLength += length;
+            if (newline != NULL) {
+                if (listenLine(listener, fd, connection->partial, connection->partialLength) != 0) {
+                    listenClose(listener, fd);
+                    return;
+                }
+                connection->partialLength = 0;
+            }
+        }
+        if (newline == NULL) {
+            break;
+        }
+        data = newline + 1;
+        left -= length + 1;
+    }
+    listenFlush(listener, fd);
+}
+
+/**
+ * Takes every waiting connection. Out of file descriptors, the listening
+ * socket is left alone until a client leaves, rather than waking the
+ * loop over and over.
+ */
+void listenAccept(Listener* listener) {
+    for (;;) {
+        int fd = accept4(listener->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                fprintf(stderr, "Too many clients (%zu), waiting for one to leave\n",
+                        listener->numConnections);
+                epoll_ctl(listener->poller, EPOLL_CTL_DEL, listener->listener, NULL);
+                listener->accepting = 0;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        if ((size_t) fd >= listener->maxConnections) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Connection* connection = &listener->connections[fd];
+        connection->state = CONNECTION_OPEN;
+        connection->events = EPOLLIN;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(listener->poller, EPOLL_CTL_ADD, fd, &event);
+        listener->numConnections++;
+        listener->numClients++;
+    }
+}
+
+/**
+ * Closes the sockets of a listener and frees it, removing a Unix socket
+ * from the file system.
+ */
+void listenerFree(Listener* listener, const char* address, int local) {
+    close(listener->listener);
+    if (local) {
+        unlink(address);
+    }
+    if (listener->signals >= 0) {
+        close(listener->signals);
+    }
+    if (listener->poller >= 0) {
+        close(listener->poller);
+    }
+    free(listener->connections);
+    free(listener);
+}
+
+/**
+ * The event loop: one thread for all clients, each a small state machine
+ * driven by epoll. Runs until SIGINT or SIGTERM, then closes the ring.
+ */
+void* listenLoop(void* arg) {
+    Listener* listener = (Listener*) arg;
+    struct epoll_event events[LISTEN_MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int numEvents = epoll_wait(listener->poller, events, LISTEN_MAX_EVENTS, -1);
+        if (numEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < numEvents; i++) {
+            int fd = events[i].data.fd;
+            uint32_t happened = events[i].events;
+            if (fd == listener->signals) {
+                running = 0;
+                continue;
+            }
+            if (fd == listener->listener) {
+                listenAccept(listener);
+                continue;
+            }
+            Connection* connection = &listener->connections[fd];
+            if (connection->state == CONNECTION_CLOSED) {
+                //Closed earlier in this round
+                continue;
+            }
+            if ((happened & EPOLLERR) || ((happened & EPOLLHUP) && !(happened & EPOLLIN))) {
+                listenClose(listener, fd);
+                continue;
+            }
+            if (happened & EPOLLOUT) {
+                listenFlush(listener, fd);
+            }
+            if ((happened & EPOLLIN) && connection->state != CONNECTION_CLOSED
+                    && connection->state != CONNECTION_DRAINING) {
+                listenRead(listener, fd);
+            }
+        }
+    }
+
+    for (size_t fd = 0; fd < listener->maxConnections; fd++) {
+        if (listener->connections[fd].state != CONNECTION_CLOSED) {
+            listener->accepting = 1;
+            listenClose(listener, (int) fd);
+        }
+    }
+    ringClose(listener->ring);
+    return NULL;
+}
+
+/**
+ * Takes pages from any number of clients on a socket, one per line in the
+ * --input-format, and sends them in the order they arrive. Parsing runs on
+ * an event loop thread, encoding on this one. Returns the exit code for
+ * main() after SIGINT or SIGTERM, which must be blocked in every thread.
+ */
+int runListen(Transmitter* transmitter, const char* address, int format) {
+    struct sockaddr_storage socketAddress;
+    socklen_t addressLength;
+    if (listenAddress(address, 1, &socketAddress, &addressLength) != 0) {
+        return 1;
+    }
+    int local = socketAddress.ss_family == AF_UNIX;
+    struct stat info;
+    if (local && lstat(address, &info) == 0) {
+        //Replace a socket left over from an earlier run, but nothing else
+        if (!S_ISSOCK(info.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", address);
+            return 1;
+        }
+        unlink(address);
+    }
+
+    Listener* listener = (Listener*) calloc(1, sizeof(Listener));
+    if (listener == NULL) {
+        fprintf(stderr, "Out of memory for the listener\n");
+        return 1;
+    }
+    listener->signals = listener->poller = -1;
+    listener->listener = socket(socketAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (listener->listener >= 0 && !local) {
+        setsockopt(listener->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (listener->listener < 0
+            || bind(listener->listener, (struct sockaddr*) &socketAddress, addressLength) != 0
+            || listen(listener->listener, SOMAXCONN) != 0) {
+        perror(address);
+        if (listener->listener >= 0) {
+            close(listener->listener);
+        }
+        free(listener);
+        return 1;
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    listener->signals = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    listener->poller = epoll_create1(EPOLL_CLOEXEC);
+    if (listener->signals < 0 || listener->poller < 0) {
+        perror(listener->signals < 0 ? "signalfd" : "epoll_create1");
+        listenerFree(listener, address, local);
+        return 1;
+    }
+    listener->maxConnections = raiseFileLimit();
+    listener->connections = (Connection*) calloc(listener->maxConnections, sizeof(Connection));
+    if (listener->connections == NULL) {
+        fprintf(stderr, "Out of memory for %zu clients\n", listener->maxConnections);
+        listenerFree(listener, address, local);
+        return 1;
+    }
+    listener->format = format;
+    listener->accepting = 1;
+
+    RecordRing ring;
+    if (ringInit(&ring, LISTEN_RING_SIZE, &transmitter->health) != 0) {
+        listenerFree(listener, address, local);
+        return 1;
+    }
+    listener->ring = &ring;
+
+    int watched[] = { listener->listener, listener->signals };
+    for (size_t i = 0; i < sizeof(watched) / sizeof(watched[0]); i++) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = watched[i];
+        epoll_ctl(listener->poller, EPOLL_CTL_ADD, watched[i], &event);
+    }
+    if (transmitter->stats) {
+        fprintf(stderr, "Listening on %s for up to %zu clients\n",
+                address, listener->maxConnections);
+    }
+
+    pthread_t loop;
+    pthread_create(&loop, NULL, listenLoop, listener);
+    ringEncode(transmitter, &ring);
+    pthread_join(loop, NULL);
+    finishTransmission(transmitter);
+
+    if (transmitter->stats) {
+        fprintf(stderr, "Accepted %llu pages from %llu clients, turned away %llu while busy\n",
+                (unsigned long long) listener->numAccepted,
+                (unsigned long long) listener->numClients,
+                (unsigned long long) listener->numRejected);
+    }
+    close(ring.doorbell);
+    free(ring.data);
+    listenerFree(listener, address, local);
+    return 0;
+}
+
+/**
+ * One client of --listen-bench.
+ */
+typedef struct {
+    int fd;
+    int connecting;
+    uint32_t sent;
+    uint32_t acknowledged;
+    uint64_t sentAt;
+    char reply[64];
+    size_t replyLength;
+} BenchClient;
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sends the next page of a bench client.
+ */
+static int benchSend(BenchClient* client, size_t index) {
+    uint32_t address = (uint32_t) ((index * 7919 + client->sent) % MAX_ADDRESS);
+    if (addressWordReserved(address, FLAG_FUNC_3)) {
+        address ^= 0x8;
+    }
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%u:bench %zu %u\n", address, index, client->sent);
+    client->sentAt = monotonicNanos();
+    client->sent++;
+    return send(client->fd, line, length, MSG_NOSIGNAL) == length ? 0 : 1;
+}
+
+/**
+ * Load test for --listen: opens numClients connections to address and
+ * keeps them all open, then has every client send numPages pages, each
+ * as soon as the one before was acknowledged. The clients run on one
+ * event loop like the server. Prints how long connecting took, the pages
+ * per second and the round-trip times. Returns 1 if any page was refused.
+ */
+int runListenBench(const char* address, size_t numClients, size_t numPages) {
+    struct sockaddr_storage socketAddress;
+    socklen_t addressLength;
+    if (listenAddress(address, 0, &socketAddress, &addressLength) != 0) {
+        return 1;
+    }
+    size_t limit = raiseFileLimit();
+    if (numClients + 16 > limit) {
+        fprintf(stderr, "Only %zu files may be open, not enough for %zu clients\n",
+                limit, numClients);
+        return 1;
+    }
+
+    int poller = epoll_create1(EPOLL_CLOEXEC);
+    BenchClient* clients = (BenchClient*) calloc(numClients, sizeof(BenchClient));
+    double* latencies = (double*) malloc(sizeof(double) * (numClients * numPages + 1));
+    struct epoll_event events[LISTEN_MAX_EVENTS];
+    int failed = 0;
+
+    // --- Alle verbinden
+    uint64_t start = monotonicNanos();
+    size_t next = 0;
+    size_t connecting = 0;
+    size_t connected = 0;
+    while (!failed && connected < numClients) {
+        while (next < numClients && connecting < LISTEN_BENCH_CONNECTING) {
+            BenchClient* client = &clients[next];
+            client->fd = socket(socketAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (client->fd < 0) {
+                perror("socket");
+                failed = 1;
+                break;
+            }
+            int one = 1;
+            setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            int result = connect(client->fd, (struct sockaddr*) &socketAddress, addressLength);
+            if (result != 0 && errno == EAGAIN) {
+                //The server's backlog is full, try again once it caught up
+                close(client->fd);
+                break;
+            }
+            if (result != 0 && errno != EINPROGRESS) {
+                perror(address);
+                failed = 1;
+                break;
+            }
+            client->connecting = result != 0;
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = client->connecting ? EPOLLOUT : EPOLLIN;
+            event.data.u64 = next;
+            epoll_ctl(poller, EPOLL_CTL_ADD, client->fd, &event);
+            connecting += client->connecting;
+            connected += !client->connecting;
+            next++;
+        }
+        int numEvents = epoll_wait(poller, events, LISTEN_MAX_EVENTS, connecting > 0 ? 100 : 1);
+        for (int i = 0; i < numEvents && !failed; i++) {
+            BenchClient* client = &clients[events[i].data.u64];
+            if (!client->connecting) {
+                fprintf(stderr, "Server closed a connection before any page was sent\n");
+                failed = 1;
+                break;
+            }
+            int error = 0;
+            socklen_t errorLength = sizeof(error);
+            getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+            if (error != 0) {
+                fprintf(stderr, "%s: %s\n", address, strerror(error));
+                failed = 1;
+                break;
+            }
+            client->connecting = 0;
+            connecting--;
+            connected++;
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u64 = events[i].data.u64;
+            epoll_ctl(poller, EPOLL_CTL_MOD, client->fd, &event);
+        }
+    }
+    double connectSeconds = (monotonicNanos() - start) / 1e9;
+
+    // --- Alle senden, jeweils nach der Bestätigung die nächste Seite
+    start = monotonicNanos();
+    size_t numLatencies = 0;
+    size_t finished = 0;
+    uint64_t refused = 0;
+    for (size_t c = 0; c < numClients && !failed; c++) {
+        if (numPages == 0) {
+            finished++;
+        } else if (benchSend(&clients[c], c) != 0) {
+            perror("send");
+            failed = 1;
+        }
+    }
+    while (!failed && finished < numClients) {
+        int numEvents = epoll_wait(poller, events, LISTEN_MAX_EVENTS, -1);
+        for (int i = 0; i < numEvents && !failed; i++) {
+            size_t index = events[i].data.u64;
+            BenchClient* client = &clients[index];
+            ssize_t got = recv(client->fd, client->reply + client->replyLength,
+                               sizeof(client->reply) - client->replyLength, 0);
+            if (got <= 0) {
+                if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    continue;
+                }
+                fprintf(stderr, "Server closed a connection with pages unacknowledged\n");
+                failed = 1;
+                break;
+            }
+            client->replyLength += got;
+            char* newline;
+            while ((newline = (char*) memchr(client->reply, '\n', client->replyLength)) != NULL) {
+                latencies[numLatencies++] = (monotonicNanos() - client->sentAt) / 1e6;
+                if (strncmp(client->reply, "ok\n", 3) != 0) {
+                    if (refused++ == 0) {
+                        fprintf(stderr, "Page refused: %.*s\n",
+                                (int) (newline - client->reply), client->reply);
+                    }
+                }
+                size_t used = newline + 1 - client->reply;
+                client->replyLength -= used;
+                memmove(client->reply, newline + 1, client->replyLength);
+                client->acknowledged++;
+                if (client->acknowledged < numPages) {
+                    failed = benchSend(client, index) != 0;
+                } else {
+                    epoll_ctl(poller, EPOLL_CTL_DEL, client->fd, NULL);
+                    close(client->fd);
+                    client->fd = -1;
+                    finished++;
+                }
+            }
+        }
+    }
+    double sendSeconds = (monotonicNanos() - start) / 1e9;
+
+    for (size_t c = 0; c < numClients; c++) {
+        if (clients[c].fd > 0) {
+            close(clients[c].fd);
+        }
+    }
+    close(poller);
+    free(clients);
+    if (failed) {
+        free(latencies);
+        return 1;
+    }
+
+    printf("Connected %zu clients in %.3f s\n", numClients, connectSeconds);
+    printf("Sent %zu pages in %.3f s, %.0f pages/s\n",
+           numLatencies, sendSeconds, numLatencies / sendSeconds);
+    if (numLatencies > 0) {
+        qsort(latencies, numLatencies, sizeof(double), compareDoubles);
+        double sum = 0;
+        for (size_t i = 0; i < numLatencies; i++) {
+            sum += latencies[i];
+        }
+        printf("Round trip: mean %.2f ms, median %.2f ms, 99%% %.2f ms, max %.2f ms\n",
+               sum / numLatencies, latencies[numLatencies / 2],
+               latencies[numLatencies * 99 / 100], latencies[numLatencies - 1]);
+    }
+    if (refused > 0) {
+        printf("%llu pages refused\n", (unsigned long long) refused);
+    }
+    free(latencies);
+    return refused > 0;
+}
+
+#else
+
+int runListen(Transmitter* transmitter, const char* address, int format) {
+    fprintf(stderr, "--listen needs epoll, which only Linux has\n");
+    return 1;
+}
+
+int runListenBench(const char* address, size_t numClients, size_t numPages) {
+    fprintf(stderr, "--listen-bench needs epoll, which only Linux has\n");
+    return 1;
+}
+
+#endif
+
+
+// =========================================================
+// EINGABE AUS DATEI (MMAP, PARALLEL GEPARST)
+// =========================================================
+
+/**
+ * Byte offset of the first line beginning at or after offset.
+ */
+size_t lineBoundary(const char* data, size_t size, size_t offset) {
+    if (offset == 0) {
+        return 0;
+    }
+    if (offset >= size) {
+        return size;
+    }
+    const char* newline = memchr(data + offset - 1, '\n', size - offset + 1);
+    return newline == NULL ? size : (size_t) (newline + 1 - data);
+}
+
+/**
+ * Byte offset at which the given chunk starts: the first line beginning at
+ * or after chunk * INPUT_CHUNK_SIZE. Every thread computes the same
+ * boundaries on its own, so no thread needs to wait for the one before.
+ */
+size_t chunkBoundary(const MappedInput* input, size_t chunk) {
+    return lineBoundary(input->data, input->size, chunk * INPUT_CHUNK_SIZE);
+}
+
+/**
+ * Parser thread. Claims the next chunk, splits it into lines and parses them
+ * into records pointing into the mapping. Parsing a chunk stops at the
+ * first bad line, the encoder reports it once it gets there.
+ */
+void* inputWorker(void* arg) {
+    MappedInput* input = (MappedInput*) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&input->lock);
+        while (!input->stop && input->nextChunk < input->numChunks
+                && input->nextChunk >= input->consumed + input->window) {
+            pthread_cond_wait(&input->changed, &input->lock);
+        }
+        if (input->stop || input->nextChunk >= input->numChunks) {
+            pthread_mutex_unlock(&input->lock);
+            return NULL;
+        }
+        size_t chunk = input->nextChunk++;
+        pthread_mutex_unlock(&input->lock);
+
+        InputChunk* slot = &input->slots[chunk % input->window];
+        const char* start = input->data + chunkBoundary(input, chunk);
+        const char* end = input->data + chunkBoundary(input, chunk + 1);
+        const char* line = start;
+
+        if (input->format != INPUT_NATIVE && slot->textCapacity < (size_t) (end - start)) {
+            free(slot->text);
+            slot->textCapacity = end - start;
+            slot->text = (char*) malloc(slot->textCapacity);
+        }
+
+        while (line < end) {
+            const char* newline = memchr(line, '\n', end - line);
+            const char* next = newline == NULL ? end : newline + 1;
+            size_t length = (newline == NULL ? end : newline) - line;
+            if (length > 0 && line[length - 1] == '\r') {
+                length--;
+            }
+
+            if (slot->count == slot->capacity) {
+                slot->capacity = slot->capacity == 0 ? 1024 : slot->capacity * 2;
+                slot->records =
+                    (Record*) realloc(slot->records, sizeof(Record) * slot->capacity);
+            }
+            Record* record = &slot->records[slot->count];
+            int error = parseRecord(
+                    input->format, line, length, slot->text + (line - start), record);
+            record->position = input->base + (line - input->data);
+            line = next;
+            if (error == PARSE_IGNORED) {
+                continue;
+            }
+            slot->count++;
+            if (error != PARSE_OK) {
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&input->lock);
+        slot->ready = 1;
+        pthread_cond_broadcast(&input->changed);
+        pthread_mutex_unlock(&input->lock);
+    }
+}
+
+/**
+ * Maps an input file and passes its records to consume() in their original
+ * order, while numThreads workers parse the chunks ahead of it. If idle is
+ * given, it is called whenever consume() has caught up with the workers.
+ * Returns the exit code for main().
+ *
+ * With numShards > 1 only one slice of the file is read: the lines
+ * starting in [shard, shard + 1) * size / numShards. Every shard finds the
+ * same line boundaries, so the slices cover the file exactly once.
+ */
+int readMappedFile(
+        const char* path,
+        int format,
+        int numThreads,
+        int shard,
+        int numShards,
+        RecordConsumer consume,
+        IdleHandler idle,
+        void* context) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    MappedInput input;
+    memset(&input, 0, sizeof(input));
+    input.mappingSize = info.st_size;
+    input.format = format;
+    input.mapping = (const char*) mmap(NULL, input.mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (input.mapping == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+
+    input.base = lineBoundary(input.mapping, input.mappingSize,
+                              (uint64_t) input.mappingSize * shard / numShards);
+    input.data = input.mapping + input.base;
+    input.size = lineBoundary(input.mapping, input.mappingSize,
+                              (uint64_t) input.mappingSize * (shard + 1) / numShards)
+                 - input.base;
+
+    //The file is read front to back exactly once
+    madvise((void*) input.mapping, input.mappingSize, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise((void*) input.mapping, input.mappingSize, MADV_HUGEPAGE);
+#endif
+
+    input.numChunks = (input.size + INPUT_CHUNK_SIZE - 1) / INPUT_CHUNK_SIZE;
+    input.window = numThreads * INPUT_CHUNKS_PER_THREAD;
+    input.slots = (InputChunk*) calloc(input.window, sizeof(InputChunk));
+    pthread_mutex_init(&input.lock, NULL);
+    pthread_cond_init(&input.changed, NULL);
+
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t) * numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_create(&workers[t], NULL, inputWorker, &input);
+    }
+
+    int result = 0;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t released = input.base / pageSize * pageSize;
+    for (size_t chunk = 0; chunk < input.numChunks && result == 0; chunk++) {
+        InputChunk* slot = &input.slots[chunk % input.window];
+
+        pthread_mutex_lock(&input.lock);
+        if (!slot->ready && idle != NULL) {
+            pthread_mutex_unlock(&input.lock);
+            idle(context);
+            pthread_mutex_lock(&input.lock);
+        }
+        while (!slot->ready) {
+            pthread_cond_wait(&input.changed, &input.lock);
+        }
+        pthread_mutex_unlock(&input.lock);
+
+        for (size_t r = 0; r < slot->count; r++) {
+            if (slot->records[r].error != PARSE_OK) {
+                printParseError(&slot->records[r]);
+                result = 1;
+                break;
+            }
+            consume(context, &slot->records[r]);
+        }
+
+        //Hand the pages of this chunk back, nothing points into them anymore
+        size_t done = (input.base + chunkBoundary(&input, chunk + 1)) / pageSize * pageSize;
+        if (done > released) {
+            madvise((void*) (input.mapping + released), done - released, MADV_DONTNEED);
+            released = done;
+        }
+
+        pthread_mutex_lock(&input.lock);
+        slot->ready = 0;
+        slot->count = 0;
+        input.consumed++;
+        input.stop = result != 0;
+        pthread_cond_broadcast(&input.changed);
+        pthread_mutex_unlock(&input.lock);
+    }
+
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    for (size_t w = 0; w < input.window; w++) {
+        free(input.slots[w].records);
+        free(input.slots[w].text);
+    }
+    free(input.slots);
+    free(workers);
+    pthread_mutex_destroy(&input.lock);
+    pthread_cond_destroy(&input.changed);
+    munmap((void*) input.mapping, input.mappingSize);
+    return result;
+}
+
+static void transmitConsumer(void* context, const Record* record) {
+    transmitRecord((Transmitter*) context, record);
+}
+
+/**
+ * The queue is as deep as it gets until the parsers catch up.
+ */
+static void transmitIdle(void* context) {
+    Transmitter* transmitter = (Transmitter*) context;
+    if (transmitter->scheduler != NULL) {
+        schedulerFlush(transmitter);
+    }
+}
+
+/**
+ * Transmits the lines of an input file, see readMappedFile().
+ */
+int transmitMappedFile(
+        Transmitter* transmitter,
+        const char* path,
+        int format,
+        int numThreads,
+        int shard,
+        int numShards) {
+    return readMappedFile(path, format, numThreads, shard, numShards,
+                          transmitConsumer, transmitIdle, transmitter);
+}
+
+
+// =========================================================
+// PRÜFSUMMEN (CRC32C)
+// =========================================================
+
+static uint32_t crc32cTable[8][256];
+
+/**
+ * Portable CRC32C, slicing by 8: eight table lookups per 8 bytes instead of
+ * one per byte.
+ */
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* p, size_t length) {
+    while (length >= 8) {
+        uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24);
+        crc = crc32cTable[7][low & 0xFF] ^ crc32cTable[6][(low >> 8) & 0xFF]
+            ^ crc32cTable[5][(low >> 16) & 0xFF] ^ crc32cTable[4][low >> 24]
+            ^ crc32cTable[3][p[4]] ^ crc32cTable[2][p[5]]
+            ^ crc32cTable[1][p[6]] ^ crc32cTable[0][p[7]];
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * CRC32C with the SSE4.2 crc32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+static int crc32cHardwareAvailable(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+/**
+ * CRC32C with the ARMv8 CRC extension.
+ */
+__attribute__((target("+crc")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static int crc32cHardwareAvailable(void) {
+#ifdef HWCAP_CRC32
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return 0;
+#endif
+}
+#else
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+    return crc32cSoftware(crc, p, length);
+}
+
+static int crc32cHardwareAvailable(void) {
+    return 0;
+}
+#endif
+
+static uint32_t (*crc32cKernel)(uint32_t, const uint8_t*, size_t) = NULL;
+static pthread_once_t crc32cOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Fills the slicing tables and picks the kernel, once for all threads.
+ */
+static void crc32cInit(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32cTable[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc32cTable[t - 1][n];
+            crc32cTable[t][n] = (c >> 8) ^ crc32cTable[0][c & 0xFF];
+        }
+    }
+    crc32cKernel = crc32cHardwareAvailable() ? crc32cHardware : crc32cSoftware;
+}
+
+/**
+ * Continues a CRC32C over more data; start with crc = 0. Uses the CPU's CRC
+ * instruction where there is one. Safe to call from several threads.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    pthread_once(&crc32cOnce, crc32cInit);
+    return ~crc32cKernel(~crc, (const uint8_t*) data, length);
+}
+
+/**
+ * Checks every transmission listed in an index against a PCM dump. The dump
+ * is read front to back in large blocks, skipping the silence between
+ * transmissions. Returns the exit code for main().
+ */
+int verifyDump(const char* indexPath, const char* dumpPath) {
+    FILE* index = fopen(indexPath, "r");
+    if (index == NULL) {
+        perror(indexPath);
+        return 1;
+    }
+    int dump = open(dumpPath, O_RDONLY);
+    if (dump < 0) {
+        perror(dumpPath);
+        fclose(index);
+        return 1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(dump, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    uint8_t* buffer = (uint8_t*) malloc(VERIFY_BUFFER_SIZE);
+    char line[256];
+    uint64_t position = 0;
+    unsigned long long checked = 0;
+    unsigned long long mismatches = 0;
+    int result = 0;
+
+    while (result == 0 && fgets(line, sizeof(line), index) != NULL) {
+        unsigned long long offset, numSamples;
+        unsigned int address, functionCode, expected;
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%llu %llu %u %u %x",
+                   &offset, &numSamples, &address, &functionCode, &expected) != 5) {
+            fprintf(stderr, "Malformed index line: %s", line);
+            result = 1;
+            break;
+        }
+
+        uint64_t start = offset * 2;
+        uint64_t remaining = numSamples * 2;
+        if (start != position) {
+            if (lseek(dump, start, SEEK_SET) < 0) {
+                perror(dumpPath);
+                result = 1;
+                break;
+            }
+            position = start;
+        }
+
+        uint32_t crc = 0;
+        while (remaining > 0) {
+            size_t want = remaining < VERIFY_BUFFER_SIZE ? remaining : VERIFY_BUFFER_SIZE;
+            ssize_t got = read(dump, buffer, want);
+            if (got <= 0) {
+                fprintf(stderr, "Dump ends inside transmission at sample %llu\n", offset);
+                result = 1;
+                break;
+            }
+            crc = crc32c(crc, buffer, got);
+            position += got;
+            remaining -= got;
+        }
+        if (result != 0) {
+            break;
+        }
+
+        checked++;
+        if (crc != expected) {
+            mismatches++;
+            printf("Mismatch at sample %llu (address %u): expected %08x, got %08x\n",
+                   offset, address, expected, crc);
+        }
+    }
+
+    if (result == 0) {
+        printf("%llu transmissions checked, %llu corrupt\n", checked, mismatches);
+        result = mismatches > 0;
+    }
+    free(buffer);
+    close(dump);
+    fclose(index);
+    return result;
+}
+
+
+// =========================================================
+// FLUGSCHREIBER (RINGPUFFER IN DATEI)
+// =========================================================
+
+static size_t recorderDataOffset(uint64_t indexCapacity) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t end = RECORDER_HEADER_SIZE + indexCapacity * sizeof(RecorderEntry);
+    return (end + pageSize - 1) / pageSize * pageSize;
+}
+
+/**
+ * Maps a flight recorder file holding the last `minutes` of output. A file
+ * of the same size from an earlier run is carried on, so the recording
+ * survives a restart; otherwise it is created afresh. Everything sent is
+ * then copied into the mapping, which the kernel writes back on its own.
+ * Returns non-zero on error.
+ */
+int openRecorder(const char* path, double minutes, uint32_t sampleRate, Recorder* recorder) {
+    uint64_t capacity = (uint64_t) (minutes * 60 * sampleRate);
+    uint64_t indexCapacity = (uint64_t) (minutes * RECORDER_ENTRIES_PER_MINUTE) + 1;
+    if (capacity < (uint64_t) sampleRate * (RECORDER_MARGIN + 1)) {
+        fprintf(stderr, "Flight recorder must hold more than %d seconds\n", RECORDER_MARGIN + 1);
+        return 1;
+    }
+    size_t dataOffset = recorderDataOffset(indexCapacity);
+    uint64_t fileSize = dataOffset + capacity * 2;
+    if (fileSize > SIZE_MAX || fileSize > INT64_MAX) {
+        fprintf(stderr, "Flight recorder of %g minutes is too large\n", minutes);
+        return 1;
+    }
+    size_t size = (size_t) fileSize;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat info;
+    int fresh = fstat(fd, &info) != 0 || (size_t) info.st_size != size;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) size) != 0)) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+
+    recorder->header = (RecorderHeader*) mapping;
+    recorder->entries = (RecorderEntry*) ((uint8_t*) mapping + RECORDER_HEADER_SIZE);
+    recorder->data = (uint8_t*) mapping + dataOffset;
+    recorder->mappingSize = size;
+
+    RecorderHeader* header = recorder->header;
+    if (fresh || memcmp(header->magic, RECORDER_MAGIC, 8) != 0
+            || header->capacity != capacity || header->indexCapacity != indexCapacity
+            || header->sampleRate != sampleRate) {
+        memset(header, 0, sizeof(RecorderHeader));
+        header->sampleRate = sampleRate;
+        header->headerSize = RECORDER_HEADER_SIZE;
+        header->capacity = capacity;
+        header->indexCapacity = indexCapacity;
+        memcpy(header->magic, RECORDER_MAGIC, 8);
+    }
+    return 0;
+}
+
+/**
+ * Appends samples to the ring, overwriting the oldest ones.
+ */
+void recorderWrite(Recorder* recorder, const uint8_t* pcm, size_t numBytes) {
+    RecorderHeader* header = recorder->header;
+    uint64_t written = header->written;
+    uint64_t ringBytes = header->capacity * 2;
+
+    //Only the newest capacity samples of a huge write survive anyway
+    if (numBytes > ringBytes) {
+        written += (numBytes - ringBytes) / 2;
+        pcm += numBytes - ringBytes;
+        numBytes = ringBytes;
+    }
+    size_t at = (written % header->capacity) * 2;
+    size_t first = numBytes < ringBytes - at ? numBytes : ringBytes - at;
+    memcpy(recorder->data + at, pcm, first);
+    memcpy(recorder->data, pcm + first, numBytes - first);
+    __atomic_store_n(&header->written, written + numBytes / 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Adds an index entry for the transmission which is written next.
+ */
+void recorderIndex(
+        Recorder* recorder,
+        uint64_t numSamples,
+        uint32_t address,
+        FunctionCode functionCode,
+        uint32_t crc) {
+
+    RecorderHeader* header = recorder->header;
+    RecorderEntry* entry = &recorder->entries[header->indexWritten % header->indexCapacity];
+    entry->offset = header->written;
+    entry->numSamples = numSamples;
+    entry->address = address;
+    entry->functionCode = functionCode;
+    entry->crc = crc;
+    __atomic_store_n(&header->indexWritten, header->indexWritten + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies the last `minutes` of a flight recorder to outputPath and prints
+ * the transmissions which lie wholly inside it to stdout, in the format of
+ * --index, so --verify can check the copy. The recorder may be in use; the
+ * copy stays RECORDER_MARGIN seconds clear of the writer. Returns the exit
+ * code for main().
+ */
+int extractRecorder(const char* path, double minutes, const char* outputPath) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat info;
+    RecorderHeader header;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < RECORDER_HEADER_SIZE
+            || pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+            || memcmp(header.magic, RECORDER_MAGIC, 8) != 0
+            || (size_t) info.st_size != recorderDataOffset(header.indexCapacity)
+                                        + header.capacity * 2) {
+        fprintf(stderr, "%s is not a flight recorder file\n", path);
+        close(fd);
+        return 1;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+    const RecorderHeader* live = (const RecorderHeader*) mapping;
+    const RecorderEntry* entries =
+        (const RecorderEntry*) ((const uint8_t*) mapping + RECORDER_HEADER_SIZE);
+    const uint8_t* data = (const uint8_t*) mapping + recorderDataOffset(header.indexCapacity);
+
+    FILE* out = fopen(outputPath, "wb");
+    if (out == NULL) {
+        perror(outputPath);
+        munmap(mapping, info.st_size);
+        return 1;
+    }
+
+    uint64_t end = __atomic_load_n(&live->written, __ATOMIC_ACQUIRE);
+    uint64_t available = header.capacity - (uint64_t) header.sampleRate * RECORDER_MARGIN;
+    uint64_t wanted = (uint64_t) (minutes * 60 * header.sampleRate);
+    if (wanted > available) {
+        wanted = available;
+    }
+    if (wanted > end) {
+        wanted = end;
+    }
+    uint64_t start = end - wanted;
+
+    //Oldest first, so the writer only ever moves away from what is left
+    for (uint64_t sample = start; sample < end; ) {
+        size_t at = sample % header.capacity;
+        uint64_t count = header.capacity - at;
+        if (count > end - sample) {
+            count = end - sample;
+        }
+        if (count > RECORDER_CHUNK / 2) {
+            count = RECORDER_CHUNK / 2;
+        }
+        fwrite(data + at * 2, 2, count, out);
+        sample += count;
+    }
+    fclose(out);
+
+    uint64_t now = __atomic_load_n(&live->written, __ATOMIC_ACQUIRE);
+    if (now > start + header.capacity) {
+        fprintf(stderr, "The recorder overtook the copy, its first %.1f s are newer than "
+                        "the rest\n", (double) (now - start - header.capacity) / header.sampleRate);
+    }
+
+    printf("# sample_offset sample_count address function crc32c\n");
+    uint64_t numEntries = __atomic_load_n(&live->indexWritten, __ATOMIC_ACQUIRE);
+    uint64_t firstEntry = numEntries > header.indexCapacity ? numEntries - header.indexCapacity : 0;
+    for (uint64_t e = firstEntry; e < numEntries; e++) {
+        const RecorderEntry* entry = &entries[e % header.indexCapacity];
+        if (entry->offset >= start && entry->offset + entry->numSamples <= end) {
+            printf("%llu %llu %u %u %08x\n",
+                   (unsigned long long) (entry->offset - start),
+                   (unsigned long long) entry->numSamples,
+                   entry->address, entry->functionCode, entry->crc);
+        }
+    }
+    printf("# total_samples %llu\n", (unsigned long long) (end - start));
+
+    munmap(mapping, info.st_size);
+    return 0;
+}
+
+
+// =========================================================
+// VERTEILTE ERZEUGUNG (SHARDS ZUSAMMENFÜHREN)
+// =========================================================
+
+/**
+ * The manifest written next to a shard's output. Returns a malloc'd string.
+ */
+char* manifestPath(const char* segmentPath) {
+    char* path = (char*) malloc(strlen(segmentPath) + sizeof(MANIFEST_SUFFIX));
+    strcpy(path, segmentPath);
+    strcat(path, MANIFEST_SUFFIX);
+    return path;
+}
+
+/**
+ * What the merge needs to know about one shard.
+ */
+typedef struct {
+    const char* segmentPath;
+    char* manifestPath;
+    int shard;
+    int numShards;
+    unsigned long long totalSamples;
+} ShardInfo;
+
+static int compareShards(const void* a, const void* b) {
+    return ((const ShardInfo*) a)->shard - ((const ShardInfo*) b)->shard;
+}
+
+/**
+ * Reads the shard number and the total from a manifest. The total is only
+ * written once a shard has finished, so a shard that failed or is still
+ * running is refused here.
+ */
+static int readShardInfo(ShardInfo* info) {
+    FILE* manifest = fopen(info->manifestPath, "r");
+    if (manifest == NULL) {
+        perror(info->manifestPath);
+        return 1;
+    }
+    char line[256];
+    int haveTotal = 0;
+    info->numShards = 0;
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        if (sscanf(line, "# shard %d/%d", &info->shard, &info->numShards) == 2) {
+            continue;
+        }
+        haveTotal = sscanf(line, "# total_samples %llu", &info->totalSamples) == 1;
+    }
+    fclose(manifest);
+
+    if (info->numShards == 0 || !haveTotal) {
+        fprintf(stderr, "%s: not the manifest of a finished shard\n", info->manifestPath);
+        return 1;
+    }
+    struct stat segment;
+    if (stat(info->segmentPath, &segment) != 0) {
+        perror(info->segmentPath);
+        return 1;
+    }
+    if ((unsigned long long) segment.st_size != info->totalSamples * 2) {
+        fprintf(stderr, "%s: size doesn't match its manifest\n", info->segmentPath);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Appends a whole file to out. copy_file_range() lets the kernel copy
+ * without going through user space, and share the blocks instead of
+ * copying them on file systems that support reflinks.
+ */
+static int appendFile(int out, const char* path) {
+    int in = open(path, O_RDONLY);
+    if (in < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat info;
+    fstat(in, &info);
+    off_t remaining = info.st_size;
+
+#ifdef __linux__
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(in, NULL, out, NULL, remaining, 0);
+        if (copied <= 0) {
+            break;
+        }
+        remaining -= copied;
+    }
+#endif
+
+    //Fallback for other systems or file systems the kernel can't copy between
+    static char buffer[1 << 20];
+    while (remaining > 0) {
+        ssize_t got = read(in, buffer, sizeof(buffer));
+        if (got <= 0 || write(out, buffer, got) != got) {
+            perror(path);
+            close(in);
+            return 1;
+        }
+        remaining -= got;
+    }
+    close(in);
+    return 0;
+}
+
+/**
+ * Joins the outputs of all shards of a job, in shard order, into one file
+ * which is identical to what a single run over the whole input would have
+ * written. Their manifests are merged into OUTPUT.manifest, with the
+ * offsets moved to where each shard ends up, which is then identical to a
+ * single run's --index. Returns the exit code for main().
+ */
+int mergeShards(const char* outputPath, char** segmentPaths, int numSegments) {
+    ShardInfo* shards = (ShardInfo*) calloc(numSegments, sizeof(ShardInfo));
+    int result = 0;
+
+    for (int i = 0; i < numSegments && result == 0; i++) {
+        shards[i].segmentPath = segmentPaths[i];
+        shards[i].manifestPath = manifestPath(segmentPaths[i]);
+        result = readShardInfo(&shards[i]);
+    }
+    if (result == 0) {
+        qsort(shards, numSegments, sizeof(ShardInfo), compareShards);
+        for (int i = 0; i < numSegments; i++) {
+            if (shards[i].shard != i || shards[i].numShards != numSegments) {
+                fprintf(stderr, "Expected shards 0 to %d of %d, got shard %d/%d\n",
+                        numSegments - 1, numSegments,
+                        shards[i].shard, shards[i].numShards);
+                result = 1;
+                break;
+            }
+        }
+    }
+
+    int out = -1;
+    FILE* index = NULL;
+    char* outputManifest = manifestPath(outputPath);
+    if (result == 0) {
+        out = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        index = fopen(outputManifest, "w");
+        if (out < 0 || index == NULL) {
+            perror(out < 0 ? outputPath : outputManifest);
+            result = 1;
+        }
+    }
+
+    unsigned long long base = 0;
+    if (result == 0) {
+        fprintf(index, "# sample_offset sample_count address function crc32c\n");
+    }
+    for (int i = 0; i < numSegments && result == 0; i++) {
+        result = appendFile(out, shards[i].segmentPath);
+
+        FILE* manifest = fopen(shards[i].manifestPath, "r");
+        char line[256];
+        while (result == 0 && manifest != NULL && fgets(line, sizeof(line), manifest) != NULL) {
+            unsigned long long offset, numSamples;
+            unsigned int address, functionCode, checksum;
+            if (sscanf(line, "%llu %llu %u %u %x",
+                       &offset, &numSamples, &address, &functionCode, &checksum) == 5) {
+                fprintf(index, "%llu %llu %u %u %08x\n",
+                        base + offset, numSamples, address, functionCode, checksum);
+            }
+        }
+        if (manifest != NULL) {
+            fclose(manifest);
+        }
+        base += shards[i].totalSamples;
+    }
+    if (result == 0) {
+        fprintf(index, "# total_samples %llu\n", base);
+    }
+
+    if (index != NULL) {
+        fclose(index);
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    for (int i = 0; i < numSegments; i++) {
+        free(shards[i].manifestPath);
+    }
+    free(shards);
+    free(outputManifest);
+    return result;
+}
+
+
+// =========================================================
+// DEKODIERUNG UND KONFORMITÄTSTEST
+// =========================================================
+
+/**
+ * Checks the parity and CRC of a codeword and extracts its 21 data bits.
+ * Returns 0 if the codeword is damaged.
+ */
+int decodeCodeword(uint32_t codeword, uint32_t* msg) {
+    *msg = codeword >> (CRC_BITS + 1);
+    return encodeCodeword(*msg) == codeword;
+}
+
+/**
+ * Reads codewords back from PCM written by pcmEncodeTransmission(), taking
+ * the sample nearest to the middle of every bit. The samples are
+ * little-endian whatever the host.
+ */
+void pcmDecodeWords(
+        uint32_t sampleRate,
+        uint32_t baudRate,
+        const uint8_t* pcm,
+        size_t numWords,
+        uint32_t* out) {
+
+    uint64_t repeatsPerBit = SYMRATE / baudRate;
+    for (size_t i = 0; i < numWords; i++) {
+        uint32_t word = 0;
+        for (int b = 0; b < 32; b++) {
+            //First sample at or after the middle of the bit
+            uint64_t symbol = ((uint64_t) i * 32 + b) * repeatsPerBit + repeatsPerBit / 2;
+            uint64_t k = (symbol * sampleRate + SYMRATE - 1) / SYMRATE;
+            int16_t sample = (int16_t) (pcm[2 * k] | pcm[2 * k + 1] << 8);
+            word = (word << 1) | (sample < 0);
+        }
+        out[i] = word;
+    }
+}
+
+/**
+ * Decodes a transmission carrying a single page, as encodeTransmission()
+ * writes it: the preamble, then batches starting with SYNC, an address word
+ * in the frame given by the low address bits, its message words and at
+ * least one IDLE word after them. Returns DECODE_OK or what was wrong.
+ */
+int decodeTransmission(
+        const uint32_t* transmission,
+        size_t transmissionLength,
+        uint32_t preambleLength,
+        DecodedPage* page) {
+
+    size_t numPreamble = preambleLength / 32;
+    if (transmissionLength < numPreamble
+            || (transmissionLength - numPreamble) % BATCH_WORDS != 0) {
+        return DECODE_BAD_PREAMBLE;
+    }
+    for (size_t i = 0; i < numPreamble; i++) {
+        if (transmission[i] != 0xAAAAAAAA) {
+            return DECODE_BAD_PREAMBLE;
+        }
+    }
+
+    //0 = vor der Adresse, 1 = in der Nachricht, 2 = nach der Nachricht
+    int state = 0;
+    uint32_t bits = 0;
+    int numBits = 0;
+    page->numChars = 0;
+    for (size_t i = numPreamble; i < transmissionLength; i++) {
+        size_t position = (i - numPreamble) % BATCH_WORDS;
+        uint32_t word = transmission[i];
+        if (position == 0) {
+            if (word != SYNC) {
+                return DECODE_BAD_SYNC;
+            }
+            continue;
+        }
+        if (word == IDLE) {
+            if (state == 1) {
+                state = 2;
+            }
+            continue;
+        }
+
+        uint32_t msg;
+        if (!decodeCodeword(word, &msg)) {
+            return DECODE_BAD_CODEWORD;
+        }
+        if (state == 2 || (state == 0 && (msg & FLAG_MESSAGE))) {
+            return DECODE_EXTRA_WORDS;
+        }
+        if (state == 0) {
+            page->address = ((msg >> 2) << 3) | ((position - 1) / FRAME_SIZE);
+            page->functionCode = msg & 0x3;
+            state = 1;
+            continue;
+        }
+        if (!(msg & FLAG_MESSAGE)) {
+            return DECODE_EXTRA_WORDS;
+        }
+
+        //Text bits come first-sent first, characters LSB first
+        for (int b = TEXT_BITS_PER_WORD - 1; b >= 0; b--) {
+            bits |= ((msg >> b) & 1) << numBits;
+            numBits++;
+            if (numBits == TEXT_BITS_PER_CHAR) {
+                if (page->numChars == sizeof(page->text)) {
+                    return DECODE_EXTRA_WORDS;
+                }
+                page->text[page->numChars++] = bits;
+                bits = 0;
+                numBits = 0;
+            }
+        }
+    }
+
+    if (state == 0) {
+        return DECODE_NO_ADDRESS;
+    }
+    return state == 2 ? DECODE_OK : DECODE_UNTERMINATED;
+}
+
+/**
+ * Describes sweep case `index`. The address cases cover all 21 bits, every
+ * function code and short messages of varying length. The frame cases send
+ * every message length up to SWEEP_MAX_CHARS from every frame, so the text
+ * crosses each batch boundary at each possible word, with all 128
+ * characters cycling through every bit position of the codewords.
+ * Returns 1 if the case should also go through PCM.
+ */
+int sweepCase(
+        uint64_t index,
+        uint32_t* address,
+        FunctionCode* functionCode,
+        char* message,
+        size_t* numChars) {
+
+    if (index <= MAX_ADDRESS) {
+        *address = index;
+        *functionCode = index & 0x3;
+        *numChars = index % 41;
+        for (size_t n = 0; n < *numChars; n++) {
+            message[n] = (index * 7 + n * 31) & 0x7F;
+        }
+        return 0;
+    }
+
+    index -= MAX_ADDRESS + 1;
+    uint32_t frame = index % (BATCH_SIZE / FRAME_SIZE);
+    *numChars = index / (BATCH_SIZE / FRAME_SIZE);
+    //Use high address bits too, so the frame isn't the whole address
+    *address = (MAX_ADDRESS & ~0x7u) - (*numChars << 3) + frame;
+    *functionCode = FLAG_FUNC_3;
+    for (size_t n = 0; n < *numChars; n++) {
+        message[n] = (n + frame * 16) & 0x7F;
+    }
+    return 1;
+}
+
+/**
+ * Encodes a page, optionally renders it to PCM and reads it back, then
+ * decodes it and compares. Returns DECODE_OK, a DECODE_ error, or -1 if it
+ * decoded to a different page. The sweep uses -2 for reserved address words
+ * which the parser let through.
+ */
+int checkRoundTrip(
+        uint32_t address,
+        FunctionCode functionCode,
+        const char* message,
+        size_t numChars,
+        int viaPcm) {
+
+    size_t length = messageLength(address, numChars, functionCode, PREAMBLE_LENGTH);
+    uint32_t* transmission = (uint32_t*) malloc(sizeof(uint32_t) * length);
+    if (transmission == NULL
+            || encodeTransmission(address, message, numChars, transmission, functionCode,
+                                  PREAMBLE_LENGTH) != 0) {
+        free(transmission);
+        return 1;
+    }
+
+    if (viaPcm) {
+        size_t pcmLength = pcmTransmissionLength(SAMPLE_RATE, BAUD_RATE, length);
+        uint8_t* pcm = (uint8_t*) malloc(pcmLength);
+        pcmEncodeTransmission(SAMPLE_RATE, BAUD_RATE, transmission, length, PCM_LEVEL, pcm);
+        pcmDecodeWords(SAMPLE_RATE, BAUD_RATE, pcm, length, transmission);
+        free(pcm);
+    }
+
+    DecodedPage page;
+    int result = decodeTransmission(transmission, length, PREAMBLE_LENGTH, &page);
+    free(transmission);
+    if (result != DECODE_OK) {
+        return result;
+    }
+
+    if (page.address != address || page.functionCode != functionCode
+            || page.numChars < numChars || memcmp(page.text, message, numChars) != 0) {
+        return -1;
+    }
+    //Only padding may follow: less than a codeword, all zero
+    if ((page.numChars - numChars) * TEXT_BITS_PER_CHAR >= TEXT_BITS_PER_WORD) {
+        return -1;
+    }
+    for (size_t n = numChars; n < page.numChars; n++) {
+        if (page.text[n] != 0) {
+            return -1;
+        }
+    }
+    return DECODE_OK;
+}
+
+void* sweepWorker(void* arg) {
+    Sweep* sweep = (Sweep*) arg;
+    char message[SWEEP_MAX_CHARS];
+
+    for (;;) {
+        uint64_t first = __atomic_fetch_add(&sweep->next, SWEEP_BLOCK, __ATOMIC_RELAXED);
+        if (first >= sweep->numCases) {
+            return NULL;
+        }
+        uint64_t last = first + SWEEP_BLOCK;
+        if (last > sweep->numCases) {
+            last = sweep->numCases;
+        }
+
+        for (uint64_t index = first; index < last; index++) {
+            uint32_t address;
+            FunctionCode functionCode;
+            size_t numChars;
+            int viaPcm = sweepCase(index, &address, &functionCode, message, &numChars);
+            int result;
+            if (addressWordReserved(address, functionCode)) {
+                //Can't be sent, so it has to be refused on input
+                char line[32];
+                Record record;
+                int length = snprintf(line, sizeof(line), "%u:%u:", address, functionCode);
+                result = parseLine(line, length, &record) == PARSE_RESERVED_ADDRESS ? DECODE_OK : -2;
+            } else {
+                result = checkRoundTrip(address, functionCode, message, numChars, viaPcm);
+            }
+            if (result == DECODE_OK) {
+                continue;
+            }
+            uint64_t failures = __atomic_add_fetch(&sweep->failures, 1, __ATOMIC_RELAXED);
+            if (failures <= SWEEP_MAX_REPORTS) {
+                fprintf(stderr, "Mismatch: address %u, function %u, %zu characters%s: %s\n",
+                        address, functionCode, numChars, viaPcm ? " (via PCM)" : "",
+                        result == -2 ? "reserved address word not refused by the parser"
+                        : result < 0 ? "decoded to a different page"
+                        : result == DECODE_BAD_PREAMBLE ? "bad preamble or length"
+                        : result == DECODE_BAD_SYNC ? "missing sync word"
+                        : result == DECODE_BAD_CODEWORD ? "CRC or parity error"
+                        : result == DECODE_NO_ADDRESS ? "no address word"
+                        : result == DECODE_UNTERMINATED ? "message not ended by IDLE"
+                        : "unexpected codewords");
+            }
+        }
+    }
+}
+
+/**
+ * Round-trips every address and every frame/length combination through the
+ * encoder and decoder on numThreads threads, and checks that the parser
+ * accepts exactly the 21-bit addresses. Returns the exit code for main().
+ */
+int runSweep(int numThreads) {
+    Sweep sweep;
+    sweep.numCases = (uint64_t) MAX_ADDRESS + 1
+                   + (uint64_t) (BATCH_SIZE / FRAME_SIZE) * (SWEEP_MAX_CHARS + 1);
+    sweep.next = 0;
+    sweep.failures = 0;
+
+    //The 21-bit limit at the parser
+    static const struct { const char* line; int error; } limits[] = {
+        { "0:a", PARSE_OK },
+        { "2097151:a", PARSE_OK },
+        { "2097152:a", PARSE_INVALID_ADDRESS },
+        { "4294967295:a", PARSE_INVALID_ADDRESS },
+        { "4294967296:a", PARSE_INVALID_ADDRESS },
+        { "99999999999999999999:a", PARSE_INVALID_ADDRESS },
+    };
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        Record record;
+        if (parseLine(limits[i].line, strlen(limits[i].line), &record) != limits[i].error) {
+            fprintf(stderr, "Mismatch: parsing \"%s\"\n", limits[i].line);
+            sweep.failures++;
+        }
+    }
+
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t) * numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_create(&workers[t], NULL, sweepWorker, &sweep);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+
+    printf("%llu cases, %llu mismatches\n",
+           (unsigned long long) sweep.numCases, (unsigned long long) sweep.failures);
+    return sweep.failures == 0 ? 0 : 1;
+}
+
+// =========================================================
+// FRAME-AUSLASTUNG UND CAPCODE-BERATUNG
+// =========================================================
+
+/**
+ * Makes sure the batches up to `batch` are in the simulation window, and
+ * drops the ones which no message can be placed in anymore. Returns
+ * non-zero if there is no memory for the window.
+ */
+static int simulationReserve(FrameSimulation* simulation, uint64_t batch) {
+    uint64_t first = simulation->from / BATCH_SIZE;
+    if (first > simulation->baseBatch) {
+        size_t keep = simulation->capacity - (first - simulation->baseBatch);
+        memmove(simulation->occupied, simulation->occupied + (first - simulation->baseBatch),
+                sizeof(uint16_t) * keep);
+        memset(simulation->occupied + keep, 0,
+               sizeof(uint16_t) * (simulation->capacity - keep));
+        simulation->baseBatch = first;
+    }
+    if (batch - simulation->baseBatch >= simulation->capacity) {
+        size_t capacity = simulation->capacity < SIMULATION_MIN_BATCHES
+                        ? SIMULATION_MIN_BATCHES : simulation->capacity;
+        while (batch - simulation->baseBatch >= capacity) {
+            capacity *= 2;
+        }
+        uint16_t* occupied = (uint16_t*) realloc(simulation->occupied, sizeof(uint16_t) * capacity);
+        if (occupied == NULL) {
+            return 1;
+        }
+        simulation->occupied = occupied;
+        memset(simulation->occupied + simulation->capacity, 0,
+               sizeof(uint16_t) * (capacity - simulation->capacity));
+        simulation->capacity = capacity;
+    }
+    return 0;
+}
+
+/**
+ * Finds the first run of numWords free slots at or after `from` which
+ * starts in the given frame, or in any slot if frame is -1. The batches it
+ * can end in must be reserved already.
+ */
+static uint64_t simulationFindRun(const FrameSimulation* simulation, int frame, size_t numWords) {
+    uint32_t starts = frame < 0 ? 0xFFFF : 0x3u << (frame * FRAME_SIZE);
+    const uint16_t* occupied = simulation->occupied - simulation->baseBatch;
+    uint64_t start = simulation->from;
+    for (;;) {
+        //Next free slot the message may start in
+        uint64_t batch = start / BATCH_SIZE;
+        uint32_t candidates = ~occupied[batch] & starts & (0xFFFFu << (start % BATCH_SIZE));
+        if (candidates == 0) {
+            start = (batch + 1) * BATCH_SIZE;
+            continue;
+        }
+        start = batch * BATCH_SIZE + __builtin_ctz(candidates);
+
+        //How far the free slots go from there
+        uint64_t end = start;
+        while (end < start + numWords) {
+            uint32_t taken = occupied[end / BATCH_SIZE] >> (end % BATCH_SIZE);
+            if (taken == 0) {
+                end = (end / BATCH_SIZE + 1) * BATCH_SIZE;
+                continue;
+            }
+            end += __builtin_ctz(taken);
+            break;
+        }
+        if (end >= start + numWords) {
+            return start;
+        }
+        start = end + 1;
+    }
+}
+
+/**
+ * Places a message of numWords codewords (address word included) whose
+ * address word has to go into the given frame. Returns its first slot, or
+ * 0 once the simulation has failed.
+ */
+uint64_t simulatePlace(FrameSimulation* simulation, uint32_t frame, size_t numWords) {
+    if (simulation->failed) {
+        return 0;
+    }
+    uint64_t sent = simulation->end / BATCH_SIZE;
+    sent = sent > SIMULATION_WINDOW ? sent - SIMULATION_WINDOW : 0;
+    if (simulation->from < sent * BATCH_SIZE) {
+        simulation->from = sent * BATCH_SIZE;
+    }
+    if (simulationReserve(simulation, simulation->from / BATCH_SIZE) != 0) {
+        simulation->failed = 1;
+        return 0;
+    }
+    while (simulation->occupied[simulation->from / BATCH_SIZE - simulation->baseBatch] == 0xFFFF) {
+        simulation->from = (simulation->from / BATCH_SIZE + 1) * BATCH_SIZE;
+        if (simulationReserve(simulation, simulation->from / BATCH_SIZE) != 0) {
+            simulation->failed = 1;
+            return 0;
+        }
+    }
+    //The batch after the end is empty, so the message fits before that
+    if (simulationReserve(simulation, (simulation->end + numWords) / BATCH_SIZE + 2) != 0) {
+        simulation->failed = 1;
+        return 0;
+    }
+    uint64_t anywhere = simulationFindRun(simulation, -1, numWords);
+    uint64_t start = simulationFindRun(simulation, frame, numWords);
+
+    for (uint64_t slot = start; slot < start + numWords; slot++) {
+        simulation->occupied[slot / BATCH_SIZE - simulation->baseBatch] |= 1 << (slot % BATCH_SIZE);
+    }
+    uint64_t delay = start - anywhere;
+    simulation->numMessages++;
+    simulation->totalDelay += delay;
+    if (delay > simulation->maxDelay) {
+        simulation->maxDelay = delay;
+    }
+    if (start + numWords > simulation->end) {
+        simulation->end = start + numWords;
+    }
+    return start;
+}
+
+void analysisConsumer(void* context, const Record* record) {
+    FrameAnalysis* analysis = (FrameAnalysis*) context;
+    size_t numWords = 1 + (record->length * TEXT_BITS_PER_CHAR
+                           + (TEXT_BITS_PER_WORD - 1)) / TEXT_BITS_PER_WORD;
+    if (analysis->messages != NULL) {
+        analysis->messages[record->address]++;
+        analysis->codewords[record->address] += numWords;
+    }
+    uint32_t frame = analysis->frames != NULL
+                   ? analysis->frames[record->address]
+                   : addressOffset(record->address) / FRAME_SIZE;
+    simulatePlace(&analysis->simulation, frame, numWords);
+}
+
+/**
+ * Balances the codewords over the frames by moving as few busy addresses
+ * as possible: each step moves the address from the busiest frame to the
+ * idlest which best closes half the gap between them. A moved address
+ * keeps its upper bits if that capcode is free, otherwise the next free
+ * block of eight is used, wrapping around to the lowest blocks. Fills in
+ * the moves and the new frame of every address, and returns the number of
+ * moves. `taken` is scratch space of one bit per capcode.
+ */
+size_t suggestCapcodes(const FrameAnalysis* analysis, uint32_t* from, uint32_t* to, uint8_t* frames,
+                       uint8_t* taken) {
+    uint64_t load[BATCH_SIZE / FRAME_SIZE] = { 0 };
+    for (uint32_t address = 0; address <= MAX_ADDRESS; address++) {
+        frames[address] = addressOffset(address) / FRAME_SIZE;
+        load[frames[address]] += analysis->codewords[address];
+    }
+
+    //Capcodes in use, or already handed out as the target of a move
+    memset(taken, 0, (MAX_ADDRESS + 1) / 8);
+    for (uint32_t address = 0; address <= MAX_ADDRESS; address++) {
+        if (analysis->messages[address] != 0) {
+            taken[address / 8] |= 1 << (address % 8);
+        }
+    }
+
+    size_t numMoves = 0;
+    while (numMoves < ANALYSIS_MAX_MOVES) {
+        uint32_t busiest = 0;
+        uint32_t idlest = 0;
+        for (uint32_t f = 1; f < BATCH_SIZE / FRAME_SIZE; f++) {
+            busiest = load[f] > load[busiest] ? f : busiest;
+            idlest = load[f] < load[idlest] ? f : idlest;
+        }
+        uint64_t half = (load[busiest] - load[idlest]) / 2;
+
+        //The unmoved address of the busiest frame closest to half the gap
+        uint32_t best = 0;
+        uint64_t bestLoad = 0;
+        for (uint32_t address = busiest; address <= MAX_ADDRESS; address += BATCH_SIZE / FRAME_SIZE) {
+            uint64_t words = analysis->codewords[address];
+            if (words > bestLoad && words <= half && frames[address] == busiest) {
+                best = address;
+                bestLoad = words;
+            }
+        }
+        if (bestLoad == 0) {
+            break;
+        }
+
+        uint32_t target = MAX_ADDRESS + 1;
+        uint32_t numBlocks = (MAX_ADDRESS >> 3) + 1;
+        for (uint32_t step = 0; step < numBlocks && target > MAX_ADDRESS; step++) {
+            uint32_t block = ((best >> 3) + step) % numBlocks;
+            uint32_t candidate = (block << 3) | idlest;
+            if (!(taken[candidate / 8] & (1 << (candidate % 8)))
+                    && !addressWordReserved(candidate, FLAG_FUNC_0)
+                    && !addressWordReserved(candidate, FLAG_FUNC_2)) {
+                target = candidate;
+            }
+        }
+        if (target > MAX_ADDRESS) {
+            break;
+        }
+
+        taken[target / 8] |= 1 << (target % 8);
+        frames[best] = idlest;
+        load[busiest] -= bestLoad;
+        load[idlest] += bestLoad;
+        from[numMoves] = best;
+        to[numMoves] = target;
+        numMoves++;
+    }
+    return numMoves;
+}
+
+/**
+ * Prints airtime and delays of a simulation. A slot lasts one codeword, a
+ * batch 17 of them including its sync word.
+ */
+void printSimulation(const char* label, const FrameSimulation* simulation) {
+    double secondsPerSlot = 32.0 * BATCH_WORDS / BATCH_SIZE / BAUD_RATE;
+    uint64_t batches = (simulation->end + BATCH_SIZE - 1) / BATCH_SIZE;
+    printf("%s: %llu batches (%.1f s airtime), delay mean %.3f s, max %.3f s\n",
+           label, (unsigned long long) batches,
+           batches * BATCH_WORDS * 32.0 / BAUD_RATE,
+           simulation->numMessages > 0
+               ? simulation->totalDelay * secondsPerSlot / simulation->numMessages : 0.0,
+           simulation->maxDelay * secondsPerSlot);
+}
+
+/**
+ * Reads a traffic log twice: once to measure the load of every frame and
+ * simulate it as it is, and once to simulate it with the suggested
+ * capcodes. Prints the report to stdout. Returns the exit code for main().
+ */
+int runAnalysis(const char* path, int format, int numThreads) {
+    FrameAnalysis analysis;
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.messages = (uint32_t*) calloc(MAX_ADDRESS + 1, sizeof(uint32_t));
+    analysis.codewords = (uint64_t*) calloc(MAX_ADDRESS + 1, sizeof(uint64_t));
+    uint32_t* from = (uint32_t*) malloc(sizeof(uint32_t) * ANALYSIS_MAX_MOVES);
+    uint32_t* to = (uint32_t*) malloc(sizeof(uint32_t) * ANALYSIS_MAX_MOVES);
+    uint8_t* frames = (uint8_t*) malloc(MAX_ADDRESS + 1);
+    uint8_t* taken = (uint8_t*) malloc((MAX_ADDRESS + 1) / 8);
+    int result = 1;
+    if (analysis.messages == NULL || analysis.codewords == NULL || from == NULL || to == NULL
+            || frames == NULL || taken == NULL) {
+        fprintf(stderr, "Out of memory for the analysis\n");
+        goto done;
+    }
+
+    result = readMappedFile(path, format, numThreads, 0, 1, analysisConsumer, NULL, &analysis);
+    if (result == 0 && analysis.simulation.failed) {
+        fprintf(stderr, "Out of memory for the analysis\n");
+        result = 1;
+    }
+    if (result != 0) {
+        goto done;
+    }
+
+    uint64_t messages[BATCH_SIZE / FRAME_SIZE] = { 0 };
+    uint64_t codewords[BATCH_SIZE / FRAME_SIZE] = { 0 };
+    uint64_t totalCodewords = 0;
+    for (uint32_t address = 0; address <= MAX_ADDRESS; address++) {
+        messages[address & 0x7] += analysis.messages[address];
+        codewords[address & 0x7] += analysis.codewords[address];
+        totalCodewords += analysis.codewords[address];
+    }
+    printf("# frame messages codewords share\n");
+    for (int f = 0; f < BATCH_SIZE / FRAME_SIZE; f++) {
+        printf("%d %llu %llu %.1f%%\n", f, (unsigned long long) messages[f],
+               (unsigned long long) codewords[f],
+               totalCodewords > 0 ? 100.0 * codewords[f] / totalCodewords : 0.0);
+    }
+    printSimulation("current", &analysis.simulation);
+
+    size_t numMoves = suggestCapcodes(&analysis, from, to, frames, taken);
+    if (numMoves == 0) {
+        printf("no capcode change would balance the frames any better\n");
+        goto done;
+    }
+
+    FrameSimulation current = analysis.simulation;
+    free(analysis.messages);
+    analysis.messages = NULL;
+    analysis.frames = frames;
+    memset(&analysis.simulation, 0, sizeof(analysis.simulation));
+    result = readMappedFile(path, format, numThreads, 0, 1, analysisConsumer, NULL, &analysis);
+    if (result == 0 && analysis.simulation.failed) {
+        fprintf(stderr, "Out of memory for the analysis\n");
+        result = 1;
+    }
+    if (result != 0) {
+        free(current.occupied);
+        goto done;
+    }
+
+    printf("# address new_address codewords\n");
+    for (size_t m = 0; m < numMoves; m++) {
+        printf("%u %u %llu\n", from[m], to[m], (unsigned long long) analysis.codewords[from[m]]);
+    }
+    printSimulation("suggested", &analysis.simulation);
+    if (current.end > 0 && current.numMessages > 0) {
+        printf("airtime %+.1f%%, mean delay %+.1f%%\n",
+               100.0 * ((double) analysis.simulation.end / current.end - 1),
+               current.totalDelay > 0
+                   ? 100.0 * ((double) analysis.simulation.totalDelay / current.totalDelay - 1)
+                   : 0.0);
+    }
+    free(current.occupied);
+
+done:
+    free(analysis.messages);
+    free(analysis.codewords);
+    free(analysis.simulation.occupied);
+    free(from);
+    free(to);
+    free(frames);
+    free(taken);
+    return result;
+}
+
+// =========================================================
+// KONFIGURATION (NEU LADEN MIT SIGHUP)
+// =========================================================
+
+/**
+ * Fills in the compiled-in defaults.
+ */
+void defaultConfig(Config* config) {
+    config->minDelay = MIN_DELAY;
+    config->maxDelay = MAX_DELAY;
+    config->preambleLength = PREAMBLE_LENGTH;
+    config->level = PCM_LEVEL;
+}
+
+/**
+ * Reads `key = value` lines from a config file, starting from the defaults.
+ * Blank lines and lines starting with # are skipped. On any error the file
+ * is rejected as a whole and 1 is returned.
+ */
+int loadConfig(const char* path, Config* config) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    defaultConfig(config);
+    char line[CONFIG_LINE_SIZE];
+    char key[CONFIG_LINE_SIZE];
+    unsigned long value;
+    int lineNumber = 0;
+    int error = 0;
+    while (!error && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char* start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\r' || *start == 0) {
+            continue;
+        }
+        if (sscanf(start, "%255[a-z_] = %lu", key, &value) != 2) {
+            fprintf(stderr, "%s:%d: Expected key = value\n", path, lineNumber);
+            error = 1;
+        } else if (strcmp(key, "min_delay") == 0 && value <= CONFIG_MAX_DELAY) {
+            config->minDelay = value;
+        } else if (strcmp(key, "max_delay") == 0 && value <= CONFIG_MAX_DELAY) {
+            config->maxDelay = value;
+        } else if (strcmp(key, "preamble_length") == 0 && value % 32 == 0 && value <= 32 * 1024) {
+            config->preambleLength = value;
+        } else if (strcmp(key, "level") == 0 && value <= 32767) {
+            config->level = value;
+        } else {
+            fprintf(stderr, "%s:%d: Unknown key or invalid value: %s", path, lineNumber, start);
+            error = 1;
+        }
+    }
+    fclose(file);
+
+    if (!error && config->minDelay > config->maxDelay) {
+        fprintf(stderr, "%s: min_delay is greater than max_delay\n", path);
+        error = 1;
+    }
+    return error;
+}
+
+/**
+ * Returns the Config to encode the next message with. Must be paired with
+ * configRelease() once the message is written. Only the encoder thread may
+ * call this.
+ */
+const Config* configAcquire(LiveConfig* live) {
+    __atomic_store_n(&live->busy, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&live->active, __ATOMIC_SEQ_CST);
+}
+
+void configRelease(LiveConfig* live) {
+    __atomic_store_n(&live->busy, 0, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&live->epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Waits for SIGHUP and swaps in the reloaded config file. SIGHUP has to be
+ * blocked in every thread, so it is only ever delivered here. A file with
+ * errors leaves the running config in place.
+ */
+void* configReloadWorker(void* arg) {
+    LiveConfig* live = (LiveConfig*) arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+
+    for (;;) {
+        int signal;
+        if (sigwait(&signals, &signal) != 0) {
+            continue;
+        }
+        Config* config = (Config*) malloc(sizeof(Config));
+        if (config == NULL) {
+            fprintf(stderr, "Out of memory for the configuration, keeping the previous one\n");
+            continue;
+        }
+        if (loadConfig(live->path, config) != 0) {
+            fprintf(stderr, "Keeping the previous configuration\n");
+            free(config);
+            continue;
+        }
+        Config* old = __atomic_exchange_n(&live->active, config, __ATOMIC_SEQ_CST);
+
+        //The encoder may still be in a message it started with the old
+        //config; wait until it has finished that one
+        if (__atomic_load_n(&live->busy, __ATOMIC_SEQ_CST)) {
+            uint64_t epoch = __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&live->busy, __ATOMIC_SEQ_CST)
+                    && __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST) == epoch) {
+                struct timespec pause = { 0, 1000000 };
+                nanosleep(&pause, NULL);
+            }
+        }
+        free(old);
+        fprintf(stderr, "Reloaded configuration from %s\n", live->path);
+    }
+    return NULL;
+}
+
+// =========================================================
+// AUTOTUNING (KERNEL-AUSWAHL PRO HOST)
+// =========================================================
+
+static const char* const codewordKernelNames[] = { "bitwise", "table" };
+static const CodewordKernel codewordKernels[] = { encodeCodewordBitwise, encodeCodewordTable };
+static const char* const packingKernelNames[] = { "bitwise", "reversed" };
+static const PackingKernel packingKernels[] = { encodeASCIIBitwise, encodeASCIIReversed };
+static const char* const pcmKernelNames[] = { "resampled", "direct" };
+static const PcmKernel pcmKernels[] = { pcmEncodeResampled, pcmEncodeDirect };
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+/**
+ * Fills the lookup tables of the table-driven kernels.
+ */
+void kernelTablesInit(void) {
+    for (uint32_t x = 0; x < (1 << 10); x++) {
+        codewordHigh[x] = encodeCodewordBitwise(x << 11) & 0x7FF;
+    }
+    for (uint32_t x = 0; x < (1 << 11); x++) {
+        codewordLow[x] = encodeCodewordBitwise(x) & 0x7FF;
+    }
+    for (uint32_t c = 0; c < 128; c++) {
+        uint8_t reversed = 0;
+        for (int i = 0; i < TEXT_BITS_PER_CHAR; i++) {
+            reversed = (reversed << 1) | ((c >> i) & 1);
+        }
+        reversedChars[c] = reversed;
+    }
+}
+
+/**
+ * Switches the encoder over to the kernels of a tuning. Must happen before
+ * any encoding starts, the kernel pointers aren't synchronised.
+ */
+void applyTuning(const Tuning* tuning) {
+    kernelTablesInit();
+    codewordKernel = codewordKernels[tuning->codeword];
+    packingKernel = packingKernels[tuning->packing];
+    pcmKernel = pcmKernels[tuning->pcm];
+}
+
+static int kernelIndex(const char* const* names, size_t count, const char* name) {
+    for (size_t k = 0; k < count; k++) {
+        if (strcmp(names[k], name) == 0) {
+            return (int) k;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads a tuning saved by saveTuning(). Returns 1 if there is none, or if
+ * it was made by another version or for another kind of machine.
+ */
+int loadTuning(const char* path, Tuning* tuning) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 1;
+    }
+    struct utsname host;
+    uname(&host);
+
+    char line[TUNE_LINE_SIZE];
+    char key[64];
+    char value[TUNE_LINE_SIZE];
+    int version = 0;
+    int sameMachine = 0;
+    memset(tuning, 0, sizeof(Tuning));
+    tuning->codeword = tuning->packing = tuning->pcm = -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || sscanf(line, " %63[a-z_] = %255s", key, value) != 2) {
+            continue;
+        }
+        if (strcmp(key, "version") == 0) {
+            version = atoi(value);
+        } else if (strcmp(key, "machine") == 0) {
+            sameMachine = strcmp(value, host.machine) == 0;
+        } else if (strcmp(key, "codeword") == 0) {
+            tuning->codeword = kernelIndex(codewordKernelNames, COUNT_OF(codewordKernelNames), value);
+        } else if (strcmp(key, "packing") == 0) {
+            tuning->packing = kernelIndex(packingKernelNames, COUNT_OF(packingKernelNames), value);
+        } else if (strcmp(key, "pcm") == 0) {
+            tuning->pcm = kernelIndex(pcmKernelNames, COUNT_OF(pcmKernelNames), value);
+        }
+    }
+    fclose(file);
+    if (version != TUNE_VERSION || !sameMachine || tuning->codeword < 0
+            || tuning->packing < 0 || tuning->pcm < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Writes a tuning as `key = value` lines. Failing to is not an error, the
+ * next run just measures again.
+ */
+void saveTuning(const char* path, const Tuning* tuning) {
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.%ld", path, (long) getpid());
+    FILE* file = fopen(temporary, "w");
+    if (file == NULL) {
+        return;
+    }
+    struct utsname host;
+    uname(&host);
+    fprintf(file, "# pocsag kernel choice for this host, delete or use --retune to measure again\n");
+    fprintf(file, "version = %d\n", TUNE_VERSION);
+    fprintf(file, "machine = %s\n", host.machine);
+    fprintf(file, "codeword = %s\n", codewordKernelNames[tuning->codeword]);
+    fprintf(file, "packing = %s\n", packingKernelNames[tuning->packing]);
+    fprintf(file, "pcm = %s\n", pcmKernelNames[tuning->pcm]);
+    //Several instances may start at once; each replaces the file whole
+    if (fclose(file) != 0 || rename(temporary, path) != 0) {
+        unlink(temporary);
+    }
+}
+
+/**
+ * Times every variant of each kernel and keeps the fastest. Each kernel is
+ * timed on the same input as the plain one and only counts if its output
+ * is identical. The kernels are timed one after another, each with the
+ * ones already picked, so the whole takes a few tens of milliseconds.
+ */
+void measureTuning(Tuning* tuning) {
+    memset(tuning, 0, sizeof(Tuning));
+    tuning->measured = 1;
+    kernelTablesInit();
+
+    uint32_t seed = 0x2545F491;
+    uint32_t* messages = (uint32_t*) malloc(sizeof(uint32_t) * TUNE_CODEWORDS);
+    uint32_t* expected = (uint32_t*) malloc(sizeof(uint32_t) * TUNE_CODEWORDS);
+    uint32_t* actual = (uint32_t*) malloc(sizeof(uint32_t) * TUNE_CODEWORDS);
+    for (size_t i = 0; i < TUNE_CODEWORDS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        messages[i] = seed & 0x1FFFFF;
+        expected[i] = encodeCodewordBitwise(messages[i]);
+    }
+    double best = -1;
+    for (size_t k = 0; k < COUNT_OF(codewordKernels); k++) {
+        double fastest = -1;
+        for (int round = 0; round < TUNE_ROUNDS; round++) {
+            uint64_t start = monotonicNanos();
+            for (size_t i = 0; i < TUNE_CODEWORDS; i++) {
+                actual[i] = codewordKernels[k](messages[i]);
+            }
+            double nanos = (double) (monotonicNanos() - start) / TUNE_CODEWORDS;
+            if (fastest < 0 || nanos < fastest) {
+                fastest = nanos;
+            }
+        }
+        if (memcmp(actual, expected, sizeof(uint32_t) * TUNE_CODEWORDS) == 0
+                && (best < 0 || fastest < best)) {
+            best = fastest;
+            tuning->codeword = (int) k;
+        }
+    }
+    tuning->nanos[0] = best;
+    codewordKernel = codewordKernels[tuning->codeword];
+    free(messages);
+    free(expected);
+    free(actual);
+
+    //Printable text, a few batches long
+    char text[TUNE_TEXT_CHARS];
+    for (size_t i = 0; i < TUNE_TEXT_CHARS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        text[i] = (char) (' ' + seed % 95);
+    }
+    size_t numBatches = (TUNE_TEXT_CHARS * TEXT_BITS_PER_CHAR / TEXT_BITS_PER_WORD) / BATCH_SIZE + 2;
+    Batch* batches = allocBatches(numBatches);
+    uint32_t* expectedWords = (uint32_t*) malloc(sizeof(uint32_t) * numBatches * BATCH_WORDS);
+    uint32_t* words = (uint32_t*) malloc(sizeof(uint32_t) * numBatches * BATCH_WORDS);
+    encodeASCIIBitwise(text, TUNE_TEXT_CHARS, batches, 1);
+    batchSerialise(batches, numBatches, expectedWords);
+    best = -1;
+    for (size_t k = 0; k < COUNT_OF(packingKernels); k++) {
+        double fastest = -1;
+        for (int round = 0; round < TUNE_ROUNDS; round++) {
+            uint64_t start = monotonicNanos();
+            packingKernels[k](text, TUNE_TEXT_CHARS, batches, 1);
+            double nanos = (double) (monotonicNanos() - start) / TUNE_TEXT_CHARS;
+            if (fastest < 0 || nanos < fastest) {
+                fastest = nanos;
+            }
+        }
+        batchSerialise(batches, numBatches, words);
+        if (memcmp(words, expectedWords, sizeof(uint32_t) * numBatches * BATCH_WORDS) == 0
+                && (best < 0 || fastest < best)) {
+            best = fastest;
+            tuning->packing = (int) k;
+        }
+    }
+    tuning->nanos[1] = best;
+    packingKernel = packingKernels[tuning->packing];
+    free(batches);
+    free(expectedWords);
+    free(words);
+
+    //A page of typical length, preamble included
+    size_t transmissionLength = messageLength(1, TUNE_PCM_CHARS, FLAG_FUNC_3, PREAMBLE_LENGTH);
+    uint32_t* transmission = (uint32_t*) malloc(sizeof(uint32_t) * transmissionLength);
+    if (encodeTransmission(1, text, TUNE_PCM_CHARS, transmission, FLAG_FUNC_3, PREAMBLE_LENGTH) != 0) {
+        //Any words do for timing, as long as every kernel gets the same
+        memset(transmission, 0, sizeof(uint32_t) * transmissionLength);
+    }
+    size_t pcmLength = pcmTransmissionLength(SAMPLE_RATE, BAUD_RATE, transmissionLength);
+    uint8_t* expectedPcm = (uint8_t*) malloc(pcmLength);
+    uint8_t* pcm = (uint8_t*) malloc(pcmLength);
+    pcmEncodeResampled(SAMPLE_RATE, BAUD_RATE, transmission, transmissionLength, PCM_LEVEL, expectedPcm);
+    best = -1;
+    for (size_t k = 0; k < COUNT_OF(pcmKernels); k++) {
+        double fastest = -1;
+        for (int round = 0; round < TUNE_ROUNDS; round++) {
+            uint64_t start = monotonicNanos();
+            pcmKernels[k](SAMPLE_RATE, BAUD_RATE, transmission, transmissionLength, PCM_LEVEL, pcm);
+            double nanos = (double) (monotonicNanos() - start) / (pcmLength / 2);
+            if (fastest < 0 || nanos < fastest) {
+                fastest = nanos;
+            }
+        }
+        if (memcmp(pcm, expectedPcm, pcmLength) == 0 && (best < 0 || fastest < best)) {
+            best = fastest;
+            tuning->pcm = (int) k;
+        }
+    }
+    tuning->nanos[2] = best;
+    free(transmission);
+    free(expectedPcm);
+    free(pcm);
+}
+
+/**
+ * Picks the kernels for this run: from the cache file if it holds a
+ * tuning for this machine, or measured and then saved to it. With force
+ * set it always measures. A NULL cachePath measures without saving.
+ */
+void autotune(const char* cachePath, int force, Tuning* tuning) {
+    if (force || cachePath == NULL || loadTuning(cachePath, tuning) != 0) {
+        measureTuning(tuning);
+        if (cachePath != NULL) {
+            saveTuning(cachePath, tuning);
+        }
+    }
+    applyTuning(tuning);
+}
+
+/**
+ * Reports the kernels in use on stderr, for --stats.
+ */
+void printTuning(const Tuning* tuning, const char* cachePath) {
+    fprintf(stderr, "Kernels: codeword %s, packing %s, pcm %s (%s%s)\n",
+            codewordKernelNames[tuning->codeword], packingKernelNames[tuning->packing],
+            pcmKernelNames[tuning->pcm],
+            tuning->measured ? "measured" : cachePath != NULL ? "cached in " : "default",
+            tuning->measured || cachePath == NULL ? "" : cachePath);
+    if (tuning->measured) {
+        fprintf(stderr, "  %.2f ns/codeword, %.2f ns/character, %.2f ns/sample\n",
+                tuning->nanos[0], tuning->nanos[1], tuning->nanos[2]);
+    }
+}
+
+// =========================================================
+// GOLDENE AUSGABEN (DIGEST-KORPUS)
+// =========================================================
+
+/**
+ * Adds a case for every function code to the corpus, skipping addresses
+ * whose address word is reserved.
+ */
+static void goldenAddCases(
+        GoldenCorpus* corpus,
+        uint32_t address,
+        uint32_t baudRate,
+        const char* message,
+        size_t numChars) {
+
+    for (FunctionCode functionCode = 0; functionCode < 4; functionCode++) {
+        if (addressWordReserved(address, functionCode)) {
+            continue;
+        }
+        if (corpus->numCases == corpus->capacity) {
+            corpus->capacity = corpus->capacity == 0 ? 1024 : corpus->capacity * 2;
+            corpus->cases = (GoldenCase*) realloc(corpus->cases,
+                                                  sizeof(GoldenCase) * corpus->capacity);
+        }
+        GoldenCase* golden = &corpus->cases[corpus->numCases++];
+        memset(golden, 0, sizeof(GoldenCase));
+        golden->address = address;
+        golden->functionCode = functionCode;
+        golden->baudRate = baudRate;
+        golden->numChars = numChars;
+        memcpy(golden->text, message, numChars);
+    }
+}
+
+/**
+ * Builds the cases of the corpus: every frame with every message length up
+ * to three batches (by then every word of a batch has been crossed), pages
+ * at the edges of the address space and around the reserved address words,
+ * and every 7-bit character. All with each function code, spread over the
+ * three baud rates.
+ */
+void goldenGenerate(GoldenCorpus* corpus) {
+    static const uint32_t baudRates[] = { 512, 1200, 2400 };
+    static const uint32_t edges[] = {
+        0, 1, 7, 8, MAX_ADDRESS - 8, MAX_ADDRESS - 7, MAX_ADDRESS,
+        2007663, 2007664, 2007672, 2045055, 2045056, 2045064,
+    };
+    static const size_t edgeLengths[] = { 0, 1, 2, 3, 40 };
+    char message[GOLDEN_MAX_CHARS];
+    memset(corpus, 0, sizeof(GoldenCorpus));
+
+    for (size_t numChars = 0; numChars <= GOLDEN_FRAME_CHARS; numChars++) {
+        for (uint32_t frame = 0; frame < BATCH_SIZE / FRAME_SIZE; frame++) {
+            uint32_t index = numChars * (BATCH_SIZE / FRAME_SIZE) + frame;
+            //Scatter the upper address bits
+            uint32_t address = ((index * 0x9E3779B1u) >> 11 & (MAX_ADDRESS & ~0x7u)) | frame;
+            for (size_t n = 0; n < numChars; n++) {
+                message[n] = (char) ((index * 7 + n * 31) & 0x7F);
+            }
+            goldenAddCases(corpus, address, baudRates[index % 3], message, numChars);
+        }
+    }
+    for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++) {
+        for (size_t l = 0; l < sizeof(edgeLengths) / sizeof(edgeLengths[0]); l++) {
+            for (size_t n = 0; n < edgeLengths[l]; n++) {
+                message[n] = (char) ('0' + (e + n) % 10);
+            }
+            goldenAddCases(corpus, edges[e], baudRates[(e + l) % 3], message, edgeLengths[l]);
+        }
+    }
+    for (uint32_t c = 0; c < 128; c++) {
+        memset(message, (int) c, TEXT_BITS_PER_WORD);
+        goldenAddCases(corpus, 1000 + c, baudRates[c % 3], message, TEXT_BITS_PER_WORD);
+    }
+    for (uint32_t c = 0; c < 128; c++) {
+        message[c] = (char) c;
+    }
+    goldenAddCases(corpus, 1128, 512, message, 128);
+    //Only 7 bits of each byte are sent
+    goldenAddCases(corpus, 1129, 512, "\xc3\xa9t\xc3\xa9 \xff\x80", 8);
+}
+
+/**
+ * Renders a case at a whole number of samples per bit, picked from the
+ * case so the corpus covers them all, both in one piece and as a window
+ * from the middle. Returns 1 if that matches pcmEncodeResampled(), which
+ * is too slow to digest at every rate but the reference all the same.
+ */
+int goldenIntegerRate(const GoldenCase* golden, const uint32_t* transmission, size_t length) {
+    uint32_t samplesPerBit = 1 + (golden->address + golden->numChars) % GOLDEN_MAX_SAMPLES_PER_BIT;
+    uint32_t sampleRate = golden->baudRate * samplesPerBit;
+    size_t pcmLength = pcmTransmissionLength(sampleRate, golden->baudRate, length);
+    uint8_t* expected = (uint8_t*) malloc(pcmLength);
+    uint8_t* pcm = (uint8_t*) malloc(pcmLength);
+    pcmEncodeResampled(sampleRate, golden->baudRate, (uint32_t*) transmission, length,
+                       PCM_LEVEL, expected);
+    pcmEncodeTransmission(sampleRate, golden->baudRate, (uint32_t*) transmission, length,
+                          PCM_LEVEL, pcm);
+    int exact = memcmp(expected, pcm, pcmLength) == 0;
+
+    size_t numSamples = pcmLength / 2;
+    size_t first = numSamples / 3 + golden->numChars;
+    int16_t* window = (int16_t*) pcm;
+    pcmRenderCodewords(sampleRate, golden->baudRate, PCM_LEVEL, transmission, first,
+                       numSamples - first, window);
+    for (size_t k = 0; exact && k < numSamples - first; k++) {
+        int16_t sample = (int16_t) (expected[2 * (first + k)] | expected[2 * (first + k) + 1] << 8);
+        exact = window[k] == sample;
+    }
+    free(expected);
+    free(pcm);
+    return exact;
+}
+
+/**
+ * Puts a case between two stretches of silence on a PcmRenderer and reads
+ * the timeline back: forwards in small windows, backwards in windows of
+ * another size and in one piece. The window sizes depend on the case, so
+ * the corpus covers them all. Returns 1 if every read matches the samples
+ * of pcmEncodeTransmission() at SAMPLE_RATE, given as pcm.
+ */
+int goldenRenderer(const GoldenCase* golden, const uint32_t* transmission, size_t length,
+                   const uint8_t* pcm) {
+    PcmRenderer renderer;
+    pcmRendererInit(&renderer, SAMPLE_RATE, golden->baudRate);
+    uint64_t lead = 1 + golden->numChars % 97;
+    int built = pcmRendererAddSilence(&renderer, lead) == 0
+             && pcmRendererAddTransmission(&renderer, transmission, length) == 0
+             && pcmRendererAddSilence(&renderer, GOLDEN_MAX_WINDOW) == 0;
+    uint64_t numSamples = renderer.totalSamples;
+    uint64_t pcmSamples = pcmTransmissionLength(SAMPLE_RATE, golden->baudRate, length) / 2;
+
+    size_t windows[3] = {
+        1 + (golden->address + golden->numChars) % GOLDEN_MAX_WINDOW,
+        1 + (golden->address * 7 + golden->numChars) % (GOLDEN_MAX_WINDOW * 67),
+        numSamples,
+    };
+    int16_t* out = (int16_t*) malloc(sizeof(int16_t) * numSamples);
+    int exact = built && out != NULL;
+    for (int w = 0; exact && w < 3; w++) {
+        uint64_t numWindows = (numSamples + windows[w] - 1) / windows[w];
+        for (uint64_t k = 0; exact && k < numWindows; k++) {
+            //The second size seeks backwards through the timeline
+            uint64_t offset = (w == 1 ? numWindows - 1 - k : k) * windows[w];
+            size_t want = windows[w];
+            size_t got = pcmRendererRead(&renderer, offset, want, out + offset);
+            exact = got == (numSamples - offset < want ? numSamples - offset : want);
+        }
+        for (uint64_t i = 0; exact && i < numSamples; i++) {
+            int16_t sample = 0;
+            if (i >= lead && i - lead < pcmSamples) {
+                const uint8_t* bytes = pcm + 2 * (i - lead);
+                sample = (int16_t) (bytes[0] | bytes[1] << 8);
+            }
+            exact = out[i] == sample;
+        }
+    }
+    free(out);
+    pcmRendererFree(&renderer);
+    return exact;
+}
+
+/**
+ * CRC32C digests of a case's codewords (as little-endian words) and of
+ * its PCM samples. With crossMismatch, the case is also rendered by the
+ * other paths, and crossMismatch is set to what differs, or NULL.
+ */
+void goldenDigest(const GoldenCase* golden, uint32_t* codewordDigest, uint32_t* pcmDigest,
+                  const char** crossMismatch) {
+    size_t length = messageLength(golden->address, golden->numChars, golden->functionCode,
+                                  PREAMBLE_LENGTH);
+    uint32_t* transmission = (uint32_t*) malloc(sizeof(uint32_t) * length);
+    if (transmission == NULL
+            || encodeTransmission(golden->address, golden->text, golden->numChars, transmission,
+                                  golden->functionCode, PREAMBLE_LENGTH) != 0) {
+        //Shows up as a mismatch
+        free(transmission);
+        *codewordDigest = 0;
+        *pcmDigest = 0;
+        if (crossMismatch != NULL) {
+            *crossMismatch = NULL;
+        }
+        return;
+    }
+
+    size_t pcmLength = pcmTransmissionLength(SAMPLE_RATE, golden->baudRate, length);
+    uint8_t* pcm = (uint8_t*) malloc(pcmLength);
+    pcmEncodeTransmission(SAMPLE_RATE, golden->baudRate, transmission, length, PCM_LEVEL, pcm);
+    *pcmDigest = crc32c(0, pcm, pcmLength);
+    if (crossMismatch != NULL) {
+        *crossMismatch = NULL;
+        if (!goldenRenderer(golden, transmission, length, pcm)) {
+            *crossMismatch = "samples read back from a renderer";
+        }
+        if (!goldenIntegerRate(golden, transmission, length)) {
+            *crossMismatch = "samples at a whole number of samples per bit";
+        }
+    }
+    free(pcm);
+
+    uint32_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t word[4] = {
+            transmission[i] & 0xFF, (transmission[i] >> 8) & 0xFF,
+            (transmission[i] >> 16) & 0xFF, transmission[i] >> 24,
+        };
+        crc = crc32c(crc, word, sizeof(word));
+    }
+    *codewordDigest = crc;
+    free(transmission);
+}
+
+void* goldenWorker(void* arg) {
+    GoldenCorpus* corpus = (GoldenCorpus*) arg;
+
+    for (;;) {
+        size_t first = __atomic_fetch_add(&corpus->next, GOLDEN_BLOCK, __ATOMIC_RELAXED);
+        if (first >= corpus->numCases) {
+            return NULL;
+        }
+        size_t last = first + GOLDEN_BLOCK;
+        if (last > corpus->numCases) {
+            last = corpus->numCases;
+        }
+
+        for (size_t c = first; c < last; c++) {
+            GoldenCase* golden = &corpus->cases[c];
+            uint32_t codewordDigest;
+            uint32_t pcmDigest;
+            const char* crossMismatch = NULL;
+            goldenDigest(golden, &codewordDigest, &pcmDigest,
+                         corpus->crossChecks ? &crossMismatch : NULL);
+            if (corpus->generating) {
+                golden->codewordDigest = codewordDigest;
+                golden->pcmDigest = pcmDigest;
+                continue;
+            }
+            if (codewordDigest == golden->codewordDigest && pcmDigest == golden->pcmDigest
+                    && crossMismatch == NULL) {
+                continue;
+            }
+            uint64_t failures = __atomic_add_fetch(&corpus->failures, 1, __ATOMIC_RELAXED);
+            if (failures <= GOLDEN_MAX_REPORTS) {
+                fprintf(stderr, "Mismatch on line %zu (%s kernels): address %u, function %u, "
+                                "%zu characters at %u baud: %s differ\n",
+                        golden->line, corpus->kernels, golden->address, golden->functionCode,
+                        golden->numChars, golden->baudRate,
+                        codewordDigest != golden->codewordDigest ? "codewords"
+                        : pcmDigest != golden->pcmDigest ? "samples"
+                        : crossMismatch);
+            }
+        }
+    }
+}
+
+/**
+ * Digests every case of the corpus on numThreads threads.
+ */
+void goldenRun(GoldenCorpus* corpus, int numThreads) {
+    corpus->next = 0;
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t) * numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_create(&workers[t], NULL, goldenWorker, corpus);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+}
+
+/**
+ * Reads a corpus written by writeGoldenCorpus(). Lines hold the two
+ * digests, the baud rate, address and function code and the message in
+ * double quotes, where \\, \" and \xNN are escaped.
+ */
+int readGoldenCorpus(const char* path, GoldenCorpus* corpus) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+    memset(corpus, 0, sizeof(GoldenCorpus));
+
+    char line[GOLDEN_LINE_SIZE];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        GoldenCase golden;
+        memset(&golden, 0, sizeof(golden));
+        int textStart = 0;
+        int valid = sscanf(line, "%x %x %u %u %u \"%n", &golden.codewordDigest, &golden.pcmDigest,
+                           &golden.baudRate, &golden.address, &golden.functionCode,
+                           &textStart) == 5 && textStart > 0
+                 && golden.address <= MAX_ADDRESS && golden.functionCode < 4
+                 && (golden.baudRate == 512 || golden.baudRate == 1200 || golden.baudRate == 2400);
+        const char* p = line + textStart;
+        while (valid && *p != '"') {
+            unsigned int c;
+            if (*p == '\0' || *p == '\n' || golden.numChars == GOLDEN_MAX_CHARS) {
+                valid = 0;
+            } else if (*p != '\\') {
+                golden.text[golden.numChars++] = *p++;
+            } else if (p[1] == '\\' || p[1] == '"') {
+                golden.text[golden.numChars++] = p[1];
+                p += 2;
+            } else if (p[1] == 'x' && sscanf(p + 2, "%2x", &c) == 1) {
+                golden.text[golden.numChars++] = (char) c;
+                p += 4;
+            } else {
+                valid = 0;
+            }
+        }
+        if (!valid) {
+            fprintf(stderr, "%s:%zu: invalid case\n", path, lineNumber);
+            fclose(file);
+            free(corpus->cases);
+            return 1;
+        }
+        golden.line = lineNumber;
+        if (corpus->numCases == corpus->capacity) {
+            corpus->capacity = corpus->capacity == 0 ? 1024 : corpus->capacity * 2;
+            corpus->cases = (GoldenCase*) realloc(corpus->cases,
+                                                  sizeof(GoldenCase) * corpus->capacity);
+        }
+        corpus->cases[corpus->numCases++] = golden;
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Writes the generated corpus with the digests of this build, which is
+ * taken to be correct. Only for when the output is meant to change.
+ */
+int writeGoldenCorpus(const char* path, int numThreads) {
+    GoldenCorpus corpus;
+    goldenGenerate(&corpus);
+    corpus.generating = 1;
+    goldenRun(&corpus, numThreads);
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        free(corpus.cases);
+        return 1;
+    }
+    fprintf(file, "# Golden output of pocsag, checked by --golden. Written by --golden-generate;\n"
+                  "# regenerate only when the output is meant to change.\n"
+                  "# codewords_crc32c samples_crc32c baud address function \"message\"\n");
+    for (size_t c = 0; c < corpus.numCases; c++) {
+        const GoldenCase* golden = &corpus.cases[c];
+        fprintf(file, "%08x %08x %u %u %u \"", golden->codewordDigest, golden->pcmDigest,
+                golden->baudRate, golden->address, golden->functionCode);
+        for (size_t n = 0; n < golden->numChars; n++) {
+            unsigned char c = golden->text[n];
+            if (c == '\\' || c == '"') {
+                fprintf(file, "\\%c", c);
+            } else if (c < ' ' || c > '~') {
+                fprintf(file, "\\x%02x", c);
+            } else {
+                fputc(c, file);
+            }
+        }
+        fprintf(file, "\"\n");
+    }
+    int error = fclose(file) != 0;
+    if (error) {
+        perror(path);
+    }
+    printf("%zu cases\n", corpus.numCases);
+    free(corpus.cases);
+    return error;
+}
+
+/**
+ * Checks the output for every case of a corpus against its digests, with
+ * every combination of kernel variants, so a change to a kernel this host
+ * doesn't pick is caught too. Returns the exit code for main().
+ */
+int runGolden(const char* path, int numThreads) {
+    GoldenCorpus corpus;
+    if (readGoldenCorpus(path, &corpus) != 0) {
+        return 1;
+    }
+
+    size_t numCombinations = 0;
+    for (size_t k = 0; k < COUNT_OF(codewordKernels); k++) {
+        for (size_t p = 0; p < COUNT_OF(packingKernels); p++) {
+            for (size_t s = 0; s < COUNT_OF(pcmKernels); s++) {
+                Tuning tuning = { (int) k, (int) p, (int) s, 0, { 0 } };
+                applyTuning(&tuning);
+                //Those paths don't depend on the kernels, once is enough
+                corpus.crossChecks = numCombinations == 0;
+                snprintf(corpus.kernels, sizeof(corpus.kernels), "%s/%s/%s",
+                         codewordKernelNames[k], packingKernelNames[p], pcmKernelNames[s]);
+                goldenRun(&corpus, numThreads);
+                numCombinations++;
+            }
+        }
+    }
+    Tuning plain = { 0, 0, 0, 0, { 0 } };
+    applyTuning(&plain);
+
+    printf("%zu cases, %zu kernel combinations, %llu mismatches\n",
+           corpus.numCases, numCombinations, (unsigned long long) corpus.failures);
+    free(corpus.cases);
+    return corpus.failures == 0 ? 0 : 1;
+}
+
 // =========================================================
-// MAIN FUNKTION
+// MEHRKANAL-IQ (POLYPHASEN-SYNTHESE)
 // =========================================================
 
-int main() {
-    //Read in lines from STDIN.
-    //Lines are in the format of address:message OR address:function:message
-    char line[65536];
-    srand(time(NULL));
-    for (;;) {
+/**
+ * In-place inverse FFT (radix 2, without the 1/n) of n interleaved complex
+ * values. twiddles holds exp(2 pi i k / n) for k < n / 2.
+ */
+void fftInverse(const float* twiddles, uint32_t n, float* data) {
+    //Bit-reversed order
+    for (uint32_t i = 1, j = 0; i < n; i++) {
+        uint32_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float re = data[2 * i];
+            float im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
 
-        if (fgets(line, sizeof(line), stdin) == NULL) {
-            //Exit on EOF
-            return 0;
+    for (uint32_t size = 2; size <= n; size *= 2) {
+        uint32_t half = size / 2;
+        uint32_t stride = n / size;
+        for (uint32_t start = 0; start < n; start += size) {
+            for (uint32_t k = 0; k < half; k++) {
+                float wr = twiddles[2 * k * stride];
+                float wi = twiddles[2 * k * stride + 1];
+                float* a = data + 2 * (start + k);
+                float* b = data + 2 * (start + k + half);
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
         }
+    }
+}
 
-        // --- Bereinigung der Eingabe
-        size_t line_length = strlen(line);
-        if (line_length == 0) {
-            continue;
+/**
+ * Sets up a filter bank for numBins (a power of two) channels. The
+ * prototype filter is a Blackman-windowed sinc with its cutoff half a
+ * channel from the centre, scaled so each channel comes out at the
+ * amplitude it went in with. Returns non-zero if out of memory.
+ */
+int channelizerInit(Channelizer* channelizer, uint32_t spacing, uint32_t numBins) {
+    size_t length = (size_t) numBins * IQ_TAPS_PER_BRANCH;
+    channelizer->spacing = spacing;
+    channelizer->numBins = numBins;
+    channelizer->newest = 0;
+    channelizer->filter = (float*) malloc(sizeof(float) * 2 * length);
+    channelizer->history = (float*) calloc(2 * length, sizeof(float));
+    channelizer->twiddles = (float*) malloc(sizeof(float) * numBins);
+    double* prototype = (double*) malloc(sizeof(double) * length);
+    if (channelizer->filter == NULL || channelizer->history == NULL
+            || channelizer->twiddles == NULL || prototype == NULL) {
+        free(prototype);
+        channelizerFree(channelizer);
+        return 1;
+    }
+
+    double sum = 0;
+    double centre = (length - 1) / 2.0;
+    for (size_t n = 0; n < length; n++) {
+        double x = (n - centre) / numBins;
+        double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1))
+                      + 0.08 * cos(4 * M_PI * n / (length - 1));
+        prototype[n] = sinc * window;
+        sum += prototype[n];
+    }
+    //Branch p takes taps p, p + numBins, p + 2 * numBins, ...
+    for (size_t n = 0; n < length; n++) {
+        float tap = (float) (prototype[n] * numBins / sum);
+        channelizer->filter[2 * n] = tap;
+        channelizer->filter[2 * n + 1] = tap;
+    }
+    free(prototype);
+
+    for (uint32_t k = 0; k < numBins / 2; k++) {
+        channelizer->twiddles[2 * k] = (float) cos(2 * M_PI * k / numBins);
+        channelizer->twiddles[2 * k + 1] = (float) sin(2 * M_PI * k / numBins);
+    }
+    return 0;
+}
+
+/**
+ * Takes one sample of every channel (bins, numBins interleaved complex
+ * values, bin k at k * spacing, the upper half being negative offsets) and
+ * produces the next numBins output samples.
+ */
+void channelizerStep(Channelizer* channelizer, const float* bins, float* out) {
+    size_t width = 2 * (size_t) channelizer->numBins;
+    channelizer->newest = (channelizer->newest + 1) % IQ_TAPS_PER_BRANCH;
+    float* row = channelizer->history + channelizer->newest * width;
+    memcpy(row, bins, sizeof(float) * width);
+    fftInverse(channelizer->twiddles, channelizer->numBins, row);
+
+    memset(out, 0, sizeof(float) * width);
+    for (size_t l = 0; l < IQ_TAPS_PER_BRANCH; l++) {
+        size_t age = (channelizer->newest + IQ_TAPS_PER_BRANCH - l) % IQ_TAPS_PER_BRANCH;
+        const float* taps = channelizer->filter + l * width;
+        const float* past = channelizer->history + age * width;
+        for (size_t i = 0; i < width; i++) {
+            out[i] += taps[i] * past[i];
         }
+    }
+}
+
+void channelizerFree(Channelizer* channelizer) {
+    free(channelizer->filter);
+    free(channelizer->history);
+    free(channelizer->twiddles);
+    memset(channelizer, 0, sizeof(Channelizer));
+}
+
+/**
+ * Appends a record to a carrier's timeline, followed by its delay.
+ */
+void carrierConsumer(void* context, const Record* record) {
+    CarrierLoad* load = (CarrierLoad*) context;
+    size_t length = messageLength(record->address, record->length, record->functionCode,
+                                  load->config->preambleLength);
+    uint32_t* transmission = (uint32_t*) malloc(sizeof(uint32_t) * length);
+    if (transmission == NULL
+            || encodeTransmission(record->address, record->message, record->length, transmission,
+                                  record->functionCode, load->config->preambleLength) != 0) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", record->address);
+        free(transmission);
+        return;
+    }
+    if (pcmRendererAddTransmission(load->timeline, transmission, length) != 0) {
+        fprintf(stderr, "Out of memory, dropping message for address %u\n", record->address);
+        free(transmission);
+        return;
+    }
+    free(transmission);
+
+    if (pcmRendererAddSilence(load->timeline,
+            delaySamples(load->transmitter, load->config, record->position,
+                         load->timeline->sampleRate)) != 0) {
+        fprintf(stderr, "Out of memory, no delay after the message for address %u\n",
+                record->address);
+    }
+}
+
+/**
+ * Encodes the message file of every carrier and writes them as one complex
+ * baseband stream: interleaved 16 bit little-endian I and Q samples at
+ * numBins * spacing, where numBins is the smallest power of two which has
+ * room for every carrier. Each carrier's offset must be a multiple of the
+ * spacing. A carrier is FSK modulated at +-IQ_DEVIATION and off between its
+ * messages. The timelines only hold codewords, and the output is
+ * synthesised IQ_BLOCK channel samples at a time. Returns the exit code
+ * for main().
+ */
+int runMultiCarrier(
+        Transmitter* transmitter,
+        Carrier* carriers,
+        size_t numCarriers,
+        uint32_t spacing,
+        int inputFormat,
+        int numThreads) {
+
+    Config config;
+    if (transmitter->config != NULL) {
+        config = *configAcquire(transmitter->config);
+        configRelease(transmitter->config);
+    } else {
+        defaultConfig(&config);
+    }
+
+    int32_t widest = 0;
+    for (size_t c = 0; c < numCarriers; c++) {
+        double bin = carriers[c].offset / spacing;
+        if (bin != (int32_t) bin || fabs(bin) > IQ_MAX_CARRIERS) {
+            fprintf(stderr, "Carrier offset %g Hz is not a multiple of the %u Hz channel "
+                            "spacing within %d channels\n",
+                    carriers[c].offset, spacing, IQ_MAX_CARRIERS);
+            return 1;
+        }
+        carriers[c].bin = (int32_t) bin;
+        for (size_t other = 0; other < c; other++) {
+            if (carriers[other].bin == carriers[c].bin) {
+                fprintf(stderr, "Two carriers at %g Hz\n", carriers[c].offset);
+                return 1;
+            }
+        }
+        if (abs(carriers[c].bin) > widest) {
+            widest = abs(carriers[c].bin);
+        }
+    }
+    uint32_t numBins = 2;
+    while (numBins / 2 <= (uint32_t) widest) {
+        numBins *= 2;
+    }
+    if ((uint64_t) numBins * spacing > INT32_MAX) {
+        fprintf(stderr, "Output rate of %llu samples/s is too high\n",
+                (unsigned long long) numBins * spacing);
+        return 1;
+    }
 
-        if (line[line_length - 1] == '\n') {
-            line_length--;
-            line[line_length] = 0;
+    // --- Alle Kanäle kodieren, nur die Codewörter bleiben im Speicher
+    uint64_t longest = 0;
+    for (size_t c = 0; c < numCarriers; c++) {
+        pcmRendererInit(&carriers[c].timeline, spacing, BAUD_RATE);
+        carriers[c].timeline.level = 1;
+        carriers[c].phaseRe = 1;
+        carriers[c].phaseIm = 0;
+        CarrierLoad load = { transmitter, &config, &carriers[c].timeline };
+        if (readMappedFile(carriers[c].path, inputFormat, numThreads, 0, 1,
+                           carrierConsumer, NULL, &load) != 0) {
+            return 1;
         }
-        if (line[line_length - 1] == '\r') {
-            line_length--;
-            line[line_length] = 0;
+        if (carriers[c].timeline.totalSamples > longest) {
+            longest = carriers[c].timeline.totalSamples;
         }
+    }
 
-        // --- Parsing
-        size_t colonIndex1 = 0;
-        size_t colonIndex2 = 0;
-        uint32_t colonCount = 0;
-        
-        for (size_t i = 0; i < line_length; i++) {
-            if (line[i] == ':') {
-                colonCount++;
-                if (colonCount == 1) {
-                    colonIndex1 = i;
-                } else if (colonCount == 2) {
-                    colonIndex2 = i;
-                    break; 
+    Channelizer channelizer;
+    if (channelizerInit(&channelizer, spacing, numBins) != 0) {
+        fprintf(stderr, "Out of memory for the filter bank\n");
+        for (size_t c = 0; c < numCarriers; c++) {
+            pcmRendererFree(&carriers[c].timeline);
+        }
+        return 1;
+    }
+    fprintf(stderr, "Writing IQ at %u samples/s, %u channels of %u Hz\n",
+            numBins * spacing, numBins, spacing);
+
+    //FSK: turn the phase by +-deviation / spacing of a cycle per sample
+    float turnRe = (float) cos(2 * M_PI * IQ_DEVIATION / spacing);
+    float turnIm = (float) sin(2 * M_PI * IQ_DEVIATION / spacing);
+    float scale = (float) config.level / numCarriers;
+
+    int16_t* symbols = (int16_t*) malloc(sizeof(int16_t) * IQ_BLOCK * numCarriers);
+    float* bins = (float*) malloc(sizeof(float) * 2 * numBins);
+    float* samples = (float*) malloc(sizeof(float) * 2 * numBins);
+    uint8_t* pcm = (uint8_t*) malloc((size_t) IQ_BLOCK * numBins * 4);
+    if (symbols == NULL || bins == NULL || samples == NULL || pcm == NULL) {
+        fprintf(stderr, "Out of memory for the IQ buffers\n");
+        free(symbols);
+        free(bins);
+        free(samples);
+        free(pcm);
+        channelizerFree(&channelizer);
+        for (size_t c = 0; c < numCarriers; c++) {
+            pcmRendererFree(&carriers[c].timeline);
+        }
+        return 1;
+    }
+
+    //Run on until the filter has let out the end of the longest channel
+    uint64_t numSteps = longest + IQ_TAPS_PER_BRANCH;
+    for (uint64_t first = 0; first < numSteps; first += IQ_BLOCK) {
+        size_t count = numSteps - first < IQ_BLOCK ? numSteps - first : IQ_BLOCK;
+        for (size_t c = 0; c < numCarriers; c++) {
+            int16_t* row = symbols + c * IQ_BLOCK;
+            size_t rendered = pcmRendererRead(&carriers[c].timeline, first, count, row);
+            memset(row + rendered, 0, sizeof(int16_t) * (count - rendered));
+        }
+
+        uint8_t* out = pcm;
+        for (size_t k = 0; k < count; k++) {
+            memset(bins, 0, sizeof(float) * 2 * numBins);
+            for (size_t c = 0; c < numCarriers; c++) {
+                Carrier* carrier = &carriers[c];
+                int16_t symbol = symbols[c * IQ_BLOCK + k];
+                if (symbol == 0) {
+                    continue;
                 }
+                float re = carrier->phaseRe * turnRe - symbol * carrier->phaseIm * turnIm;
+                float im = carrier->phaseIm * turnRe + symbol * carrier->phaseRe * turnIm;
+                carrier->phaseRe = re;
+                carrier->phaseIm = im;
+                uint32_t bin = carrier->bin < 0 ? carrier->bin + numBins : (uint32_t) carrier->bin;
+                bins[2 * bin] = re;
+                bins[2 * bin + 1] = im;
+            }
+
+            channelizerStep(&channelizer, bins, samples);
+
+            //Write little-endian I, Q pairs
+            for (size_t i = 0; i < 2 * numBins; i++) {
+                float value = samples[i] * scale;
+                int16_t sample = value > 32767 ? 32767
+                               : value < -32768 ? -32768 : (int16_t) lrintf(value);
+                *out++ = sample & 0xFF;
+                *out++ = (sample >> 8) & 0xFF;
             }
         }
 
-        if (colonCount == 0) {
-            fprintf(stderr, "Malformed Line: Missing colon separator(s)!\n");
-            return 1;
+        //Keep the oscillators from drifting off the unit circle
+        for (size_t c = 0; c < numCarriers; c++) {
+            Carrier* carrier = &carriers[c];
+            float magnitude = sqrtf(carrier->phaseRe * carrier->phaseRe
+                                    + carrier->phaseIm * carrier->phaseIm);
+            carrier->phaseRe /= magnitude;
+            carrier->phaseIm /= magnitude;
+        }
+
+        emitSamples(transmitter, pcm, out - pcm);
+        if (ferror(transmitter->out)) {
+            break;
         }
+    }
+    fflush(transmitter->out);
 
-        uint32_t address = 0;
-        FunctionCode functionCode = FLAG_FUNC_3;
-        char* message = NULL;
+    free(symbols);
+    free(bins);
+    free(samples);
+    free(pcm);
+    channelizerFree(&channelizer);
+    for (size_t c = 0; c < numCarriers; c++) {
+        pcmRendererFree(&carriers[c].timeline);
+    }
+    return 0;
+}
+
+
+// =========================================================
+// BAKE UND TESTMUSTER
+// =========================================================
+
+/**
+ * Renders a page or a test pattern once, followed by the gap, and streams
+ * the same buffer to the output `repeat` times (0 = until the reader goes
+ * away). Nothing is encoded after the first round, each further round is a
+ * single write of a page-aligned buffer, so a reloaded config only takes
+ * effect on the next start. Returns the exit code for main().
+ */
+int runBeacon(
+        Transmitter* transmitter,
+        int pattern,
+        int inputFormat,
+        double gapSeconds,
+        uint64_t repeat) {
+
+    size_t transmissionLength = PATTERN_WORDS;
+    uint32_t* transmission;
+
+    Config config;
+    if (transmitter->config != NULL) {
+        config = *configAcquire(transmitter->config);
+        configRelease(transmitter->config);
+    } else {
+        defaultConfig(&config);
+    }
 
-        // Fall 1: ADRESSE:NACHRICHT (Ein Doppelpunkt)
-        if (colonCount == 1) {
-            address = (uint32_t) strtol(line, NULL, 10);
-            message = line + colonIndex1 + 1;
-            functionCode = FLAG_FUNC_3; // Standard: Alpha (3)
-            
-        // Fall 2: ADRESSE:FUNKTION:NACHRICHT (Zwei Doppelpunkte)
-        } else if (colonCount == 2) {
-            // Adresse parsen
-            line[colonIndex1] = 0; 
-            address = (uint32_t) strtol(line, NULL, 10);
-            line[colonIndex1] = ':'; 
+    if (pattern == BEACON_PAGE) {
+        char line[65536];
+        char text[65536];
+        Record record;
+        int error = PARSE_IGNORED;
 
-            // Funktion parsen
-            line[colonIndex2] = 0; 
-            char* funcStr = line + colonIndex1 + 1;
-            uint32_t funcNum = (uint32_t) strtol(funcStr, NULL, 10);
-            line[colonIndex2] = ':'; 
-            
-            if (funcNum > 3) {
-                 fprintf(stderr, "Invalid Function: %u. Must be between 0 and 3.\n", funcNum);
-                 return 1;
+        while (error == PARSE_IGNORED && fgets(line, sizeof(line), stdin) != NULL) {
+            size_t length = strcspn(line, "\r\n");
+            error = parseRecord(inputFormat, line, length, text, &record);
+        }
+        if (error == PARSE_IGNORED) {
+            fprintf(stderr, "No message to send as beacon\n");
+            return 1;
+        }
+        if (error != PARSE_OK) {
+            printParseError(&record);
+            return 1;
+        }
+        transmissionLength = messageLength(record.address, record.length,
+                                           record.functionCode, config.preambleLength);
+        transmission = (uint32_t*) malloc(sizeof(uint32_t) * transmissionLength);
+        if (transmission == NULL
+                || encodeTransmission(record.address, record.message, record.length,
+                                      transmission, record.functionCode,
+                                      config.preambleLength) != 0) {
+            fprintf(stderr, "Out of memory for beacon buffer\n");
+            free(transmission);
+            return 1;
+        }
+    } else {
+        transmission = (uint32_t*) malloc(sizeof(uint32_t) * transmissionLength);
+        if (transmission == NULL) {
+            fprintf(stderr, "Out of memory for beacon buffer\n");
+            return 1;
+        }
+        for (size_t i = 0; i < transmissionLength; i++) {
+            if (pattern == BEACON_PREAMBLE) {
+                transmission[i] = 0xAAAAAAAA;
+            } else {
+                transmission[i] = i % 2 == 0 ? SYNC : IDLE;
             }
-            functionCode = funcNum;
+        }
+    }
+
+    size_t pcmLength = pcmTransmissionLength(transmitter->sampleRate, BAUD_RATE, transmissionLength);
+    size_t gapLength = (size_t) (gapSeconds * transmitter->sampleRate) * 2;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t bufferSize = (pcmLength + gapLength + pageSize - 1) / pageSize * pageSize;
+
+    void* memory = NULL;
+    if (posix_memalign(&memory, pageSize, bufferSize) != 0) {
+        fprintf(stderr, "Out of memory for beacon buffer\n");
+        free(transmission);
+        return 1;
+    }
+    uint8_t* buffer = (uint8_t*) memory;
+    pcmEncodeTransmission(transmitter->sampleRate, BAUD_RATE, transmission, transmissionLength,
+                          config.level, buffer);
+    memset(buffer + pcmLength, 0, bufferSize - pcmLength);
+    free(transmission);
+
+    for (uint64_t round = 0; repeat == 0 || round < repeat; round++) {
+        emitSamples(transmitter, buffer, pcmLength + gapLength);
+        if (ferror(transmitter->out)) {
+            break;
+        }
+    }
 
-            // Nachricht parsen
-            message = line + colonIndex2 + 1;
+    free(buffer);
+    return 0;
+}
+
+
+// =========================================================
+// MAIN FUNKTION
+// =========================================================
+
+/**
+ * Prints the command line options.
+ */
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options] < messages\n"
+        "  --input FILE             read messages from FILE instead of stdin,\n"
+        "                           parsing it on several threads\n"
+        "  --threads N              number of parser threads for --input\n"
+        "  --input-format native|multimon\n"
+        "                           address:message lines (default), or pages\n"
+        "                           as logged by multimon-ng\n"
+        "  --beacon page|preamble|sync-idle\n"
+        "                           send the first message on stdin, or a test\n"
+        "                           pattern, over and over without re-encoding\n"
+        "  --gap SECONDS            silence after each beacon round\n"
+        "  --repeat N               stop the beacon after N rounds (default: never)\n"
+        "  --output FILE            write samples to FILE instead of stdout\n"
+        "  --sample-rate HZ         output sample rate (default: %d); multiples of\n"
+        "                           the baud rate are rendered without resampling\n"
+        "  --seed N                 make the delays between messages repeatable\n"
+        "  --shard K/N              with --input, --output and --seed: encode\n"
+        "                           only the K-th of N slices of the input and\n"
+        "                           write OUTPUT" MANIFEST_SUFFIX " for --merge\n"
+        "  --merge OUTPUT SEGMENT...\n"
+        "                           join the outputs of all shards of a job\n"
+        "  --index FILE             write the sample offset, length and CRC32C\n"
+        "                           of every transmission to FILE\n"
+        "  --verify INDEX DUMP      check a PCM dump against its index\n"
+        "  --recorder FILE MINUTES  also keep the last MINUTES of output in FILE,\n"
+        "                           a memory-mapped ring with an index\n"
+        "  --extract FILE MINUTES OUTPUT\n"
+        "                           copy the last MINUTES of a recorder to OUTPUT\n"
+        "                           and print their index\n"
+        "  --analyse                with --input: report the load of every frame\n"
+        "                           and suggest capcodes which balance it\n"
+        "  --sweep                  encode and decode every address and message\n"
+        "                           length on --threads threads, report mismatches\n"
+        "  --golden CORPUS          check the output for every page of CORPUS\n"
+        "                           against its digests, with every kernel variant\n"
+        "  --golden-generate CORPUS write the built-in corpus with the digests of\n"
+        "                           this build\n"
+        "  --dedup-window SECONDS   drop repeats of the same page within SECONDS\n"
+        "  --rate-limit COUNT/SECONDS\n"
+        "                           allow each address a burst of COUNT pages,\n"
+        "                           refilled over SECONDS\n"
+        "  --capabilities TABLE     send to pagers which take 1200 or 2400 baud\n"
+        "                           at that rate, grouped, when messages queue up\n"
+        "  --queue-threshold N      queue depth from which to do so (default: %d)\n"
+        "  --set-capability TABLE ADDRESS BAUD\n"
+        "                           record the fastest rate of a pager\n"
+        "  --carrier OFFSET FILE    send the messages in FILE on a carrier OFFSET Hz\n"
+        "                           from the centre; repeat for more channels, all\n"
+        "                           written as one interleaved S16LE IQ stream\n"
+        "  --channel-spacing HZ     carrier raster for --carrier (default: %d)\n"
+        "  --control SOCKET         queue messages from stdin and take cancel ID,\n"
+        "                           status ID and priority ID LEVEL commands on\n"
+        "                           the Unix socket SOCKET; lines may start with\n"
+        "                           @ID and a space\n"
+        "  --listen ADDRESS         take messages from any number of clients on the\n"
+        "                           Unix socket or [HOST:]PORT ADDRESS, one per line,\n"
+        "                           and answer every line with ok, ignored or error\n"
+        "  --listen-bench ADDRESS CLIENTS PAGES\n"
+        "                           connect CLIENTS clients to --listen and have\n"
+        "                           each send PAGES pages, report pages/s and latency\n"
+        "  --capture FILE           log every message from stdin with its arrival\n"
+        "                           time to FILE\n"
+        "  --replay FILE            send the messages of a capture instead of stdin,\n"
+        "                           with their original timing\n"
+        "  --speed FACTOR|max       replay FACTOR times as fast, or without waiting\n"
+        "  --stats                  report the kernels in use and, at the end, the\n"
+        "                           messages and samples sent\n"
+        "  --tune                   time the kernel variants and use the fastest\n"
+        "  --tune-cache FILE        keep that choice in FILE for later runs\n"
+        "  --retune                 time them again instead of using FILE\n"
+        "  --slots SCHEDULE SITE    send only in the slots of SITE in SCHEDULE, a file\n"
+        "                           or the socket of --serve-slots, and silence\n"
+        "                           in between, paced by the clock\n"
+        "  --serve-slots SOCKET SCHEDULE\n"
+        "                           hand out SCHEDULE to the sites on a Unix socket\n"
+        "  --status FILE            write samples sent, time of the last write, queue\n"
+        "                           depth and whether output is stalled to FILE,\n"
+        "                           every second\n"
+        "  --stall-timeout SECONDS  when output counts as stalled (default: %d)\n"
+        "  --soak HOURS             encode HOURS of generated traffic as fast as\n"
+        "                           possible, report memory use and time per message\n"
+        "                           along the way and fail on upward trends\n"
+        "  --config FILE            read delays, preamble length and level from\n"
+        "                           FILE, and read it again on SIGHUP\n",
+        name, SAMPLE_RATE, SCHEDULER_THRESHOLD, IQ_CHANNEL_SPACING, STATUS_STALL_TIMEOUT);
+}
+
+// Ohne main(), wenn pocsag.c in eine Bibliothek eingebunden wird (siehe python/)
+#ifndef POCSAG_LIBRARY
+int main(int argc, char** argv) {
+    Transmitter transmitter;
+    memset(&transmitter, 0, sizeof(transmitter));
+    transmitter.out = stdout;
+    transmitter.sampleRate = SAMPLE_RATE;
+    const char* inputPath = NULL;
+    const char* outputPath = NULL;
+    const char* indexPath = NULL;
+    int shard = 0;
+    int numShards = 1;
+    int beacon = -1;
+    double beaconGap = 0;
+    uint64_t beaconRepeat = 0;
+    int inputFormat = INPUT_NATIVE;
+    int sweep = 0;
+    const char* goldenPath = NULL;
+    int goldenGenerating = 0;
+    long queueThreshold = 0;
+    int analyse = 0;
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    Carrier carriers[IQ_MAX_CARRIERS];
+    size_t numCarriers = 0;
+    long channelSpacing = IQ_CHANNEL_SPACING;
+    const char* controlPath = NULL;
+    const char* listenOn = NULL;
+    const char* recorderPath = NULL;
+    double recorderMinutes = 0;
+    Recorder recorder;
+    InputSource source;
+    Capture capture;
+    Replay replay;
+    const char* capturePath = NULL;
+    const char* replayPath = NULL;
+    double replaySpeed = 1;
+    SlotSchedule slots;
+    const char* statusPath = NULL;
+    double soakHours = 0;
+    double stallTimeout = STATUS_STALL_TIMEOUT;
+    int tune = 0;
+    int retune = 0;
+    char* tuneCache = NULL;
+    Tuning tuning;
+    memset(&tuning, 0, sizeof(Tuning));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = strtol(argv[++i], NULL, 10);
+            if (numThreads <= 0) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--input-format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "native") == 0) {
+                inputFormat = INPUT_NATIVE;
+            } else if (strcmp(argv[i], "multimon") == 0) {
+                inputFormat = INPUT_MULTIMON;
+            } else {
+                fprintf(stderr, "Unknown input format: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--beacon") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "page") == 0) {
+                beacon = BEACON_PAGE;
+            } else if (strcmp(argv[i], "preamble") == 0) {
+                beacon = BEACON_PREAMBLE;
+            } else if (strcmp(argv[i], "sync-idle") == 0) {
+                beacon = BEACON_SYNC_IDLE;
+            } else {
+                fprintf(stderr, "Unknown beacon pattern: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gap") == 0 && i + 1 < argc) {
+            beaconGap = strtod(argv[++i], NULL);
+            if (beaconGap < 0) {
+                fprintf(stderr, "Invalid gap: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            beaconRepeat = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            unsigned long sampleRate = strtoul(argv[++i], NULL, 10);
+            if (sampleRate < SAMPLE_RATE_MIN || sampleRate > SAMPLE_RATE_MAX) {
+                fprintf(stderr, "Invalid sample rate: %s. Expected %d to %d Hz.\n",
+                        argv[i], SAMPLE_RATE_MIN, SAMPLE_RATE_MAX);
+                return 1;
+            }
+            transmitter.sampleRate = (uint32_t) sampleRate;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            transmitter.seeded = 1;
+            transmitter.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d/%d", &shard, &numShards) != 2
+                    || numShards < 1 || shard < 0 || shard >= numShards) {
+                fprintf(stderr, "Invalid shard: %s. Expected K/N with 0 <= K < N.\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 2 < argc) {
+            return mergeShards(argv[i + 1], argv + i + 2, argc - i - 2);
+        } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            indexPath = argv[++i];
+        } else if (strcmp(argv[i], "--verify") == 0 && i + 2 < argc) {
+            return verifyDump(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--recorder") == 0 && i + 2 < argc) {
+            recorderPath = argv[i + 1];
+            recorderMinutes = strtod(argv[i + 2], NULL);
+            if (!(recorderMinutes > 0 && recorderMinutes <= RECORDER_MAX_MINUTES)) {
+                fprintf(stderr, "Invalid duration: %s\n", argv[i + 2]);
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--extract") == 0 && i + 3 < argc) {
+            double minutes = strtod(argv[i + 2], NULL);
+            if (minutes <= 0) {
+                fprintf(stderr, "Invalid duration: %s\n", argv[i + 2]);
+                return 1;
+            }
+            return extractRecorder(argv[i + 1], minutes, argv[i + 3]);
+        } else if (strcmp(argv[i], "--sweep") == 0) {
+            sweep = 1;
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenPath = argv[++i];
+        } else if (strcmp(argv[i], "--golden-generate") == 0 && i + 1 < argc) {
+            goldenPath = argv[++i];
+            goldenGenerating = 1;
+        } else if (strcmp(argv[i], "--analyse") == 0) {
+            analyse = 1;
+        } else if (strcmp(argv[i], "--dedup-window") == 0 && i + 1 < argc) {
+            double window = strtod(argv[++i], NULL);
+            if (window <= 0) {
+                fprintf(stderr, "Invalid dedup window: %s\n", argv[i]);
+                return 1;
+            }
+            transmitter.dedup = (DedupFilter*) calloc(1, sizeof(DedupFilter));
+            if (transmitter.dedup == NULL) {
+                fprintf(stderr, "Out of memory for the dedup filter\n");
+                return 1;
+            }
+            transmitter.dedup->windowMs = (uint64_t) (window * 1000);
+        } else if (strcmp(argv[i], "--rate-limit") == 0 && i + 1 < argc) {
+            char* slash;
+            long burst = strtol(argv[++i], &slash, 10);
+            double period = *slash == '/' ? strtod(slash + 1, NULL) : 0;
+            //The refill divides by the period in milliseconds
+            if (burst <= 0 || period < 0.001) {
+                fprintf(stderr, "Invalid rate limit: %s. Expected COUNT/SECONDS, "
+                                "with at least a millisecond.\n", argv[i]);
+                return 1;
+            }
+            transmitter.rateLimiter = (RateLimiter*) calloc(1, sizeof(RateLimiter));
+            if (transmitter.rateLimiter == NULL) {
+                fprintf(stderr, "Out of memory for the rate limiter\n");
+                return 1;
+            }
+            transmitter.rateLimiter->burst = burst;
+            transmitter.rateLimiter->periodMs = (uint64_t) (period * 1000);
+        } else if (strcmp(argv[i], "--capabilities") == 0 && i + 1 < argc) {
+            if (transmitter.scheduler == NULL) {
+                transmitter.scheduler = (Scheduler*) calloc(1, sizeof(Scheduler));
+                if (transmitter.scheduler == NULL) {
+                    fprintf(stderr, "Out of memory for the scheduler\n");
+                    return 1;
+                }
+                transmitter.scheduler->threshold = SCHEDULER_THRESHOLD;
+            }
+            if (loadCapabilities(argv[++i], transmitter.scheduler) != 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--queue-threshold") == 0 && i + 1 < argc) {
+            queueThreshold = strtol(argv[++i], NULL, 10);
+            if (queueThreshold <= 0) {
+                fprintf(stderr, "Invalid queue threshold: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--set-capability") == 0 && i + 3 < argc) {
+            return setCapability(argv[i + 1], parseAddress(argv[i + 2]),
+                                 strtoul(argv[i + 3], NULL, 10));
+        } else if (strcmp(argv[i], "--carrier") == 0 && i + 2 < argc) {
+            if (numCarriers == IQ_MAX_CARRIERS) {
+                fprintf(stderr, "Too many carriers, at most %d\n", IQ_MAX_CARRIERS);
+                return 1;
+            }
+            memset(&carriers[numCarriers], 0, sizeof(Carrier));
+            carriers[numCarriers].offset = strtod(argv[i + 1], NULL);
+            carriers[numCarriers].path = argv[i + 2];
+            numCarriers++;
+            i += 2;
+        } else if (strcmp(argv[i], "--channel-spacing") == 0 && i + 1 < argc) {
+            channelSpacing = strtol(argv[++i], NULL, 10);
+            if (channelSpacing <= 2 * (IQ_DEVIATION + BAUD_RATE) || channelSpacing > SYMRATE * 8) {
+                fprintf(stderr, "Invalid channel spacing: %s. Must be wider than %d Hz "
+                                "and at most %d Hz.\n",
+                        argv[i], 2 * (IQ_DEVIATION + BAUD_RATE), SYMRATE * 8);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--slots") == 0 && i + 2 < argc) {
+            if (openSlotSchedule(argv[i + 1], argv[i + 2], &slots) != 0) {
+                return 1;
+            }
+            transmitter.slots = &slots;
+            i += 2;
+        } else if (strcmp(argv[i], "--serve-slots") == 0 && i + 2 < argc) {
+            return serveSlotSchedule(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            soakHours = strtod(argv[++i], NULL);
+            if (soakHours <= 0) {
+                fprintf(stderr, "Invalid soak duration: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--status") == 0 && i + 1 < argc) {
+            statusPath = argv[++i];
+        } else if (strcmp(argv[i], "--stall-timeout") == 0 && i + 1 < argc) {
+            stallTimeout = strtod(argv[++i], NULL);
+            if (stallTimeout <= 0) {
+                fprintf(stderr, "Invalid stall timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+            controlPath = argv[++i];
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listenOn = argv[++i];
+        } else if (strcmp(argv[i], "--listen-bench") == 0 && i + 3 < argc) {
+            long numClients = strtol(argv[i + 2], NULL, 10);
+            long numPages = strtol(argv[i + 3], NULL, 10);
+            if (numClients <= 0 || numPages < 0) {
+                fprintf(stderr, "Invalid number of clients or pages: %s %s\n",
+                        argv[i + 2], argv[i + 3]);
+                return 1;
+            }
+            return runListenBench(argv[i + 1], numClients, numPages);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            i++;
+            replaySpeed = strcmp(argv[i], "max") == 0 ? 0 : strtod(argv[i], NULL);
+            if (replaySpeed <= 0 && strcmp(argv[i], "max") != 0) {
+                fprintf(stderr, "Invalid replay speed: %s. Expected a factor or max.\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            transmitter.stats = 1;
+        } else if (strcmp(argv[i], "--tune") == 0) {
+            tune = 1;
+        } else if (strcmp(argv[i], "--retune") == 0) {
+            tune = retune = 1;
+        } else if (strcmp(argv[i], "--tune-cache") == 0 && i + 1 < argc) {
+            tune = 1;
+            tuneCache = strdup(argv[++i]);
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            LiveConfig* live = (LiveConfig*) calloc(1, sizeof(LiveConfig));
+            Config* active = (Config*) malloc(sizeof(Config));
+            if (live == NULL || active == NULL) {
+                fprintf(stderr, "Out of memory for the configuration\n");
+                return 1;
+            }
+            live->path = argv[++i];
+            live->active = active;
+            if (loadConfig(live->path, live->active) != 0) {
+                return 1;
+            }
+            transmitter.config = live;
         } else {
-             fprintf(stderr, "Malformed Line: Too many colons! Expected ADDR:MSG or ADDR:FUNC:MSG.\n");
-             return 1;
+            usage(argv[0]);
+            return 1;
         }
+    }
 
-        // Adressprüfung
-        if (address > 2097151) {
-            fprintf(stderr, "Address exceeds 21 bits: %u\n", address);
+    if (sweep) {
+        return runSweep(numThreads > 0 ? numThreads : 1);
+    }
+    if (goldenPath != NULL) {
+        if (goldenGenerating) {
+            return writeGoldenCorpus(goldenPath, numThreads > 0 ? numThreads : 1);
+        }
+        return runGolden(goldenPath, numThreads > 0 ? numThreads : 1);
+    }
+    if (analyse) {
+        //Two passes over the log, so it has to be a file
+        if (inputPath == NULL) {
+            fprintf(stderr, "--analyse needs --input\n");
+            return 1;
+        }
+        return runAnalysis(inputPath, inputFormat, numThreads > 0 ? numThreads : 1);
+    }
+    if (queueThreshold > 0) {
+        if (transmitter.scheduler == NULL) {
+            fprintf(stderr, "--queue-threshold needs --capabilities\n");
+            return 1;
+        }
+        transmitter.scheduler->threshold = queueThreshold;
+    }
+    if (numCarriers > 0 && (inputPath != NULL || indexPath != NULL || beacon >= 0
+                            || numShards > 1 || transmitter.dedup != NULL
+                            || transmitter.rateLimiter != NULL
+                            || transmitter.scheduler != NULL
+                            || transmitter.sampleRate != SAMPLE_RATE)) {
+        fprintf(stderr, "--carrier can't be combined with --input, --index, --beacon, "
+                        "--shard, --capabilities, --sample-rate or the filters\n");
+        return 1;
+    }
+    if (controlPath != NULL && (inputPath != NULL || beacon >= 0 || numCarriers > 0
+                                || numShards > 1)) {
+        fprintf(stderr, "--control queues messages from stdin, so it can't be combined "
+                        "with --input, --beacon, --carrier or --shard\n");
+        return 1;
+    }
+    if ((capturePath != NULL || replayPath != NULL)
+            && (inputPath != NULL || beacon >= 0 || numCarriers > 0 || numShards > 1)) {
+        fprintf(stderr, "--capture and --replay work on the messages from stdin, so they "
+                        "can't be combined with --input, --beacon, --carrier or --shard\n");
+        return 1;
+    }
+    if (transmitter.slots != NULL && (inputPath != NULL || beacon >= 0 || numCarriers > 0
+                                      || numShards > 1 || controlPath != NULL
+                                      || transmitter.scheduler != NULL)) {
+        fprintf(stderr, "--slots sends the messages from stdin in its own time, so it can't "
+                        "be combined with --input, --beacon, --carrier, --shard, --control "
+                        "or --capabilities\n");
+        return 1;
+    }
+    if (soakHours > 0 && (inputPath != NULL || beacon >= 0 || numCarriers > 0 || numShards > 1
+                          || controlPath != NULL || transmitter.slots != NULL
+                          || capturePath != NULL || replayPath != NULL)) {
+        fprintf(stderr, "--soak makes up its own messages, so it can't be combined with "
+                        "--input, --beacon, --carrier, --shard, --control, --slots, "
+                        "--capture or --replay\n");
+        return 1;
+    }
+    if (listenOn != NULL && (inputPath != NULL || beacon >= 0 || numCarriers > 0 || numShards > 1
+                             || controlPath != NULL || transmitter.slots != NULL
+                             || capturePath != NULL || replayPath != NULL || soakHours > 0)) {
+        fprintf(stderr, "--listen takes its messages from the socket, so it can't be combined "
+                        "with --input, --beacon, --carrier, --shard, --control, --slots, "
+                        "--capture, --replay or --soak\n");
+        return 1;
+    }
+    if (recorderPath != NULL && (numCarriers > 0 || numShards > 1)) {
+        fprintf(stderr, "--recorder can't be combined with --carrier or --shard\n");
+        return 1;
+    }
+    if (numShards > 1) {
+        //Anything depending on arrival time would make shards differ from a
+        //single run
+        if (inputPath == NULL || outputPath == NULL || !transmitter.seeded
+                || indexPath != NULL || beacon >= 0
+                || transmitter.dedup != NULL || transmitter.rateLimiter != NULL
+                || transmitter.scheduler != NULL) {
+            fprintf(stderr, "--shard needs --input, --output and --seed, and can't be "
+                            "combined with --index, --beacon, --capabilities or the filters\n");
             return 1;
         }
+    }
 
-        // --- Kodierung und Ausgabe
-        // Korrektur: Variable umbenannt, um Kollision zu vermeiden
-        size_t requiredMessageLength = messageLength(address, strlen(message), functionCode);
+    //Everything from here on encodes
+    if (tune) {
+        autotune(tuneCache, retune, &tuning);
+    }
+    if (transmitter.stats) {
+        printTuning(&tuning, tuneCache);
+        uint32_t samplesPerBit = pcmSamplesPerBit(transmitter.sampleRate, BAUD_RATE);
+        if (samplesPerBit != 0) {
+            fprintf(stderr, "Output: %u Hz, %u samples per bit, without resampling\n",
+                    transmitter.sampleRate, samplesPerBit);
+        } else {
+            fprintf(stderr, "Output: %u Hz, resampled\n", transmitter.sampleRate);
+        }
+    }
+    free(tuneCache);
 
-        uint32_t* transmission =
-             (uint32_t*) malloc(sizeof(uint32_t) * requiredMessageLength);
+    if (soakHours > 0 && outputPath == NULL) {
+        //The report goes to stdout
+        outputPath = "/dev/null";
+    }
+    if (outputPath != NULL) {
+        transmitter.out = fopen(outputPath, "wb");
+        if (transmitter.out == NULL) {
+            perror(outputPath);
+            return 1;
+        }
+    }
+    //A big buffer only pays off in a file; on a pipe it would hold pages back
+    struct stat outputInfo;
+    char* outputBuffer;
+    if (fstat(fileno(transmitter.out), &outputInfo) == 0 && S_ISREG(outputInfo.st_mode)
+            && (outputBuffer = (char*) malloc(OUTPUT_FILE_BUFFER)) != NULL) {
+        setvbuf(transmitter.out, outputBuffer, _IOFBF, OUTPUT_FILE_BUFFER);
+    }
+    char* shardManifest = NULL;
+    if (numShards > 1) {
+        indexPath = shardManifest = manifestPath(outputPath);
+    }
+    if (indexPath != NULL) {
+        transmitter.index = fopen(indexPath, "w");
+        if (transmitter.index == NULL) {
+            perror(indexPath);
+            return 1;
+        }
+        if (numShards > 1) {
+            fprintf(transmitter.index, "# shard %d/%d\n", shard, numShards);
+        }
+        fprintf(transmitter.index,
+                "# sample_offset sample_count address function crc32c\n");
+    }
+    free(shardManifest);
+    if (recorderPath != NULL) {
+        if (openRecorder(recorderPath, recorderMinutes, transmitter.sampleRate, &recorder) != 0) {
+            return 1;
+        }
+        transmitter.recorder = &recorder;
+    }
 
-        // NEU: functionCode wird übergeben
-        encodeTransmission(address, message, transmission, functionCode);
+    if (listenOn != NULL) {
+        //The event loop takes these from a signalfd, so no thread may
+        //handle them the usual way
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    }
+    if (transmitter.config != NULL) {
+        //Block SIGHUP before any other thread exists, so every thread
+        //inherits the mask and only the reload thread sees the signal
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+        pthread_t reloader;
+        if (pthread_create(&reloader, NULL, configReloadWorker, transmitter.config) != 0) {
+            fprintf(stderr, "Can't start the configuration reload thread\n");
+            return 1;
+        }
+        pthread_detach(reloader);
+    }
 
-        size_t pcmLength =
-             pcmTransmissionLength(SAMPLE_RATE, BAUD_RATE, requiredMessageLength);
+    if (statusPath != NULL && startWatchdog(&transmitter, statusPath, stallTimeout) != 0) {
+        return 1;
+    }
 
-        uint8_t* pcm =
-             (uint8_t*) malloc(sizeof(uint8_t) * pcmLength);
+    srand(time(NULL));
+    if (soakHours > 0) {
+        return runSoak(&transmitter, soakHours);
+    }
+    if (numCarriers > 0) {
+        return runMultiCarrier(&transmitter, carriers, numCarriers, channelSpacing,
+                               inputFormat, numThreads > 0 ? numThreads : 1);
+    }
+    if (beacon >= 0) {
+        return runBeacon(&transmitter, beacon, inputFormat, beaconGap, beaconRepeat);
+    }
+    if (listenOn != NULL) {
+        return runListen(&transmitter, listenOn, inputFormat);
+    }
+    if (inputPath != NULL) {
+        int result = transmitMappedFile(&transmitter, inputPath, inputFormat,
+                                        numThreads > 0 ? numThreads : 1, shard, numShards);
+        if (result == 0) {
+            finishTransmission(&transmitter);
+        }
+        return result;
+    }
 
-        pcmEncodeTransmission(
-                 SAMPLE_RATE, BAUD_RATE, transmission, requiredMessageLength, pcm);
+    inputSourceInit(&source, inputFormat);
+    if (capturePath != NULL) {
+        if (openCapture(capturePath, &capture) != 0) {
+            return 1;
+        }
+        source.capture = &capture;
+    }
+    if (replayPath != NULL) {
+        if (openReplay(replayPath, replaySpeed, &replay) != 0) {
+            return 1;
+        }
+        source.replay = &replay;
+    }
+    //A replay has its own timing, and is held up by the encoder on purpose
+    if (capturePath != NULL && replayPath == NULL
+            && inputSourceStart(&source, controlPath != NULL) != 0) {
+        return 1;
+    }
+    if (controlPath != NULL) {
+        return runQueued(&transmitter, &source, controlPath);
+    }
+    if (transmitter.slots != NULL) {
+        return runSlotted(&transmitter, &source);
+    }
 
-        //Write as series of little endian 16 bit samples
-        fwrite(pcm, sizeof(uint8_t), pcmLength, stdout);
+    //Read in lines from STDIN.
+    for (;;) {
+        Record record;
+        int error = nextRecord(&source, NULL, &record);
+        if (error == EOF) {
+            //Exit on EOF
+            finishTransmission(&transmitter);
+            return 0;
+        }
+        if (error == PARSE_IGNORED) {
+            continue;
+        }
+        if (error != PARSE_OK) {
+            printParseError(&record);
+            return 1;
+        }
 
-        free(transmission);
-        free(pcm);
+        transmitRecord(&transmitter, &record);
 
-        // --- Stille generieren
-        size_t silenceLength = rand() % (SAMPLE_RATE * (MAX_DELAY - MIN_DELAY)) + MIN_DELAY;
-        uint16_t* silence =
-             (uint16_t*) malloc(sizeof(uint16_t) * silenceLength);
-        bzero(silence, sizeof(uint16_t) * silenceLength);
-        fwrite(silence, sizeof(uint16_t), silenceLength, stdout);
-        free(silence);
+        //The queue is as deep as it gets until more input arrives
+        if (transmitter.scheduler != NULL && !inputSourcePending(&source)) {
+            schedulerFlush(&transmitter);
+        }
     }
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,580 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define POCSAG_LIBRARY
+#include "../pocsag.c"
+
+// =========================================================
+// PUFFER-OBJEKT (BUFFER PROTOCOL)
+// =========================================================
+
+/**
+ * Memory filled by the encoder, handed to Python without copying. It can be
+ * wrapped in memoryview(), numpy.frombuffer() or written to a file as is.
+ * The memory is freed with the last reference.
+ */
+typedef struct {
+    PyObject_HEAD
+    void* data;
+    Py_ssize_t numItems;
+    Py_ssize_t itemSize;
+    const char* format;
+} BufferObject;
+
+static void Buffer_dealloc(BufferObject* self) {
+    free(self->data);
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static int Buffer_getbuffer(BufferObject* self, Py_buffer* view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "encoder output is read-only");
+        view->obj = NULL;
+        return -1;
+    }
+    view->obj = (PyObject*) self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->numItems * self->itemSize;
+    view->readonly = 1;
+    view->itemsize = self->itemSize;
+    view->format = (flags & PyBUF_FORMAT) ? (char*) self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->numItems : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->itemSize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t Buffer_length(BufferObject* self) {
+    return self->numItems;
+}
+
+static PyBufferProcs Buffer_as_buffer = {
+    (getbufferproc) Buffer_getbuffer,
+    NULL,
+};
+
+static PySequenceMethods Buffer_as_sequence = {
+    .sq_length = (lenfunc) Buffer_length,
+};
+
+static PyTypeObject BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pocsag.Buffer",
+    .tp_doc = "Encoder output exposed through the buffer protocol.",
+    .tp_basicsize = sizeof(BufferObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) Buffer_dealloc,
+    .tp_as_buffer = &Buffer_as_buffer,
+    .tp_as_sequence = &Buffer_as_sequence,
+};
+
+// Codewörter sind uint32 in Maschinenreihenfolge, PCM immer S16LE
+#define CODEWORD_FORMAT "I"
+#if PY_LITTLE_ENDIAN
+#define PCM_FORMAT "h"
+#else
+#define PCM_FORMAT "<h"
+#endif
+
+/**
+ * Wraps malloc'd memory in a Buffer, taking ownership of it.
+ */
+static PyObject* newBuffer(void* data, Py_ssize_t numItems, Py_ssize_t itemSize, const char* format) {
+    BufferObject* buffer = PyObject_New(BufferObject, &BufferType);
+    if (buffer == NULL) {
+        free(data);
+        return NULL;
+    }
+    buffer->data = data;
+    buffer->numItems = numItems;
+    buffer->itemSize = itemSize;
+    buffer->format = format;
+    return (PyObject*) buffer;
+}
+
+/**
+ * Gets the uint32 values of a buffer in host byte order, e.g. array('I'), a
+ * numpy uint32 array or a codeword Buffer. Other formats, bytes included,
+ * are refused rather than reinterpreted. words points into the buffer, or,
+ * if it isn't aligned for uint32, into a copy in *copy, which the caller
+ * frees after releasing the view. Returns -1 with an exception set.
+ */
+static int getWords(PyObject* object, Py_buffer* view, const char* name,
+                    const uint32_t** words, uint32_t** copy) {
+    *copy = NULL;
+    if (PyObject_GetBuffer(object, view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0) {
+        return -1;
+    }
+    const char* format = view->format != NULL ? view->format : "B";
+    if (*format == '@' || *format == '=' || *format == (PY_LITTLE_ENDIAN ? '<' : '>')) {
+        format++;
+    }
+    if (view->itemsize != sizeof(uint32_t) || (strcmp(format, "I") != 0 && strcmp(format, "L") != 0)) {
+        PyErr_Format(PyExc_TypeError, "%s must be a buffer of uint32 in host byte order, not '%s'",
+                     name, view->format != NULL ? view->format : "B");
+        PyBuffer_Release(view);
+        return -1;
+    }
+
+    *words = (const uint32_t*) view->buf;
+    if ((uintptr_t) view->buf % sizeof(uint32_t) != 0) {
+        *copy = (uint32_t*) malloc(view->len > 0 ? view->len : 1);
+        if (*copy == NULL) {
+            PyBuffer_Release(view);
+            PyErr_NoMemory();
+            return -1;
+        }
+        memcpy(*copy, view->buf, view->len);
+        *words = *copy;
+    }
+    return 0;
+}
+
+
+// =========================================================
+// KODIERUNG
+// =========================================================
+
+/**
+ * One message of a call, with everything checked while the GIL is held.
+ */
+typedef struct {
+    uint32_t address;
+    FunctionCode functionCode;
+    const char* message;
+    Py_ssize_t length;
+    size_t numCodewords;
+    uint32_t* codewords;
+    size_t pcmLength;
+    uint8_t* pcm;
+} Job;
+
+static int checkMessage(unsigned long address, unsigned long functionCode) {
+    if (address > MAX_ADDRESS) {
+        PyErr_Format(PyExc_ValueError, "Address exceeds 21 bits: %lu", address);
+        return -1;
+    }
+    if (functionCode > 3) {
+        PyErr_Format(PyExc_ValueError,
+                     "Invalid Function: %lu. Must be between 0 and 3.", functionCode);
+        return -1;
+    }
+    if (addressWordReserved(address, functionCode)) {
+        PyErr_Format(PyExc_ValueError,
+                     "Address %lu with function %lu can't be paged: "
+                     "its address word is a SYNC or IDLE codeword", address, functionCode);
+        return -1;
+    }
+    return 0;
+}
+
+static int checkRates(unsigned long sampleRate, unsigned long baudRate) {
+    //pcmEncodeTransmission() needs whole SYMRATE samples per bit, and can
+    //only resample down, unless every bit is a whole number of samples
+    if (baudRate == 0 || baudRate > SYMRATE || SYMRATE % baudRate != 0 || sampleRate == 0
+            || (sampleRate > SYMRATE && pcmSamplesPerBit(sampleRate, baudRate) == 0)) {
+        PyErr_Format(PyExc_ValueError,
+                     "Unsupported rates: %lu Hz, %lu baud", sampleRate, baudRate);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Encodes a job, and renders it if sampleRate isn't 0. Runs without the
+ * GIL, so it must not touch any Python object. Returns 0 when out of memory,
+ * with nothing left allocated.
+ */
+static int runJob(Job* job, uint32_t sampleRate, uint32_t baudRate) {
+    job->numCodewords = messageLength(job->address, job->length, job->functionCode, PREAMBLE_LENGTH);
+    job->codewords = (uint32_t*) malloc(sizeof(uint32_t) * job->numCodewords);
+    if (job->codewords == NULL) {
+        return 0;
+    }
+    if (encodeTransmission(job->address, job->message, job->length,
+                           job->codewords, job->functionCode, PREAMBLE_LENGTH) != 0) {
+        free(job->codewords);
+        job->codewords = NULL;
+        return 0;
+    }
+
+    if (sampleRate != 0) {
+        job->pcmLength = pcmTransmissionLength(sampleRate, baudRate, job->numCodewords);
+        job->pcm = (uint8_t*) malloc(job->pcmLength);
+        if (job->pcm == NULL) {
+            free(job->codewords);
+            job->codewords = NULL;
+            return 0;
+        }
+        pcmEncodeTransmission(sampleRate, baudRate, job->codewords, job->numCodewords, PCM_LEVEL, job->pcm);
+    }
+    return 1;
+}
+
+PyDoc_STRVAR(encode_transmission_doc,
+"encode_transmission(address, message, function=3) -> Buffer\n\n"
+"Encodes a full transmission (preamble and batches) as uint32 codewords.");
+
+static PyObject* pocsag_encode_transmission(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = { "address", "message", "function", NULL };
+    Job job;
+    unsigned long address;
+    unsigned long functionCode = FLAG_FUNC_3;
+    memset(&job, 0, sizeof(job));
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ks#|k", keywords,
+                                     &address, &job.message, &job.length, &functionCode)
+            || checkMessage(address, functionCode) != 0) {
+        return NULL;
+    }
+    job.address = address;
+    job.functionCode = functionCode;
+
+    int ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = runJob(&job, 0, 0);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        return PyErr_NoMemory();
+    }
+    return newBuffer(job.codewords, job.numCodewords, sizeof(uint32_t), CODEWORD_FORMAT);
+}
+
+PyDoc_STRVAR(pcm_encode_transmission_doc,
+"pcm_encode_transmission(codewords, sample_rate=22050, baud_rate=512) -> Buffer\n\n"
+"Renders codewords (a uint32 buffer, e.g. from encode_transmission or\n"
+"array('I')) as signed 16 bit little-endian samples.");
+
+static PyObject* pocsag_pcm_encode_transmission(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = { "codewords", "sample_rate", "baud_rate", NULL };
+    PyObject* object;
+    Py_buffer codewords;
+    const uint32_t* words;
+    uint32_t* copy;
+    unsigned long sampleRate = SAMPLE_RATE;
+    unsigned long baudRate = BAUD_RATE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|kk", keywords,
+                                     &object, &sampleRate, &baudRate)) {
+        return NULL;
+    }
+    if (checkRates(sampleRate, baudRate) != 0
+            || getWords(object, &codewords, "codewords", &words, &copy) != 0) {
+        return NULL;
+    }
+
+    size_t numCodewords = codewords.len / sizeof(uint32_t);
+    size_t pcmLength = pcmTransmissionLength(sampleRate, baudRate, numCodewords);
+    uint8_t* pcm = (uint8_t*) malloc(pcmLength > 0 ? pcmLength : 1);
+    if (pcm == NULL) {
+        PyBuffer_Release(&codewords);
+        free(copy);
+        return PyErr_NoMemory();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pcmEncodeTransmission(sampleRate, baudRate, (uint32_t*) words, numCodewords, PCM_LEVEL, pcm);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&codewords);
+    free(copy);
+
+    return newBuffer(pcm, pcmLength / 2, sizeof(int16_t), PCM_FORMAT);
+}
+
+PyDoc_STRVAR(encode_batch_doc,
+"encode_batch(messages, pcm=False, sample_rate=22050, baud_rate=512) -> list\n\n"
+"Encodes many (address, message) or (address, message, function) tuples\n"
+"in one call, with the GIL released for the whole batch. Returns a list of\n"
+"codeword Buffers, or of PCM Buffers if pcm is true.");
+
+static PyObject* pocsag_encode_batch(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = { "messages", "pcm", "sample_rate", "baud_rate", NULL };
+    PyObject* messages;
+    int wantPcm = 0;
+    unsigned long sampleRate = SAMPLE_RATE;
+    unsigned long baudRate = BAUD_RATE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pkk", keywords,
+                                     &messages, &wantPcm, &sampleRate, &baudRate)) {
+        return NULL;
+    }
+    if (wantPcm && checkRates(sampleRate, baudRate) != 0) {
+        return NULL;
+    }
+
+    //The sequence keeps every message string alive while the GIL is released
+    PyObject* sequence = PySequence_Fast(messages, "messages must be a sequence");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+    Job* jobs = (Job*) calloc(count > 0 ? count : 1, sizeof(Job));
+    if (jobs == NULL) {
+        Py_DECREF(sequence);
+        return PyErr_NoMemory();
+    }
+
+    PyObject* result = NULL;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        unsigned long address;
+        unsigned long functionCode = FLAG_FUNC_3;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "ks#|k;message tuple",
+                              &address, &jobs[i].message, &jobs[i].length, &functionCode)
+                || checkMessage(address, functionCode) != 0) {
+            goto done;
+        }
+        jobs[i].address = address;
+        jobs[i].functionCode = functionCode;
+    }
+
+    int ok = 1;
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < count && ok; i++) {
+        ok = runJob(&jobs[i], wantPcm ? sampleRate : 0, baudRate);
+    }
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    result = PyList_New(count);
+    for (Py_ssize_t i = 0; result != NULL && i < count; i++) {
+        PyObject* buffer;
+        if (wantPcm) {
+            buffer = newBuffer(jobs[i].pcm, jobs[i].pcmLength / 2, sizeof(int16_t), PCM_FORMAT);
+            jobs[i].pcm = NULL;
+        } else {
+            buffer = newBuffer(jobs[i].codewords, jobs[i].numCodewords,
+                               sizeof(uint32_t), CODEWORD_FORMAT);
+            jobs[i].codewords = NULL;
+        }
+        if (buffer == NULL) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, i, buffer);
+    }
+
+done:
+    for (Py_ssize_t i = 0; i < count; i++) {
+        free(jobs[i].codewords);
+        free(jobs[i].pcm);
+    }
+    free(jobs);
+    Py_DECREF(sequence);
+    return result;
+}
+
+PyDoc_STRVAR(encode_arrays_doc,
+"encode_arrays(addresses, messages, functions=None, threads=0) -> (Buffer, Buffer)\n\n"
+"Encodes many messages into one contiguous codeword Buffer. addresses and\n"
+"functions are uint32 buffers (e.g. array('I') or a numpy uint32 array),\n"
+"messages a sequence of str or bytes of the same length. Also returns the\n"
+"offsets Buffer (size_t): transmission i is codewords[offsets[i]:offsets[i+1]].\n"
+"threads=0 uses one thread per CPU.");
+
+/**
+ * Checks that a buffer holds `count` uint32 values.
+ */
+static int checkArray(const Py_buffer* buffer, Py_ssize_t count, const char* name) {
+    if (buffer->len != count * (Py_ssize_t) sizeof(uint32_t)) {
+        PyErr_Format(PyExc_ValueError, "%s must hold one uint32 per message", name);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* pocsag_encode_arrays(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = { "addresses", "messages", "functions", "threads", NULL };
+    PyObject* addressObject;
+    PyObject* functionObject = Py_None;
+    Py_buffer addresses;
+    Py_buffer functions = { NULL };
+    uint32_t* addressCopy;
+    uint32_t* functionCopy = NULL;
+    PyObject* messages;
+    int numThreads = 0;
+    MessageArrays arrays;
+    arrays.functionCodes = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Oi", keywords,
+                                     &addressObject, &messages, &functionObject, &numThreads)) {
+        return NULL;
+    }
+    if (getWords(addressObject, &addresses, "addresses", &arrays.addresses, &addressCopy) != 0) {
+        return NULL;
+    }
+    if (functionObject != Py_None
+            && getWords(functionObject, &functions, "functions", &arrays.functionCodes,
+                        &functionCopy) != 0) {
+        PyBuffer_Release(&addresses);
+        free(addressCopy);
+        return NULL;
+    }
+
+    //The sequence keeps every message string alive while the GIL is released
+    PyObject* result = NULL;
+    PyObject* sequence = PySequence_Fast(messages, "messages must be a sequence");
+    Py_ssize_t count = sequence != NULL ? PySequence_Fast_GET_SIZE(sequence) : 0;
+    arrays.count = count;
+    const char** texts = (const char**) malloc(sizeof(char*) * (count + 1));
+    uint32_t* lengths = (uint32_t*) malloc(sizeof(uint32_t) * (count + 1));
+    size_t* offsets = (size_t*) malloc(sizeof(size_t) * (count + 1));
+    uint32_t* codewords = NULL;
+    if (sequence == NULL || checkArray(&addresses, count, "addresses") != 0
+            || (arrays.functionCodes != NULL && checkArray(&functions, count, "functions") != 0)) {
+        goto done;
+    }
+    if (texts == NULL || lengths == NULL || offsets == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(sequence, i);
+        Py_ssize_t length;
+        if (PyUnicode_Check(item)) {
+            texts[i] = PyUnicode_AsUTF8AndSize(item, &length);
+        } else if (PyBytes_AsStringAndSize(item, (char**) &texts[i], &length) != 0) {
+            texts[i] = NULL;
+        }
+        if (texts[i] == NULL) {
+            goto done;
+        }
+        if (length >= (1 << 28)) {
+            PyErr_SetString(PyExc_ValueError, "message too long");
+            goto done;
+        }
+        lengths[i] = length;
+        if (checkMessage(arrays.addresses[i],
+                         arrays.functionCodes != NULL ? arrays.functionCodes[i] : FLAG_FUNC_3) != 0) {
+            goto done;
+        }
+    }
+    arrays.messages = texts;
+    arrays.lengths = lengths;
+
+    size_t total = transmissionOffsets(arrays.addresses, lengths, count, PREAMBLE_LENGTH, offsets);
+    codewords = (uint32_t*) malloc(sizeof(uint32_t) * (total > 0 ? total : 1));
+    if (codewords == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (numThreads <= 0) {
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    int failed;
+    Py_BEGIN_ALLOW_THREADS
+    failed = encodeTransmissions(&arrays, PREAMBLE_LENGTH, offsets, codewords, numThreads);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    //newBuffer() owns the memory from here on, even if it fails
+    PyObject* words = newBuffer(codewords, total, sizeof(uint32_t), CODEWORD_FORMAT);
+    codewords = NULL;
+    PyObject* starts = NULL;
+    if (words != NULL) {
+        starts = newBuffer(offsets, count + 1, sizeof(size_t), "N");
+        offsets = NULL;
+    }
+    if (starts != NULL) {
+        result = PyTuple_Pack(2, words, starts);
+    }
+    Py_XDECREF(words);
+    Py_XDECREF(starts);
+
+done:
+    free(codewords);
+    free(offsets);
+    free(lengths);
+    free(texts);
+    Py_XDECREF(sequence);
+    PyBuffer_Release(&addresses);
+    free(addressCopy);
+    if (arrays.functionCodes != NULL) {
+        PyBuffer_Release(&functions);
+        free(functionCopy);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(message_length_doc,
+"message_length(address, num_chars, function=3) -> int\n\n"
+"Number of codewords in the transmission of a message.");
+
+static PyObject* pocsag_message_length(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = { "address", "num_chars", "function", NULL };
+    unsigned long address;
+    Py_ssize_t numChars;
+    unsigned long functionCode = FLAG_FUNC_3;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "kn|k", keywords,
+                                     &address, &numChars, &functionCode)
+            || checkMessage(address, functionCode) != 0) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(messageLength(address, numChars, functionCode, PREAMBLE_LENGTH));
+}
+
+PyDoc_STRVAR(pcm_transmission_length_doc,
+"pcm_transmission_length(sample_rate, baud_rate, transmission_length) -> int\n\n"
+"Size in bytes of the PCM rendering of transmission_length codewords.");
+
+static PyObject* pocsag_pcm_transmission_length(PyObject* self, PyObject* args) {
+    unsigned long sampleRate;
+    unsigned long baudRate;
+    Py_ssize_t transmissionLength;
+    if (!PyArg_ParseTuple(args, "kkn", &sampleRate, &baudRate, &transmissionLength)
+            || checkRates(sampleRate, baudRate) != 0) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(pcmTransmissionLength(sampleRate, baudRate, transmissionLength));
+}
+
+
+// =========================================================
+// MODUL
+// =========================================================
+
+static PyMethodDef pocsagMethods[] = {
+    { "encode_transmission", (PyCFunction) (void (*)(void)) pocsag_encode_transmission,
+      METH_VARARGS | METH_KEYWORDS, encode_transmission_doc },
+    { "pcm_encode_transmission", (PyCFunction) (void (*)(void)) pocsag_pcm_encode_transmission,
+      METH_VARARGS | METH_KEYWORDS, pcm_encode_transmission_doc },
+    { "encode_batch", (PyCFunction) (void (*)(void)) pocsag_encode_batch,
+      METH_VARARGS | METH_KEYWORDS, encode_batch_doc },
+    { "encode_arrays", (PyCFunction) (void (*)(void)) pocsag_encode_arrays,
+      METH_VARARGS | METH_KEYWORDS, encode_arrays_doc },
+    { "message_length", (PyCFunction) (void (*)(void)) pocsag_message_length,
+      METH_VARARGS | METH_KEYWORDS, message_length_doc },
+    { "pcm_transmission_length", pocsag_pcm_transmission_length,
+      METH_VARARGS, pcm_transmission_length_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef pocsagModule = {
+    PyModuleDef_HEAD_INIT,
+    "pocsag",
+    "POCSAG encoder, see pocsag.c.",
+    -1,
+    pocsagMethods,
+};
+
+PyMODINIT_FUNC PyInit_pocsag(void) {
+    if (PyType_Ready(&BufferType) < 0) {
+        return NULL;
+    }
+    PyObject* module = PyModule_Create(&pocsagModule);
+    if (module == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&BufferType);
+    if (PyModule_AddObject(module, "Buffer", (PyObject*) &BufferType) < 0
+            || PyModule_AddIntConstant(module, "SAMPLE_RATE", SAMPLE_RATE) < 0
+            || PyModule_AddIntConstant(module, "BAUD_RATE", BAUD_RATE) < 0) {
+        Py_DECREF(&BufferType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
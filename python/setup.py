@@ -0,0 +1,18 @@
+from setuptools import setup, Extension
+
+# pocsagmodule.c compiles ../pocsag.c in directly, without its main().
+setup(
+    name="pocsag",
+    version="0.1",
+    description="POCSAG encoder",
+    ext_modules=[
+        Extension(
+            "pocsag",
+            sources=["pocsagmodule.c"],
+            depends=["../pocsag.c"],
+            extra_compile_args=["-std=c99", "-pthread"],
+            extra_link_args=["-pthread"],
+            libraries=["m"],
+        )
+    ],
+)
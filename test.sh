@@ -61,6 +61,30 @@ diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
 
 
 
+echo "Test - Address whose address word is IDLE fails"
+
+printf "Address 2007664 with function 0 can't be paged: its address word is a SYNC or IDLE codeword\n" > "${TMP}/expected.txt"
+
+! ( printf "2007664:0:idle" | ./pocsag >/dev/null 2> "${TMP}/result.txt" )
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+
+echo "Test - Every address and message length decodes back"
+
+./pocsag --sweep > /dev/null
+
+
+
+echo "Test - Output matches the golden corpus bit for bit"
+
+./pocsag --golden golden.txt > /dev/null
+sed '4s/^......../00000000/' golden.txt > "${TMP}/golden.txt"
+! ./pocsag --golden "${TMP}/golden.txt" > /dev/null 2>&1
+
+
+
 echo "Test - no messages prints nothing"
 
 [[ "$(printf "" | ./pocsag | wc -c)" = 0 ]]
@@ -78,6 +102,440 @@ printf "1:\n2:" | ./pocsag | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.t
 diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
 
 
+echo "Test - Messages read from a mapped file"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+POCSAG512: Address:       3  Function: 3  Alpha:   world
+' > "${TMP}/expected.txt"
+
+printf "1:hello\r\n3:world\n" > "${TMP}/input.txt"
+./pocsag --input "${TMP}/input.txt" --threads 2 | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - multimon-ng logs are regenerated to the same pages"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+POCSAG512: Address: 2097151  Function: 3  Alpha:   biggest address<NUL><NUL>
+' > "${TMP}/expected.txt"
+
+./pocsag --input-format multimon < "${TMP}/expected.txt" | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Beacon repeats the same page"
+
+printf 'POCSAG512: Address:       9  Function: 3  Alpha:   again
+POCSAG512: Address:       9  Function: 3  Alpha:   again
+POCSAG512: Address:       9  Function: 3  Alpha:   again
+' > "${TMP}/expected.txt"
+
+printf "9:again" | ./pocsag --beacon page --gap 1 --repeat 3 | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Python module renders the same samples as the command line"
+
+make python >/dev/null
+printf "9:again" | ./pocsag --beacon page --repeat 1 > "${TMP}/cli.raw"
+PYTHONPATH=python python3 -c '
+import sys, pocsag
+pcm = pocsag.encode_batch([(9, "again")], pcm=True)[0]
+sys.exit(bytes(pcm) != open(sys.argv[1], "rb").read())
+' "${TMP}/cli.raw"
+
+
+echo "Test - Array encoding matches encoding one message at a time"
+
+PYTHONPATH=python python3 -c '
+import array, sys, pocsag
+addresses = array.array("I", [1, 3, 2097151, 9] * 100)
+messages = ["hello", "world", "biggest address", b"again"] * 100
+codewords, offsets = pocsag.encode_arrays(addresses, messages, threads=4)
+single = b"".join(bytes(c) for c in pocsag.encode_batch(list(zip(addresses, messages))))
+sys.exit(bytes(codewords) != single or memoryview(offsets)[-1] != len(codewords))
+'
+
+
+echo "Test - Dump verifies against its index"
+
+printf "1:hello\n3:world" | ./pocsag --index "${TMP}/index.txt" > "${TMP}/dump.raw"
+
+./pocsag --verify "${TMP}/index.txt" "${TMP}/dump.raw" > /dev/null
+
+
+echo "Test - Corrupted dump fails verification"
+
+printf '\x55' | dd of="${TMP}/dump.raw" bs=1 seek=30000 conv=notrunc 2>/dev/null
+
+! ./pocsag --verify "${TMP}/index.txt" "${TMP}/dump.raw" > /dev/null
+
+
+echo "Test - Flight recorder holds the end of the output"
+
+printf "1:hello\n3:world\n7:recorded\n2097151:biggest address\n" | ./pocsag --seed 3 --recorder "${TMP}/recorder" 0.25 > "${TMP}/full.raw"
+./pocsag --extract "${TMP}/recorder" 0.2 "${TMP}/last.raw" > "${TMP}/last.idx"
+
+tail -c "$(stat -c %s "${TMP}/last.raw")" "${TMP}/full.raw" | cmp - "${TMP}/last.raw"
+./pocsag --verify "${TMP}/last.idx" "${TMP}/last.raw" > /dev/null
+
+
+echo "Test - Merged shards are identical to a single run"
+
+printf "1:hello\n3:world\n7:sharded\n2097151:biggest address\n" > "${TMP}/input.txt"
+./pocsag --input "${TMP}/input.txt" --seed 7 --output "${TMP}/single.raw" --index "${TMP}/single.idx"
+for k in 0 1 2; do
+    ./pocsag --input "${TMP}/input.txt" --seed 7 --shard "${k}/3" --output "${TMP}/part${k}.raw"
+done
+./pocsag --merge "${TMP}/merged.raw" "${TMP}/part2.raw" "${TMP}/part0.raw" "${TMP}/part1.raw"
+
+cmp "${TMP}/single.raw" "${TMP}/merged.raw"
+cmp "${TMP}/single.idx" "${TMP}/merged.raw.manifest"
+
+
+echo "Test - Repeated page within the dedup window is sent once"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+' > "${TMP}/expected.txt"
+
+printf "1:hello\n1:hello" | ./pocsag --dedup-window 60 2>/dev/null | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Rate limit throttles a single pager"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   first
+POCSAG512: Address:       2  Function: 3  Alpha:   third
+' > "${TMP}/expected.txt"
+
+printf "1:first\n1:again\n2:third" | ./pocsag --rate-limit 1/3600 2>/dev/null | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Settings from a config file still decode"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+' > "${TMP}/expected.txt"
+
+printf "# quiet and short\nmin_delay = 0\nmax_delay = 0\npreamble_length = 1024\nlevel = 4000\n" > "${TMP}/pocsag.conf"
+printf "1:hello" | ./pocsag --config "${TMP}/pocsag.conf" | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - SIGHUP reloads the config between messages"
+
+rm -f "${TMP}/fifo"
+mkfifo "${TMP}/fifo"
+./pocsag --config "${TMP}/pocsag.conf" --index "${TMP}/index.txt" < "${TMP}/fifo" > /dev/null 2>&1 &
+exec 3> "${TMP}/fifo"
+echo "1:hello" >&3
+sleep 1
+printf "preamble_length = 576\n" > "${TMP}/pocsag.conf"
+kill -HUP $!
+sleep 1
+echo "1:hello" >&3
+exec 3>&-
+wait $!
+
+[[ "$(grep -v '^#' "${TMP}/index.txt" | cut -d' ' -f2 | tr '\n' ' ')" = "67528 48234 " ]]
+
+
+echo "Test - Capable pagers are grouped into faster transmissions under load"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+POCSAG1200: Address:       9  Function: 3  Alpha:   again
+POCSAG1200: Address:       3  Function: 3  Alpha:   world
+POCSAG512: Address:       7  Function: 3  Alpha:   slow
+' > "${TMP}/expected.txt"
+
+./pocsag --set-capability "${TMP}/capabilities" 3 1200
+./pocsag --set-capability "${TMP}/capabilities" 9 1200
+printf "1:hello\n3:world\n7:slow\n9:again\n" | ./pocsag --capabilities "${TMP}/capabilities" --queue-threshold 3 | multimon-ng -c -a POCSAG512 -a POCSAG1200 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Two carriers in one IQ stream decode separately"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+POCSAG512: Address:       3  Function: 3  Alpha:   world
+' > "${TMP}/expected.txt"
+
+printf "1:hello\n3:world\n" > "${TMP}/low.txt"
+printf "9:again\n" > "${TMP}/high.txt"
+printf "min_delay = 0\nmax_delay = 0\n" > "${TMP}/iq.conf"
+./pocsag --config "${TMP}/iq.conf" --carrier -12500 "${TMP}/low.txt" --carrier 25000 "${TMP}/high.txt" > "${TMP}/iq.raw" 2>/dev/null
+
+# Mix the carrier at -12500 Hz down (8 channels of 12500 Hz), average over
+# a channel sample and turn the direction of the phase into audio samples
+python3 -c '
+import cmath, math, struct, sys
+raw = open(sys.argv[1], "rb").read()
+iq = struct.unpack("<%dh" % (len(raw) // 2), raw)
+turn, osc, previous, audio = cmath.exp(2j * math.pi / 8), 1, 0, []
+for m in range(len(iq) // 16):
+    acc = 0
+    for n in range(8 * m, 8 * m + 8):
+        acc += complex(iq[2 * n], iq[2 * n + 1]) * osc
+        osc *= turn
+    swing = (acc * previous.conjugate()).imag
+    audio.append(0 if abs(acc) < 24000 else 16000 if swing > 0 else -16000)
+    previous = acc
+pcm = [audio[i * 12500 // 22050] for i in range(len(audio) * 22050 // 12500)]
+sys.stdout.buffer.write(struct.pack("<%dh" % len(pcm), *pcm))
+' "${TMP}/iq.raw" | multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt"
+
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Queued messages can be cancelled over the control socket"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   first
+POCSAG512: Address:       3  Function: 3  Alpha:   third
+' > "${TMP}/expected.txt"
+
+printf 'b cancelled
+a sending
+c pending 0
+' > "${TMP}/expected-replies.txt"
+
+rm -f "${TMP}/fifo" "${TMP}/go"
+mkfifo "${TMP}/fifo" "${TMP}/go"
+# Nothing is read until the replies are in, which keeps the first page on air
+./pocsag --control "${TMP}/control" < "${TMP}/fifo" | (read go < "${TMP}/go"; multimon-ng -c -a POCSAG512 -q - > "${TMP}/result.txt") &
+exec 3> "${TMP}/fifo"
+printf "@a 1:first\n@b 2:second\n@c 3:third\n" >&3
+python3 -c '
+import socket, sys, time
+def connect():
+    while True:
+        try:
+            client = socket.socket(socket.AF_UNIX)
+            client.connect(sys.argv[1])
+            return client
+        except OSError:
+            time.sleep(0.05)
+# A client which stays connected must not lock the others out
+idle = connect()
+control = connect()
+replies = control.makefile()
+def ask(command):
+    control.sendall(command.encode() + b"\n")
+    return replies.readline()
+while ask("status a") != "a sending\n" or ask("status c") != "c pending 2\n":
+    time.sleep(0.05)
+control.sendall(b"cancel b\nstatus a\npriority c 0\n")
+control.shutdown(socket.SHUT_WR)
+sys.stdout.write(replies.read())
+' "${TMP}/control" > "${TMP}/replies.txt"
+echo > "${TMP}/go"
+exec 3>&-
+wait $!
+
+diff -q "${TMP}/expected-replies.txt" "${TMP}/replies.txt"
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - A filtered message is reported as dropped, not sent"
+
+rm -f "${TMP}/fifo"
+mkfifo "${TMP}/fifo"
+./pocsag --dedup-window 60 --control "${TMP}/control" < "${TMP}/fifo" > /dev/null &
+exec 3> "${TMP}/fifo"
+printf "@a 1:same\n@b 1:same\n" >&3
+python3 -c '
+import socket, sys, time
+while True:
+    try:
+        control = socket.socket(socket.AF_UNIX)
+        control.connect(sys.argv[1])
+        break
+    except OSError:
+        time.sleep(0.05)
+replies = control.makefile()
+def ask(command):
+    control.sendall(command.encode() + b"\n")
+    return replies.readline()
+while ask("status b") in ("b unknown\n", "b pending 2\n", "b sending\n"):
+    time.sleep(0.05)
+sys.stdout.write(ask("status a") + ask("status b"))
+' "${TMP}/control" > "${TMP}/replies.txt"
+exec 3>&-
+wait $!
+
+[[ "$(cat "${TMP}/replies.txt")" = "$(printf 'a sent\nb dropped')" ]]
+
+
+echo "Test - Two sites only transmit in their own slots"
+
+printf 'POCSAG512: Address:       1  Function: 3  Alpha:   hello
+POCSAG512: Address:       2  Function: 3  Alpha:   world
+' > "${TMP}/expected.txt"
+
+printf "period = 8\nguard = 0.25\nslot = north 0 4\nslot = south 4 4\n" > "${TMP}/schedule.txt"
+./pocsag --serve-slots "${TMP}/slots" "${TMP}/schedule.txt" &
+server=$!
+sleep 0.5
+printf "1:hello\n2:world\n" | ./pocsag --slots "${TMP}/schedule.txt" north --stats \
+    --index "${TMP}/north.index" > "${TMP}/north.raw" 2> "${TMP}/north.txt" &
+north=$!
+printf "1:hello\n2:world\n" | ./pocsag --slots "${TMP}/slots" south --stats \
+    --index "${TMP}/south.index" > "${TMP}/south.raw" 2> "${TMP}/south.txt"
+wait $north
+kill $server
+
+# Every transmission has to start and end inside the slot, less the guard;
+# both pages fit into one
+for site in north:0:3.75 south:4:7.75; do
+    IFS=: read name first last <<< "$site"
+    phase="$(sed -n 's/.*first sample \([0-9.]*\) s into the period/\1/p' "${TMP}/${name}.txt")"
+    awk -v phase="$phase" -v first="$first" -v last="$last" '
+        /^[0-9]/ { start = phase + $1 / 22050; start -= 8 * int(start / 8); transmissions++
+                   if (start < first - 0.001 || start + $2 / 22050 > last + 0.001) bad = 1 }
+        END { exit bad || transmissions != 1 }' "${TMP}/${name}.index"
+done
+multimon-ng -c -a POCSAG512 -q "${TMP}/north.raw" > "${TMP}/result.txt"
+diff -q "${TMP}/expected.txt" "${TMP}/result.txt"
+
+
+echo "Test - Status file shows a blocked output and the final state"
+
+rm -f "${TMP}/fifo"
+mkfifo "${TMP}/fifo"
+# Nobody reads the pipe at first, so a write blocks once it is full
+exec 4<> "${TMP}/fifo"
+printf "1:hello\n2:world\n" | ./pocsag --status "${TMP}/status.txt" --stall-timeout 1 \
+    > "${TMP}/fifo" 2> /dev/null &
+writer=$!
+sleep 3
+grep -q "^stalled = 1$" "${TMP}/status.txt"
+grep -q "^queue_depth = 1$" "${TMP}/status.txt"
+cat <&4 > /dev/null &
+reader=$!
+wait $writer
+kill $reader
+exec 4>&-
+
+grep -q "^stalled = 0$" "${TMP}/status.txt"
+grep -q "^messages_sent = 2$" "${TMP}/status.txt"
+grep -q "^finished = 1$" "${TMP}/status.txt"
+
+
+echo "Test - A replayed capture renders the same output"
+
+printf "1:hello\n3:world\n7:captured\n" | ./pocsag --seed 5 --capture "${TMP}/capture.bin" > "${TMP}/live.raw"
+./pocsag --seed 5 --replay "${TMP}/capture.bin" --speed max > "${TMP}/replay.raw" 2>/dev/null
+
+cmp "${TMP}/live.raw" "${TMP}/replay.raw"
+
+
+echo "Test - A capture with an impossible address stops the replay"
+
+# Address 2^32 + 1, which would wrap to 1 if it were cut to 32 bits
+printf 'PCSGCAP1\0\0\201\200\200\200\020\3\0\1x' > "${TMP}/capture.bin"
+! ./pocsag --replay "${TMP}/capture.bin" --speed max > "${TMP}/replay.raw" 2> "${TMP}/result.txt"
+
+grep -q "^Address exceeds 21 bits" "${TMP}/result.txt"
+[[ ! -s "${TMP}/replay.raw" ]]
+
+
+echo "Test - Tuned kernels render the same output as the plain ones"
+
+printf "version = 1\nmachine = %s\ncodeword = bitwise\npacking = bitwise\npcm = resampled\n" \
+    "$(uname -m)" > "${TMP}/plain.tune"
+printf "1:hello\n3:world\n7:a somewhat longer page, to cross a batch or two\n" > "${TMP}/input.txt"
+./pocsag --seed 6 --tune-cache "${TMP}/plain.tune" --stats < "${TMP}/input.txt" > "${TMP}/plain.raw" 2> "${TMP}/stats.txt"
+./pocsag --seed 6 --tune-cache "${TMP}/tuned.tune" --retune < "${TMP}/input.txt" > "${TMP}/tuned.raw"
+mkdir -p "${TMP}/home"
+HOME="${TMP}/home" XDG_CACHE_HOME= ./pocsag --seed 6 --stats < "${TMP}/input.txt" > "${TMP}/default.raw" 2> "${TMP}/default.txt"
+
+grep -q "^Kernels: codeword bitwise, packing bitwise, pcm resampled" "${TMP}/stats.txt"
+grep -q "^Sent 3 messages" "${TMP}/stats.txt"
+grep -q "^codeword = " "${TMP}/tuned.tune"
+grep -q "^Kernels: .*(default)" "${TMP}/default.txt"
+test -z "$(ls -A "${TMP}/home")"
+cmp "${TMP}/plain.raw" "${TMP}/tuned.raw"
+cmp "${TMP}/plain.raw" "${TMP}/default.raw"
+
+
+echo "Test - Analysis moves pagers out of an overloaded frame"
+
+printf "8:aaaaaaaaaaaaaaaaaaaa\n16:bbbbbbbbbbbbbbbbbbbb\n24:cccccccccccccccccccc\n32:dddddddddddddddddddd\n" > "${TMP}/input.txt"
+./pocsag --analyse --input "${TMP}/input.txt" > "${TMP}/result.txt"
+
+grep -q "^0 4 32 100.0%$" "${TMP}/result.txt"
+grep -q "^8 9 8$" "${TMP}/result.txt"
+
+
+echo "Test - Analysis wraps around to free capcodes below the busy ones"
+
+# Every capcode in the top two blocks is in use, so the move has to wrap
+for k in 1 2 3 4 5; do
+    printf "2097144:%s\n2097136:%s\n" "$(printf 'a%.0s' {1..65})" "$(printf 'b%.0s' {1..50})"
+done > "${TMP}/input.txt"
+for address in $(seq 2097137 2097143) $(seq 2097145 2097151); do
+    echo "${address}:x"
+done >> "${TMP}/input.txt"
+./pocsag --analyse --input "${TMP}/input.txt" > "${TMP}/result.txt"
+
+grep -q "^2097136 1 95$" "${TMP}/result.txt"
+
+
+echo "Test - A soak run shows no memory growth"
+
+./pocsag --soak 1 > "${TMP}/result.txt"
+
+[[ "$(grep -c "^ *[0-9.]* *[0-9]* " "${TMP}/result.txt")" = 20 ]]
+! grep -q "grows" "${TMP}/result.txt"
+
+
+echo "Test - Whole samples per bit are rendered without resampling"
+
+printf "1:hello" | ./pocsag --sample-rate 38400 --stats > "${TMP}/result.raw" 2> "${TMP}/stats.txt"
+
+grep -q "^Output: 38400 Hz, 75 samples per bit" "${TMP}/stats.txt"
+# The 576 bit preamble alternates every 75 samples
+[[ "$(od -An -v -td2 -w2 "${TMP}/result.raw" | head -n 43200 | uniq -c | awk '{print $1}' | sort -u)" = 75 ]]
+
+
+echo "Test - Pages from many clients on the listening socket are all sent"
+
+printf 'ok
+error missing colon
+ignored
+error address exceeds 21 bits
+ok
+' > "${TMP}/expected-replies.txt"
+
+rm -f "${TMP}/pages"
+./pocsag --listen "${TMP}/pages" --stats > "${TMP}/result.raw" 2> "${TMP}/stats.txt" &
+server=$!
+while [[ ! -S "${TMP}/pages" ]]; do sleep 0.1; done
+./pocsag --listen-bench "${TMP}/pages" 20 2 > "${TMP}/bench.txt"
+python3 -c '
+import socket, sys
+client = socket.socket(socket.AF_UNIX)
+client.connect(sys.argv[1])
+client.sendall(b"1:first\nno colon\n\n9999999:too far\n3:last, without newline")
+client.shutdown(socket.SHUT_WR)
+sys.stdout.write(client.makefile().read())
+' "${TMP}/pages" > "${TMP}/replies.txt"
+kill -TERM $server
+wait $server
+
+diff -q "${TMP}/expected-replies.txt" "${TMP}/replies.txt"
+grep -q "^Sent 40 pages" "${TMP}/bench.txt"
+grep -q "^Accepted 42 pages from 21 clients" "${TMP}/stats.txt"
+[[ ! -e "${TMP}/pages" ]]
+[[ "$(multimon-ng -c -a POCSAG512 -q "${TMP}/result.raw" | grep -c "Alpha:")" = 42 ]]
+
+
 echo "Test - No colon is an error"
 
 printf 'Malformed Line!\n' > "${TMP}/expected.txt"